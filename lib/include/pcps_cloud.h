@@ -56,6 +56,13 @@ public:
      */
     bool hasValidSize() const noexcept;
 
+    /**
+     * @brief Retrieves the ratio of stored points with finite coordinates [0..1].
+     *
+     * For organized clouds it indicates how much of the cloud area is filled with valid points.
+     */
+    float getFillRatio() const noexcept;
+
     /**
      * @brief Copies the content of this cloud to another one.
      * @param other Output point cloud.
@@ -7,7 +7,10 @@
 #ifndef PCPS_CONTEXT_H
 #define PCPS_CONTEXT_H
 
+#include <mutex>
+#include <string>
 #include <memory>
+#include <cstdint>
 
 #ifdef PCPS_OPENCL
     namespace boost
@@ -31,6 +34,15 @@
 namespace pcps
 {
 
+///@cond INTERNAL
+class ThreadPool;
+
+#ifdef PCPS_OPENCL
+    class ProgramCache;
+    class DeviceBufferPool;
+#endif
+///@endcond
+
 /**
  * @brief Manages a set of resources including memory buffers and program objects.
  */
@@ -60,6 +72,72 @@ public:
          * @param queue boost::compute queue.
          */
         Context(const boost::compute::context& context, boost::compute::command_queue& queue) noexcept;
+
+        /**
+         * @brief Indicates if the device can access host memory without copies, as CPU devices,
+         * integrated GPUs or PoCL ones.
+         *
+         * Otherwise, device clouds are copied to pooled device buffers through pinned host staging buffers.
+         */
+        bool hasZeroCopyHostMemory();
+
+        /**
+         * @brief Retrieves the number of device buffers allocated by this context since it was created.
+         *
+         * Device buffers are pooled and reused across frames,
+         * so the difference between two frames should be zero in steady state.
+         */
+        std::uint64_t getDeviceBufferAllocations();
+
+        /**
+         * @brief Retrieves the number of device buffers reused from the pool since this context was created.
+         */
+        std::uint64_t getDeviceBufferReuses();
+
+        /**
+         * @brief Retrieves the directory in which compiled program binaries are stored (empty if disabled).
+         */
+        const std::string& getProgramCacheDirectory();
+
+        /**
+         * @brief Sets the directory in which compiled program binaries are stored.
+         *
+         * Program binaries are keyed by platform, device, driver, build options and source,
+         * so later processes with the same device can load them instead of compiling them again.
+         *
+         * By default it is empty (disabled).
+         *
+         * @param directory Existing writable directory, or empty to disable it.
+         * @return true if the operation was completed successfully; false otherwise.
+         */
+        bool setProgramCacheDirectory(const std::string& directory);
+
+        /**
+         * @brief Retrieves the number of programs loaded from the program cache directory since this context
+         * was created.
+         */
+        std::uint64_t getProgramCacheDiskHits();
+
+        /**
+         * @brief Retrieves the number of programs compiled from source by this context since it was created.
+         */
+        std::uint64_t getProgramBuilds();
+
+        /**
+         * @brief Indicates if compiled programs are specialized for the size of the input point clouds.
+         */
+        bool specializeCloudGeometry();
+
+        /**
+         * @brief Sets if compiled programs are specialized for the size of the input point clouds.
+         *
+         * Specialized programs can compute indexes with constants instead of kernel arguments,
+         * but each point cloud size builds a new program, so it should only be enabled if the sensor geometry
+         * is fixed (like a single depth camera). Programs can be compiled in advance with warmUp.
+         *
+         * By default it is false.
+         */
+        void setSpecializeCloudGeometry(bool specialize);
     #endif
 
     #ifdef PCPS_CUDA
@@ -72,6 +150,123 @@ public:
         explicit Context(pcps_thrust::CachedAllocator& allocator) noexcept;
     #endif
 
+    /**
+     * @brief Retrieves the maximum number of CPU threads used by the host side algorithms.
+     */
+    int getThreads() const noexcept;
+
+    /**
+     * @brief Sets the maximum number of CPU threads used by the host side algorithms.
+     *
+     * By default it is the number of concurrent threads supported by the system.
+     *
+     * @param threads Maximum number of CPU threads [1..inf).
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setThreads(int threads) noexcept;
+
+    /**
+     * @brief Retrieves the area from which the normal splitter uses the device instead of the host.
+     */
+    int getSplitterMaxCpuRegionArea() const noexcept;
+
+    /**
+     * @brief Sets the area from which the normal splitter uses the device instead of the host.
+     *
+     * Its meaning depends on the implementation:
+     * - OpenCL: it is compared with the area of the whole normal cloud. Smaller clouds are split region by region
+     *   on the host, and the others are split level by level on the device.
+     * - CUDA: it is compared with the area of each normal region. Smaller regions are reduced on the host,
+     *   and the others on the device.
+     * - CPU: it is ignored, since all regions are reduced on the host.
+     *
+     * The best value depends on the device, so it can be retrieved by calibrate().
+     *
+     * By default it is PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA or PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA.
+     *
+     * @param maxCpuRegionArea Area from which the device is used [1..inf).
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setSplitterMaxCpuRegionArea(int maxCpuRegionArea) noexcept;
+
+    /**
+     * @brief Times host and device splits of whole normal clouds over a sweep of cloud areas,
+     * and sets the splitter max CPU region area to the smallest one from which the device is faster.
+     *
+     * It measures the OpenCL meaning of the setting (whole clouds). For CUDA, whose regions are compared one by one,
+     * the measured crossover is used as the region area from which device reductions pay off.
+     *
+     * The CPU implementation has no device, so there is nothing to calibrate.
+     *
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool calibrate();
+
+    /**
+     * @brief Stores the calibrated settings of this context in the given file,
+     * so contexts of later processes with the same device can load them instead of calibrating again.
+     * @param filePath Output file path.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool saveCalibration(const std::string& filePath) const;
+
+    /**
+     * @brief Loads the calibrated settings stored by saveCalibration.
+     * @param filePath Input file path.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool loadCalibration(const std::string& filePath);
+
+    /**
+     * @brief Builds ahead of time the resources lazily created by the first segmentation,
+     * as kernels and threads, so the first frame is not slower than the next ones.
+     *
+     * It segmentates synthetic clouds with the default settings, the given size and the given normal neighbor levels
+     * (search radius divided by the distance between adjacent points), so the buffers and specialized kernels
+     * used by clouds like the expected ones are already available.
+     *
+     * @param width Expected organized cloud width.
+     * @param height Expected organized cloud height.
+     * @param neighborLevels Expected normal extractor neighbor levels.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool warmUp(int width, int height, int neighborLevels);
+
+    ///@cond INTERNAL
+
+    /**
+     * @brief Retrieves the pool of CPU threads used by the host side algorithms.
+     *
+     * Threads are created on demand and kept alive until the context is destroyed or its threads count changes.
+     * Callers share the ownership of the retrieved pool, so a threads count change doesn't destroy a pool in use.
+     *
+     * It can be called from different host threads at the same time.
+     */
+    std::shared_ptr<ThreadPool> getThreadPool();
+
+    /**
+     * @brief Indicates if algorithms can use this context from different host threads at the same time.
+     */
+    bool isThreadSafe() const noexcept;
+
+    #ifdef PCPS_OPENCL
+        /**
+         * @brief Retrieves the pool of device buffers and host staging buffers reused across frames.
+         *
+         * It is created on demand and kept alive until the context is destroyed.
+         */
+        DeviceBufferPool& getDeviceBufferPool();
+
+        /**
+         * @brief Retrieves the cache of the programs built from pcps sources.
+         *
+         * It is created on demand and kept alive until the context is destroyed.
+         */
+        ProgramCache& getProgramCache();
+    #endif
+
+    ///@endcond
+
     /**
      * @brief Copy construction is not allowed.
      */
@@ -95,12 +290,31 @@ public:
     /**
      * @brief Class destructor.
      */
-    virtual ~Context() = default;
+    virtual ~Context();
 
 protected:
     ///@cond INTERNAL
 
-    Context() = default;
+    Context() noexcept;
+
+    ///@endcond
+
+private:
+    ///@cond INTERNAL
+
+    mutable std::mutex _threadPoolMutex;
+    int _threads = _getDefaultThreads();
+    int _splitterMaxCpuRegionArea = _getDefaultSplitterMaxCpuRegionArea();
+    std::shared_ptr<ThreadPool> _threadPool;
+
+    #ifdef PCPS_OPENCL
+        std::unique_ptr<DeviceBufferPool> _deviceBufferPool;
+        std::unique_ptr<ProgramCache> _programCache;
+    #endif
+
+    static int _getDefaultThreads() noexcept;
+
+    static int _getDefaultSplitterMaxCpuRegionArea() noexcept;
 
     ///@endcond
 };
@@ -101,6 +101,12 @@ private:
 
     Cloud* _hostCloud;
     void* _deviceData;
+
+    #ifdef PCPS_OPENCL
+        Context* _context;
+        bool _pooledDeviceData;
+    #endif
+
     bool _constHostCloud;
 
     ///@endcond
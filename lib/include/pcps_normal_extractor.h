@@ -16,6 +16,10 @@ class Cloud;
 class Context;
 class DeviceCloud;
 
+///@cond INTERNAL
+class NormalStatistics;
+///@endcond
+
 /**
  * @brief Estimates local surface normals at each point of the given organized point cloud.
  *
@@ -25,6 +29,21 @@ class NormalExtractor
 {
 
 public:
+    /**
+     * @brief CPU instruction sets used to estimate normals.
+     */
+    enum class CpuInstructions
+    {
+        SCALAR = 0, /**< Portable scalar code, one point at a time. */
+        SSE4_2 = 1, /**< SSE4.2 vectors, four points at a time. */
+        AVX2 = 2 /**< AVX2 vectors, eight points at a time. */
+    };
+
+    /**
+     * @brief Retrieves the most advanced CPU instruction set supported by the running CPU.
+     */
+    static CpuInstructions getMaxCpuInstructions() noexcept;
+
     /**
      * @brief Retrieves the radius of the search circumference to determine the surface normal for each point.
      */
@@ -58,6 +77,59 @@ public:
      */
     void setFlipViewPoint(const Point& flipViewPoint) noexcept;
 
+    /**
+     * @brief Indicates if the covariance matrix of each point is retrieved from integral images.
+     */
+    bool useIntegralImages() const noexcept;
+
+    /**
+     * @brief Sets if the covariance matrix of each point is retrieved from integral images.
+     *
+     * Integral images (summed-area tables) of the point coordinates and their products are built once per cloud,
+     * so the cost of each point does not depend on the search radius. The search circumference is replaced with
+     * a square with the same area.
+     *
+     * Only the CPU implementation supports integral images; other implementations ignore this setting.
+     */
+    void setUseIntegralImages(bool useIntegralImages) noexcept;
+
+    /**
+     * @brief Indicates if neighbor points are staged in device local memory.
+     */
+    bool useLocalMemory() const noexcept;
+
+    /**
+     * @brief Sets if neighbor points are staged in device local memory.
+     *
+     * Each work-group copies a tile of points plus a halo of the search radius to local memory, so neighbor
+     * work-items don't read the same points from global memory. If the halo doesn't fit in local memory,
+     * points are read from global memory as usual.
+     *
+     * By default it is true.
+     *
+     * Only the OpenCL implementation supports local memory; other implementations ignore this setting.
+     */
+    void setUseLocalMemory(bool useLocalMemory) noexcept;
+
+    /**
+     * @brief Retrieves the CPU instruction set used to estimate normals.
+     */
+    CpuInstructions getCpuInstructions() const noexcept;
+
+    /**
+     * @brief Sets the CPU instruction set used to estimate normals.
+     *
+     * By default it is the most advanced instruction set supported by the running CPU.
+     *
+     * Vector instruction sets compute the covariance matrices of neighbor points in lockstep and give the same
+     * results as the scalar code. Only the CPU implementation without integral images supports them;
+     * other implementations ignore this setting.
+     *
+     * @param cpuInstructions CPU instruction set [SCALAR..getMaxCpuInstructions()].
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setCpuInstructions(CpuInstructions cpuInstructions) noexcept;
+
     /**
      * @brief Estimates local surface normals at each point of the given organized point cloud.
      * @param inputPointCloud Input organized point cloud.
@@ -83,13 +155,24 @@ private:
     Point _flipViewPoint = { 0, 0, 10000, 0 };
     float _searchRadius = 0.5f;
     bool _flipNormals = true;
+    bool _useIntegralImages = false;
+    bool _useLocalMemory = true;
+    CpuInstructions _cpuInstructions = getMaxCpuInstructions();
 
     static float _getCellDistance(const Cloud& cloud) noexcept;
 
-    bool _getNeighborLevels(const Cloud& cloud, int& neighborLevels) const noexcept;
+    static bool _getCellDistance(const DeviceCloud& deviceCloud, float& cellDistance, Context& context);
+
+    bool _getNeighborLevels(const DeviceCloud& deviceCloud, int& neighborLevels, Context& context) const;
+
+    bool _extract(const DeviceCloud& inputPointDeviceCloud, DeviceCloud& outputNormalDeviceCloud,
+                  NormalStatistics* normalStatistics, bool& statisticsBuilt, Context& context) const;
 
     bool _extract(const DeviceCloud& inputPointDeviceCloud, int neighborLevels, void* outputNormalDeviceData,
-                  Context& context) const;
+                  NormalStatistics* normalStatistics, bool& statisticsBuilt, Context& context) const;
+
+    friend class PlaneSegmentator;
+    friend class PlaneSegmentationPipeline;
 
     ///@endcond
 
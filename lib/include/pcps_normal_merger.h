@@ -8,15 +8,165 @@
 #define PCPS_NORMAL_MERGER_H
 
 #include <vector>
-#include <unordered_set>
+#include <cstdint>
 #include "pcps_point.h"
 
 namespace pcps
 {
 
 class Plane;
+class Context;
 class NormalRegion;
 
+///@cond INTERNAL
+class ThreadPool;
+///@endcond
+
+/**
+ * @brief Scratch buffers and timings of a NormalMerger merge.
+ *
+ * A const NormalMerger can be shared by many threads as long as each one of them merges with its own workspace.
+ */
+class NormalMergerWorkspace
+{
+
+public:
+    /**
+     * @brief Retrieves the elapsed microseconds on each round of the last PARALLEL merge.
+     */
+    const std::vector<std::int64_t>& getLastRoundsElapsedMcs() const noexcept;
+
+private:
+    ///@cond INTERNAL
+
+    friend class NormalMerger;
+
+    struct Group
+    {
+        Point normal;
+        int area;
+        unsigned version;
+        std::size_t absorberIndex;
+        std::size_t firstNeighbor;
+        std::size_t lastNeighbor;
+    };
+
+    struct Edge
+    {
+        float cosine;
+        std::size_t aIndex;
+        std::size_t bIndex;
+        unsigned aVersion;
+        unsigned bVersion;
+    };
+
+    struct DormantEdge
+    {
+        std::size_t groupIndex;
+        std::size_t next;
+    };
+
+    struct NeighborPair
+    {
+        std::size_t aIndex;
+        std::size_t bIndex;
+    };
+
+    struct RegionSide
+    {
+        int position;
+        int nearSide;
+        int begin;
+        int end;
+        std::size_t regionIndex;
+    };
+
+    struct Run
+    {
+        int begin;
+        int end;
+        std::size_t regionIndex;
+    };
+
+    // Storage is kept between merge calls, so reusing a workspace doesn't allocate memory in steady state:
+    std::vector<Group> _groups;
+    std::vector<std::size_t> _neighborOffsets;
+    std::vector<std::size_t> _neighborIndexes;
+    std::vector<std::size_t> _nextNeighbors;
+    std::vector<unsigned> _neighborMarks;
+    std::vector<std::size_t> _planeIndexes;
+    std::vector<Edge> _edges;
+    std::vector<DormantEdge> _dormantEdges;
+    std::vector<std::size_t> _firstDormantEdges;
+    std::vector<std::size_t> _lastDormantEdges;
+    std::vector<NeighborPair> _neighborPairs;
+    std::vector<RegionSide> _regionSides;
+    std::vector<RegionSide> _sortedRegionSides;
+    std::vector<std::size_t> _sideCounts;
+    std::vector<std::size_t> _rowOffsets;
+    std::vector<std::size_t> _rowRegionIndexes;
+    std::vector<Run> _runs;
+    std::vector<Run> _previousRuns;
+    std::vector<std::size_t> _liveGroupIndexes;
+    std::vector<std::size_t> _nextLiveGroupIndexes;
+    std::vector<std::size_t> _bestNeighborIndexes;
+    std::vector<std::size_t> _rootIndexes;
+    std::vector<std::size_t> _nextRootIndexes;
+    std::vector<unsigned char> _hookFlags;
+    std::vector<unsigned char> _nextHookFlags;
+    std::vector<std::size_t> _rootSlots;
+    std::vector<std::size_t> _memberOffsets;
+    std::vector<std::size_t> _memberIndexes;
+    std::vector<std::size_t> _rowBegins;
+    std::vector<std::size_t> _rowEnds;
+    std::vector<std::size_t> _nextRowBegins;
+    std::vector<std::size_t> _roundNeighborIndexes;
+    std::vector<std::size_t> _nextRoundNeighborIndexes;
+    std::vector<std::int64_t> _roundsElapsedMcs;
+    unsigned _neighborMark = 0;
+    float _minimumStdDsvThreshold = 0;
+    float _maximumStdDsvThreshold = 0;
+    bool _disjointRegions = true;
+
+    void _setupGroups(const std::vector<NormalRegion>& normalRegions);
+
+    void _findDisjointNeighborPairs(const std::vector<NormalRegion>& normalRegions);
+
+    void _findRunNeighborPairs(const std::vector<NormalRegion>& normalRegions);
+
+    void _paintRun(const Run& run);
+
+    void _greedyMerge();
+
+    void _priorityQueueMerge();
+
+    void _parallelMerge(ThreadPool& threadPool);
+
+    bool _parallelMergeRound(ThreadPool& threadPool);
+
+    std::size_t _getParentGroupIndex(std::size_t groupIndex) const noexcept;
+
+    void _findRootGroups(ThreadPool& threadPool, int chunks);
+
+    bool _pushEdge(std::size_t aIndex, std::size_t bIndex, float minimumCosine);
+
+    void _addDormantEdge(std::size_t aIndex, std::size_t bIndex);
+
+    void _joinDormantEdges(std::size_t aIndex, std::size_t bIndex) noexcept;
+
+    void _pushDormantEdges(std::size_t groupIndex, float minimumCosine);
+
+    std::size_t _getAbsorberGroupIndex(std::size_t groupIndex) noexcept;
+
+    bool _getBestNeighborGroupIndex(std::size_t groupIndex, std::size_t& bestNeighborGroupIndex) noexcept;
+
+    void _mergeGroups(std::size_t aIndex, std::size_t bIndex) noexcept;
+
+    void _buildPlanes(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes);
+
+    ///@endcond
+};
+
 /**
  * @brief Merges the given normal regions into planes (groups) with low standard deviation.
  */
@@ -24,6 +174,17 @@ class NormalMerger
 {
 
 public:
+    /**
+     * @brief Orders in which neighbor groups are merged.
+     */
+    enum class MergeOrder
+    {
+        GREEDY = 0, /**< Each group, in index order, absorbs its most similar neighbor until none is left. */
+        PRIORITY_QUEUE = 1, /**< The most similar pair of neighbor groups of the whole cloud is merged first. */
+        PARALLEL = 2 /**< Borůvka-style rounds: each group picks its most similar neighbor,
+                          and the resulting trees of groups are merged in parallel. */
+    };
+
     /**
      * @brief Retrieves the standard deviation by which two normal regions are always merged.
      */
@@ -42,6 +203,48 @@ public:
      */
     bool setStdDsvThresholds(float minimumStdDsvThreshold, float maximumStdDsvThreshold) noexcept;
 
+    /**
+     * @brief Retrieves the order in which neighbor groups are merged.
+     */
+    MergeOrder getMergeOrder() const noexcept;
+
+    /**
+     * @brief Sets the order in which neighbor groups are merged.
+     *
+     * PRIORITY_QUEUE keeps the mergeable neighbor group pairs in a binary heap sorted by the cosine of their angle.
+     * After each merge only the neighbors which could not be merged with the merged groups are checked again,
+     * instead of all their neighbors. Since merges happen in a different order, output planes can differ
+     * from the GREEDY ones.
+     *
+     * PARALLEL processes all groups of each round with the threads of the given context,
+     * and its output doesn't depend on the threads count.
+     *
+     * @param mergeOrder Merge order [GREEDY..PARALLEL].
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setMergeOrder(MergeOrder mergeOrder) noexcept;
+
+    /**
+     * @brief Indicates if the input normal regions are expected not to overlap.
+     */
+    bool getDisjointRegions() const noexcept;
+
+    /**
+     * @brief Sets if the input normal regions are expected not to overlap, as NormalSplitter ones.
+     *
+     * Neighbors of disjoint regions are found by matching their sides, which are sorted by position with
+     * counting sorts, in O(n + width + height) time (width and height are the bounds of the regions).
+     * Regions with zero area have no neighbors and are not assigned to any plane.
+     * Otherwise, each row is painted as a list of runs in region order (later regions overwrite the previous ones),
+     * which takes time proportional to the sum of the regions heights.
+     *
+     * By default it is false, so overlapping regions are handled correctly.
+     * PlaneSegmentator enables it, since its regions come from NormalSplitter.
+     *
+     * @param disjointRegions true if the input normal regions don't overlap; false otherwise.
+     */
+    void setDisjointRegions(bool disjointRegions) noexcept;
+
     /**
      * @brief Merges the given normal regions into planes (groups) with low standard deviation.
      * @param normalRegions Input normal regions.
@@ -49,29 +252,41 @@ public:
      */
     void merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes);
 
+    /**
+     * @brief Merges the given normal regions into planes (groups) with low standard deviation.
+     * @param normalRegions Input normal regions.
+     * @param planes Stores the output planes (groups) with low standard deviation.
+     * @param context Compute context, which provides the threads used by the PARALLEL merge order.
+     */
+    void merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes, Context& context);
+
+    /**
+     * @brief Merges the given normal regions into planes (groups) with low standard deviation,
+     * storing the scratch buffers and timings in the given workspace instead of in this merger.
+     * @param normalRegions Input normal regions.
+     * @param planes Stores the output planes (groups) with low standard deviation.
+     * @param workspace Scratch buffers and timings.
+     * @param context Compute context, which provides the threads used by the PARALLEL merge order.
+     */
+    void merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes,
+               NormalMergerWorkspace& workspace, Context& context) const;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on each round of the last PARALLEL merge.
+     */
+    const std::vector<std::int64_t>& getLastRoundsElapsedMcs() const noexcept;
+
 private:
     ///@cond INTERNAL
 
-    struct Group
-    {
-        std::vector<std::size_t> regionIndexes;
-        std::unordered_set<std::size_t> neighborGroupIndexes;
-        Point normal;
-        int area;
-    };
-
-    std::vector<Group> _groups;
-    std::vector<int> _pointCloudIds;
     float _minimumStdDsvThreshold = (5 * 3.14159265358979323846f) / 180;
     float _maximumStdDsvThreshold = (25 * 3.14159265358979323846f) / 180;
+    MergeOrder _mergeOrder = MergeOrder::GREEDY;
+    bool _disjointRegions = false;
+    NormalMergerWorkspace _workspace;
 
-    void _setupGroups(const std::vector<NormalRegion>& normalRegions);
-
-    bool _getBestNeighborGroupIndex(std::size_t groupIndex, std::size_t& bestNeighborGroupIndex) const noexcept;
-
-    void _mergeGroups(std::size_t aIndex, std::size_t bIndex);
-
-    void _buildPlanes(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes) const;
+    void _merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes,
+                NormalMergerWorkspace& workspace, ThreadPool& threadPool) const;
 
     ///@endcond
 };
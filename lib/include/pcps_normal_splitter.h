@@ -8,6 +8,8 @@
 #define PCPS_NORMAL_SPLITTER_H
 
 #include <vector>
+#include <functional>
+#include "pcps_normal_region.h"
 
 namespace pcps
 {
@@ -16,7 +18,47 @@ class Point;
 class Cloud;
 class Context;
 class DeviceCloud;
-class NormalRegion;
+
+///@cond INTERNAL
+class ThreadPool;
+class NormalStatistics;
+///@endcond
+
+/**
+ * @brief Scratch buffers of a NormalSplitter split.
+ *
+ * A const NormalSplitter can be shared by many threads as long as each one of them splits with its own workspace.
+ */
+class NormalSplitterWorkspace
+{
+
+private:
+    ///@cond INTERNAL
+
+    friend class NormalSplitter;
+
+    struct Item
+    {
+        NormalRegion normalRegion;
+        int task;
+    };
+
+    struct TaskOutput
+    {
+        int worker;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::vector<Item> _items;
+    std::vector<NormalRegion> _tasks;
+    std::vector<NormalRegion> _stack;
+    std::vector<TaskOutput> _taskOutputs;
+    std::vector<std::vector<NormalRegion>> _workerNormalRegions;
+    std::vector<std::vector<NormalRegion>> _workerStacks;
+
+    ///@endcond
+};
 
 /**
  * @brief Splits a given organized normal cloud into regions with low standard deviation.
@@ -82,6 +124,18 @@ public:
     bool split(const DeviceCloud& inputNormalDeviceCloud, std::vector<NormalRegion>& outputNormalRegions,
                Context& context) const;
 
+    /**
+     * @brief Splits a given organized normal cloud into regions with low standard deviation,
+     * storing the scratch buffers in the given workspace so they are reused across splits.
+     * @param inputNormalDeviceCloud Input organized normal device cloud.
+     * @param outputNormalRegions Stores the output regions with low standard deviation.
+     * @param workspace Scratch buffers.
+     * @param context Compute context.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool split(const DeviceCloud& inputNormalDeviceCloud, std::vector<NormalRegion>& outputNormalRegions,
+               NormalSplitterWorkspace& workspace, Context& context) const;
+
 private:
     ///@cond INTERNAL
 
@@ -95,8 +149,36 @@ private:
     bool _getStdDev(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion, const Point& mean,
                     int numValidNormals, float& stdDev, Context& context) const;
 
-    bool _split(const DeviceCloud& inputNormalDeviceCloud, const NormalRegion& normalRegion,
-                std::vector<NormalRegion>& outputNormalRegions, Context& context) const;
+    using RegionStatistics = std::function<bool(const NormalRegion& normalRegion, Point& mean, int& numValidNormals,
+                                                bool& split)>;
+
+    bool _getRegionStatistics(const DeviceCloud& normalDeviceCloud, const NormalStatistics* normalStatistics,
+                              RegionStatistics& regionStatistics, bool& threadSafe, Context& context) const;
+
+    bool _getStatistics(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion, Point& mean,
+                        int& numValidNormals, bool& split, Context& context) const;
+
+    bool _split(const DeviceCloud& inputNormalDeviceCloud, const NormalStatistics* normalStatistics,
+                std::vector<NormalRegion>& outputNormalRegions, NormalSplitterWorkspace& workspace,
+                Context& context) const;
+
+    bool _split(const DeviceCloud& inputNormalDeviceCloud, const NormalStatistics* normalStatistics,
+                const NormalRegion& initialNormalRegion, std::vector<NormalRegion>& outputNormalRegions,
+                NormalSplitterWorkspace& workspace, Context& context) const;
+
+    bool _splitLevels(const DeviceCloud& inputNormalDeviceCloud, const NormalRegion& initialNormalRegion,
+                      std::vector<NormalRegion>& outputNormalRegions, bool& levelSplit, Context& context) const;
+
+    bool _split(const RegionStatistics& regionStatistics, const NormalRegion& initialNormalRegion,
+                std::vector<NormalRegion>& outputNormalRegions, std::vector<NormalRegion>& stack) const;
+
+    bool _parallelSplit(const RegionStatistics& regionStatistics, const NormalRegion& initialNormalRegion,
+                        std::vector<NormalRegion>& outputNormalRegions, NormalSplitterWorkspace& workspace,
+                        ThreadPool& threadPool) const;
+
+    bool _splitRegion(const RegionStatistics& regionStatistics, const NormalRegion& normalRegion,
+                      std::vector<NormalRegion>& outputNormalRegions, bool& split, NormalRegion& firstNormalRegion,
+                      NormalRegion& secondNormalRegion) const;
 
     void _getCpuMean(const Cloud& normalCloud, const NormalRegion& normalRegion, Point& mean,
                      int& numValidNormals) const;
@@ -104,6 +186,9 @@ private:
     void _getCpuStdDev(const Cloud& normalCloud, const NormalRegion& normalRegion, const Point& mean,
                        int numValidNormals, float& stdDev) const;
 
+    friend class PlaneSegmentator;
+    friend class PlaneSegmentationPipeline;
+
     ///@endcond
 };
 
@@ -7,11 +7,16 @@
 #ifndef PCPS_ORGANIZER_H
 #define PCPS_ORGANIZER_H
 
+#include <memory>
+#include <vector>
+#include "pcps_sensor.h"
+
 namespace pcps
 {
 
 class Cloud;
 class Context;
+class DeviceCloud;
 
 /**
  * @brief Organizes a disorganized point cloud.
@@ -56,6 +61,39 @@ public:
      */
     bool setMaximumHeight(int maximumHeight) noexcept;
 
+    /**
+     * @brief Retrieves the percentile of the nearest neighbor distances used to calculate the output cell size.
+     */
+    float getSpacingPercentile() const noexcept;
+
+    /**
+     * @brief Sets the percentile of the nearest neighbor distances used to calculate the output cell size.
+     *
+     * With 0 the minimum distance between points is used. Higher values prevent duplicated or very close points
+     * from collapsing the output cell size.
+     *
+     * @param spacingPercentile Nearest neighbor distances percentile [0..1].
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setSpacingPercentile(float spacingPercentile) noexcept;
+
+    /**
+     * @brief Retrieves the sensor used to project the input points onto the output organized point cloud.
+     */
+    const Sensor& getSensor() const noexcept;
+
+    /**
+     * @brief Sets the sensor used to project the input points onto the output organized point cloud.
+     *
+     * With the plane projection (default) the output size depends on the input points spacing.
+     * With the spherical and pinhole projections the output size is fixed by the sensor and each point is
+     * projected from the input cloud sensor origin in a single pass.
+     *
+     * @param sensor Sensor with valid parameters.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setSensor(const Sensor& sensor) noexcept;
+
     /**
      * @brief Organizes a disorganized point cloud.
      * @param inputPointCloud Input disorganized point cloud.
@@ -65,11 +103,37 @@ public:
      */
     bool organize(const Cloud& inputPointCloud, Cloud& outputPointCloud, Context& context) const;
 
+    /**
+     * @brief Organizes a disorganized point cloud, keeping the result in the compute device.
+     *
+     * The output device cloud can be used as input of NormalExtractor without uploading it again.
+     * The points of the output host cloud are only guaranteed to be updated after calling
+     * DeviceCloud::updateHostCloud on the output device cloud.
+     *
+     * @param inputPointCloud Input disorganized point cloud.
+     * @param outputPointCloud Stores the output organized point cloud.
+     * @param outputPointDeviceCloud Stores the output organized point device cloud, mapped to outputPointCloud.
+     * @param context Compute context.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
+                  std::unique_ptr<DeviceCloud>& outputPointDeviceCloud, Context& context) const;
+
 private:
     ///@cond INTERNAL
 
     int _maximumWidth = 2047;
     int _maximumHeight = 2047;
+    float _spacingPercentile = 0;
+    Sensor _sensor;
+
+    static bool _getSpacingBins(float distanceX, float distanceY, std::size_t numPoints, int& binCols, int& binRows,
+                                float& binSizeInv) noexcept;
+
+    bool _getPlaneAxes(const std::vector<Point>& points, Point& xAxis, Point& yAxis, Point& zAxis) const;
+
+    void _getOutputSize(float distanceX, float distanceY, float minDistance, int& width, int& height,
+                        float& cellSizeInv) const noexcept;
 
     ///@endcond
 };
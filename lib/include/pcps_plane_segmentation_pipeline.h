@@ -0,0 +1,207 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_PLANE_SEGMENTATION_PIPELINE_H
+#define PCPS_PLANE_SEGMENTATION_PIPELINE_H
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+#include "pcps_plane_segmentator.h"
+
+namespace pcps
+{
+
+/**
+ * @brief Result of a point cloud segmented by a PlaneSegmentationPipeline.
+ */
+class PlaneSegmentationResult
+{
+
+public:
+    std::vector<Plane> planes; /**< Output planes. */
+    std::uint64_t frameIndex = 0; /**< Index of the point cloud in submission order. */
+    std::int64_t latencyMcs = 0; /**< Elapsed microseconds since the point cloud was submitted. */
+    bool success = false; /**< Indicates if the point cloud was segmented successfully. */
+    bool dropped = false; /**< Indicates if the point cloud was dropped because a queue was full. */
+};
+
+/**
+ * @brief Segmentates point clouds into planes asynchronously.
+ *
+ * Organization, normal extraction, normal split and normal merge run as pipeline stages in separate threads,
+ * with a bounded queue of point clouds in front of each stage, so consecutive point clouds are processed
+ * at the same time by different stages.
+ *
+ * All stages share the given context, which must outlive the pipeline,
+ * and whose threads count must not be changed while the pipeline is alive.
+ * If the context is not thread safe (as the OpenCL and CUDA ones), stages take turns to use it.
+ */
+class PlaneSegmentationPipeline
+{
+
+public:
+    /**
+     * @brief Pipeline stages.
+     */
+    enum class Stage
+    {
+        ORGANIZATION = 0, /**< Point cloud organization. */
+        NORMAL_EXTRACTION = 1, /**< Surface normals extraction. */
+        NORMAL_SPLIT = 2, /**< Surface normals split. */
+        NORMAL_MERGE = 3 /**< Surface normal regions merge. */
+    };
+
+    /**
+     * @brief What to do when a point cloud must be pushed into a full queue.
+     */
+    enum class Backpressure
+    {
+        BLOCK = 0, /**< Wait until the queue has room for it. */
+        DROP_OLDEST = 1, /**< Drop the oldest point cloud of the queue. */
+        DROP_NEWEST = 2 /**< Drop the new point cloud. */
+    };
+
+    /**
+     * @brief Callable with the signature void(PlaneSegmentationResult& result),
+     * called from a pipeline thread when a point cloud is segmented or dropped.
+     */
+    using Callback = std::function<void(PlaneSegmentationResult& result)>;
+
+    /**
+     * @brief Class constructor.
+     * @param planeSegmentator Its settings are copied into the pipeline stages.
+     * @param context Compute context shared by all stages.
+     */
+    PlaneSegmentationPipeline(const PlaneSegmentator& planeSegmentator, Context& context);
+
+    /**
+     * @brief Retrieves the maximum number of point clouds waiting in front of each stage.
+     */
+    int getQueueCapacity() const noexcept;
+
+    /**
+     * @brief Sets the maximum number of point clouds waiting in front of each stage.
+     * @param queueCapacity Maximum number of point clouds [1..inf).
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setQueueCapacity(int queueCapacity) noexcept;
+
+    /**
+     * @brief Retrieves what to do when a point cloud must be pushed into a full queue.
+     */
+    Backpressure getBackpressure() const noexcept;
+
+    /**
+     * @brief Sets what to do when a point cloud must be pushed into a full queue.
+     * @param backpressure Backpressure policy [BLOCK..DROP_NEWEST].
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool setBackpressure(Backpressure backpressure) noexcept;
+
+    /**
+     * @brief Submits a copy of the given point cloud to be segmented.
+     * @param inputPointCloud Input point cloud.
+     * @return Future which stores the result of the segmentation.
+     */
+    std::future<PlaneSegmentationResult> submit(const Cloud& inputPointCloud);
+
+    /**
+     * @brief Submits a copy of the given point cloud to be segmented.
+     * @param inputPointCloud Input point cloud.
+     * @param callback Called with the result of the segmentation.
+     */
+    void submit(const Cloud& inputPointCloud, const Callback& callback);
+
+    /**
+     * @brief Waits until all submitted point clouds have been segmented or dropped.
+     */
+    void wait();
+
+    /**
+     * @brief Retrieves the number of point clouds waiting in front of the given stage.
+     */
+    int getQueueDepth(Stage stage) const;
+
+    /**
+     * @brief Retrieves the number of point clouds dropped because a queue was full.
+     */
+    std::uint64_t getDroppedFrames() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds since the last completed point cloud was submitted
+     * until it was segmented.
+     */
+    std::int64_t getLastLatencyMcs() const noexcept;
+
+    /**
+     * @brief Copy construction is not allowed.
+     */
+    PlaneSegmentationPipeline(const PlaneSegmentationPipeline& other) = delete;
+
+    /**
+     * @brief Copy assignment is not allowed.
+     */
+    PlaneSegmentationPipeline& operator=(const PlaneSegmentationPipeline& other) = delete;
+
+    /**
+     * @brief Class destructor.
+     *
+     * Waits until all submitted point clouds have been segmented.
+     */
+    ~PlaneSegmentationPipeline();
+
+private:
+    ///@cond INTERNAL
+
+    static constexpr int _stages = 4;
+
+    class Frame;
+    class FrameQueue;
+
+    using Process = bool (PlaneSegmentationPipeline::*)(Frame& frame);
+
+    PlaneSegmentator _planeSegmentator;
+    NormalSplitterWorkspace _normalSplitterWorkspace;
+    Context& _context;
+    std::unique_ptr<FrameQueue> _queues[_stages];
+    std::thread _workers[_stages];
+    std::mutex _mutex;
+    std::mutex _contextMutex;
+    std::condition_variable _doneCondition;
+    std::uint64_t _nextFrameIndex = 0;
+    std::uint64_t _pendingFrames = 0;
+    std::atomic<std::uint64_t> _droppedFrames;
+    std::atomic<std::int64_t> _lastLatencyMcs;
+    std::atomic<int> _queueCapacity;
+    std::atomic<int> _backpressure;
+
+    void _submit(std::unique_ptr<Frame> frame);
+
+    void _work(int stage, Process process);
+
+    void _push(int stage, std::unique_ptr<Frame> frame);
+
+    void _complete(std::unique_ptr<Frame> frame, bool success, bool dropped);
+
+    bool _organize(Frame& frame);
+
+    bool _extractNormals(Frame& frame);
+
+    bool _splitNormals(Frame& frame);
+
+    bool _mergeNormals(Frame& frame);
+
+    ///@endcond
+};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 #ifndef PCPS_PLANE_SEGMENTATOR_H
 #define PCPS_PLANE_SEGMENTATOR_H
 
+#include <memory>
 #include <cstdint>
 #include "pcps_cloud.h"
 #include "pcps_plane.h"
@@ -18,8 +19,120 @@
 namespace pcps
 {
 
+///@cond INTERNAL
+class NormalStatistics;
+///@endcond
+
+/**
+ * @brief Intermediate results, scratch buffers and timings of a PlaneSegmentator segmentation.
+ *
+ * A const PlaneSegmentator can be shared by many threads as long as each one of them segmentates
+ * with its own workspace. Reusing a workspace avoids most memory allocations in steady state.
+ */
+class PlaneSegmentationWorkspace
+{
+
+public:
+    /**
+     * @brief Class constructor.
+     */
+    PlaneSegmentationWorkspace();
+
+    /**
+     * @brief Copy constructor.
+     */
+    PlaneSegmentationWorkspace(const PlaneSegmentationWorkspace& other);
+
+    /**
+     * @brief Move constructor.
+     */
+    PlaneSegmentationWorkspace(PlaneSegmentationWorkspace&& other) noexcept;
+
+    /**
+     * @brief Copy assignment operator.
+     */
+    PlaneSegmentationWorkspace& operator=(const PlaneSegmentationWorkspace& other);
+
+    /**
+     * @brief Move assignment operator.
+     */
+    PlaneSegmentationWorkspace& operator=(PlaneSegmentationWorkspace&& other) noexcept;
+
+    /**
+     * @brief Class destructor.
+     */
+    ~PlaneSegmentationWorkspace();
+
+    /**
+     * @brief Retrieves the result of the last point cloud organization.
+     *
+     * This result is provided only if PlaneSegmentator::storeIntermediateResults() is true.
+     */
+    const Cloud& getLastOrganizationResult() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on the last point cloud organization.
+     */
+    std::int64_t getLastOrganizationElapsedMcs() const noexcept;
+
+    /**
+     * @brief Retrieves the result of the last surface normals extraction.
+     *
+     * This result is provided only if PlaneSegmentator::storeIntermediateResults() is true.
+     */
+    const Cloud& getLastNormalExtractionResult() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on the last surface normals extraction.
+     */
+    std::int64_t getLastNormalExtractionElapsedMcs() const noexcept;
+
+    /**
+     * @brief Retrieves the result of the last surface normals split.
+     *
+     * This result is provided only if PlaneSegmentator::storeIntermediateResults() is true.
+     */
+    const std::vector<NormalRegion>& getLastNormalSplitResult() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on the last surface normals split.
+     */
+    std::int64_t getLastNormalSplitElapsedMcs() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on the last surface normal regions merge.
+     */
+    std::int64_t getLastNormalMergeElapsedMcs() const noexcept;
+
+    /**
+     * @brief Retrieves the elapsed microseconds on each round of the last PARALLEL surface normal regions merge.
+     */
+    const std::vector<std::int64_t>& getLastNormalMergeRoundsElapsedMcs() const noexcept;
+
+private:
+    ///@cond INTERNAL
+
+    friend class PlaneSegmentator;
+
+    Cloud _organizationResult;
+    Cloud _normalExtractionResult;
+    std::vector<NormalRegion> _normalSplitResult;
+    std::unique_ptr<NormalStatistics> _normalStatistics;
+    NormalSplitterWorkspace _normalSplitterWorkspace;
+    NormalMergerWorkspace _normalMergerWorkspace;
+    std::int64_t _organizationElapsedMcs = 0;
+    std::int64_t _normalExtractionElapsedMcs = 0;
+    std::int64_t _normalSplitElapsedMcs = 0;
+    std::int64_t _normalMergeElapsedMcs = 0;
+
+    ///@endcond
+};
+
 /**
  * @brief Segmentate a given point cloud into planes.
+ *
+ * Segmentations which don't take a workspace store their intermediate results and timings in this object,
+ * so they can't be called from different threads at the same time.
  */
 class PlaneSegmentator
 {
@@ -28,7 +141,12 @@ public:
     Organizer organizer; /**< Point cloud organizer. */
     NormalExtractor normalExtractor; /**< Surface normals extractor. */
     NormalSplitter normalSplitter; /**< Surface normals splitter. */
-    NormalMerger normalMerger; /**< Surface normals regions merger. */
+    NormalMerger normalMerger; /**< Surface normals regions merger (with disjoint regions enabled). */
+
+    /**
+     * @brief Class constructor.
+     */
+    PlaneSegmentator() noexcept;
 
     /**
      * @brief Indicates if the intermediate results of the last segmentation must be stored.
@@ -40,6 +158,22 @@ public:
      */
     void setStoreIntermediateResults(bool store) noexcept;
 
+    /**
+     * @brief Indicates if the normal statistics needed by the splitter are built during the normal extraction.
+     */
+    bool fuseNormalStatistics() const noexcept;
+
+    /**
+     * @brief Sets if the normal statistics needed by the splitter are built during the normal extraction.
+     *
+     * Each row of normals is accumulated into tile sums by the extractor right after it is computed,
+     * so the splitter does not have to read the whole normal cloud again: it only reads the normals at the borders
+     * of each region and the ones of the regions near the split threshold. Output regions are the same.
+     *
+     * Only the CPU implementation supports it; other implementations ignore this setting.
+     */
+    void setFuseNormalStatistics(bool fuse) noexcept;
+
     /**
      * @brief Segmentate a given point cloud into planes.
      * @param inputPointCloud Input point cloud.
@@ -58,6 +192,53 @@ public:
      */
     bool segmentate(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes, Context& context);
 
+    /**
+     * @brief Segmentate a given point cloud into planes.
+     *
+     * It can be called from different threads at the same time if each one of them uses its own workspace
+     * and the context is thread safe.
+     *
+     * @param inputPointCloud Input point cloud.
+     * @param outputPlanes Stores the result of the segmentation.
+     * @param workspace Stores the intermediate results, scratch buffers and timings of the segmentation.
+     * @param context Compute context.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool segmentate(const Cloud& inputPointCloud, std::vector<Plane>& outputPlanes,
+                    PlaneSegmentationWorkspace& workspace, Context& context) const;
+
+    /**
+     * @brief Segmentate a given point cloud into planes.
+     *
+     * It can be called from different threads at the same time if each one of them uses its own workspace
+     * and the context is thread safe.
+     *
+     * @param inputPointDeviceCloud Input point device cloud.
+     * @param outputPlanes Stores the result of the segmentation.
+     * @param workspace Stores the intermediate results, scratch buffers and timings of the segmentation.
+     * @param context Compute context.
+     * @return true if the operation was completed successfully; false otherwise.
+     */
+    bool segmentate(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes,
+                    PlaneSegmentationWorkspace& workspace, Context& context) const;
+
+    /**
+     * @brief Segmentate the given point clouds into planes.
+     *
+     * Point clouds are distributed across the context threads if the context is thread safe,
+     * and each thread segmentates its point clouds with its own workspace.
+     *
+     * Otherwise (OpenCL and CUDA contexts) point clouds are segmentated one by one with a shared workspace,
+     * with the same device launches as calling segmentate for each one of them.
+     *
+     * @param inputPointClouds Input point clouds.
+     * @param outputPlanes Stores the result of the segmentation of each point cloud.
+     * @param context Compute context.
+     * @return true if all point clouds were segmented successfully; false otherwise.
+     */
+    bool segmentate(const std::vector<Cloud>& inputPointClouds, std::vector<std::vector<Plane>>& outputPlanes,
+                    Context& context) const;
+
     /**
      * @brief Retrieves the result of the last point cloud organization.
      *
@@ -102,18 +283,17 @@ public:
 private:
     ///@cond INTERNAL
 
-    Cloud _organizationResult;
-    Cloud _normalExtractionResult;
-    std::vector<NormalRegion> _normalSplitResult;
-    std::int64_t _organizationElapsedMcs = 0;
-    std::int64_t _normalExtractionElapsedMcs = 0;
-    std::int64_t _normalSplitElapsedMcs = 0;
-    std::int64_t _normalMergeElapsedMcs = 0;
+    PlaneSegmentationWorkspace _workspace;
     bool _storeIntermediateResults = false;
+    bool _fuseNormalStatistics = true;
+
+    bool _start(const Cloud& inputPointCloud, PlaneSegmentationWorkspace& workspace) const;
 
-    bool _start(const Cloud& inputPointCloud);
+    bool _organizeAndSegmentate(const Cloud& inputPointCloud, std::vector<Plane>& outputPlanes,
+                                PlaneSegmentationWorkspace& workspace, Context& context) const;
 
-    bool _segmentateImpl(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes, Context& context);
+    bool _segmentateImpl(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes,
+                         PlaneSegmentationWorkspace& workspace, Context& context) const;
 
     ///@endcond
 };
@@ -40,6 +40,11 @@ public:
      */
     bool isEqualTo(const Point& other, float precision) const noexcept;
 
+    /**
+     * @brief Retrieves the dot product between this point and the given one (aux is not used).
+     */
+    float dot(const Point& other) const noexcept;
+
     /**
      * @brief Retrieves the cross product between this point and the given one.
      */
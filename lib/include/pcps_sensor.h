@@ -0,0 +1,129 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_SENSOR_H
+#define PCPS_SENSOR_H
+
+#include "pcps_point.h"
+
+namespace pcps
+{
+
+/**
+ * @brief Describes how the points acquired by a sensor are projected onto an organized point cloud (range image).
+ */
+class Sensor
+{
+
+public:
+    /**
+     * @brief Available projections.
+     */
+    enum class Projection
+    {
+        PLANE = 0, /**< Points are projected onto a plane, with a cell size derived from the point spacing. */
+        SPHERICAL = 1, /**< Points are projected by their azimuth and elevation angles (spinning LiDAR). */
+        PINHOLE = 2, /**< Points are projected with the pinhole camera model (depth camera looking along +z). */
+        FITTED_PLANE = 3 /**< Points are projected onto their dominant plane, retrieved with PCA. */
+    };
+
+    Projection projection = Projection::PLANE; /**< Specifies how points are projected. */
+    int width = 0; /**< Range image width in cells. Not used by the plane projections. */
+    int height = 0; /**< Range image height in cells. Not used by the plane projections. */
+    Point xAxis = { 1, 0, 0, 0 }; /**< Plane projection unit x axis (output columns). */
+    Point yAxis = { 0, 1, 0, 0 }; /**< Plane projection unit y axis (output rows), orthogonal to xAxis. */
+    float horizontalResolution = 0; /**< Spherical projection azimuth angle of each column in radians. */
+    float verticalResolution = 0; /**< Spherical projection elevation angle of each row in radians. */
+    float maxElevation = 0; /**< Spherical projection elevation angle of the first row in radians. */
+    float fx = 0; /**< Pinhole projection horizontal focal length in cells. */
+    float fy = 0; /**< Pinhole projection vertical focal length in cells. */
+    float cx = 0; /**< Pinhole projection horizontal principal point in cells. */
+    float cy = 0; /**< Pinhole projection vertical principal point in cells. */
+
+    /**
+     * @brief Retrieves a sensor which projects points onto the XY plane.
+     */
+    static Sensor plane() noexcept;
+
+    /**
+     * @brief Retrieves a sensor which projects points onto the plane defined by the given axes.
+     *
+     * The axes are normalized, and yAxis is made orthogonal to xAxis.
+     * The point with the highest coordinate along xAxis x yAxis is kept in each cell.
+     *
+     * @param xAxis Plane x axis, mapped to the output columns.
+     * @param yAxis Plane y axis, mapped to the output rows. It must not be parallel to xAxis.
+     * @return The requested sensor, or an invalid one if the given axes are not valid.
+     */
+    static Sensor plane(const Point& xAxis, const Point& yAxis) noexcept;
+
+    /**
+     * @brief Retrieves a sensor which projects points onto their dominant plane.
+     *
+     * The plane axes are retrieved from the principal components of the input points, so grids
+     * of tilted or vertical surfaces are not filled with empty cells.
+     */
+    static Sensor fittedPlane() noexcept;
+
+    /**
+     * @brief Retrieves a spinning LiDAR sensor, which covers 360 degrees of azimuth.
+     * @param horizontalResolution Azimuth angle of each column in radians (0..2*pi].
+     * @param verticalResolution Elevation angle of each row (ring) in radians (0..inf).
+     * @param minElevation Elevation angle of the last row in radians.
+     * @param maxElevation Elevation angle of the first row in radians [minElevation..inf).
+     * @return The requested sensor, or an invalid one if the given parameters are not valid.
+     */
+    static Sensor spherical(float horizontalResolution, float verticalResolution, float minElevation,
+                            float maxElevation) noexcept;
+
+    /**
+     * @brief Retrieves a pinhole camera sensor.
+     * @param fx Horizontal focal length in cells (0..inf).
+     * @param fy Vertical focal length in cells (0..inf).
+     * @param cx Horizontal principal point in cells.
+     * @param cy Vertical principal point in cells.
+     * @param width Image width in cells [1..inf).
+     * @param height Image height in cells [1..inf).
+     * @return The requested sensor, or an invalid one if the given parameters are not valid.
+     */
+    static Sensor pinhole(float fx, float fy, float cx, float cy, int width, int height) noexcept;
+
+    /**
+     * @brief Indicates if the sensor parameters are valid for its projection.
+     */
+    bool isValid() const noexcept;
+
+    /**
+     * @brief Indicates if the organized point cloud size is fixed by the sensor instead of by the point spacing.
+     */
+    bool hasFixedSize() const noexcept;
+
+    /**
+     * @brief Retrieves the range image cell of the given point. Not valid for the plane projections.
+     * @param point Point to project.
+     * @param origin Sensor acquisition origin.
+     * @return Cell index [0..width*height) if the point is inside the sensor field of view; -1 otherwise.
+     */
+    int getCellIndex(const Point& point, const Point& origin) const noexcept;
+
+    /**
+     * @brief Retrieves the depth of the given point.
+     *
+     * If more than one point is projected onto the same cell, the one with the lowest depth is kept.
+     * The plane projection depth is the opposite of the coordinate along xAxis x yAxis (-z by default),
+     * the spherical one is the distance to the origin and the pinhole one is the distance to the origin
+     * along the z axis. Not valid for the fitted plane projection.
+     *
+     * @param point Point to measure.
+     * @param origin Sensor acquisition origin.
+     * @return The depth of the given point.
+     */
+    float getDepth(const Point& point, const Point& origin) const noexcept;
+};
+
+}
+
+#endif
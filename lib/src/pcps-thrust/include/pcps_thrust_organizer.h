@@ -13,8 +13,9 @@ namespace pcps_thrust
 {
     class CachedAllocator;
 
-    void organize(const thrust::host_vector<float2>& points2D, int maximumWidth, int maximumHeight, float epsilon,
-                  int& width, int& height, thrust::host_vector<int>& indices, CachedAllocator& allocator);
+    void organize(const thrust::host_vector<float2>& points2D, int maximumWidth, int maximumHeight,
+                  float spacingPercentile, float epsilon, int& width, int& height, thrust::host_vector<int>& indices,
+                  CachedAllocator& allocator);
 }
 
 #endif
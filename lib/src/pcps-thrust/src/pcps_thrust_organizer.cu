@@ -7,6 +7,8 @@
 #include "pcps_thrust_organizer.h"
 
 #include <cmath>
+#include "thrust/sort.h"
+#include "thrust/remove.h"
 #include "thrust/transform.h"
 #include "thrust/device_vector.h"
 #include "thrust/transform_reduce.h"
@@ -82,6 +84,49 @@ namespace
         }
     };
 
+    struct NearestDistanceTransform
+    {
+        PointIterator pointsBegin;
+        int numPoints;
+        float maxDistance;
+
+        __device__
+        float operator()(int index) const noexcept
+        {
+            float2 point = *(pointsBegin + index);
+            float minDistance = maxDistance;
+
+            for(int otherIndex = 0; otherIndex < numPoints; ++otherIndex)
+            {
+                if(otherIndex != index)
+                {
+                    float2 otherPoint = *(pointsBegin + otherIndex);
+                    float distanceX = point.x - otherPoint.x;
+                    float distanceY = point.y - otherPoint.y;
+                    float distance = (distanceX * distanceX) + (distanceY * distanceY);
+
+                    if(distance < minDistance)
+                    {
+                        minDistance = distance;
+                    }
+                }
+            }
+
+            return minDistance;
+        }
+    };
+
+    struct NoNeighborPredicate
+    {
+        float maxDistance;
+
+        __device__
+        bool operator()(float distance) const noexcept
+        {
+            return distance >= maxDistance;
+        }
+    };
+
     struct DistanceReduce
     {
         __device__
@@ -112,8 +157,9 @@ namespace
 
 #pragma pop
 
-void organize(const thrust::host_vector<float2>& points2D, int maximumWidth, int maximumHeight, float epsilon,
-              int& width, int& height, thrust::host_vector<int>& indices, CachedAllocator& allocator)
+void organize(const thrust::host_vector<float2>& points2D, int maximumWidth, int maximumHeight,
+              float spacingPercentile, float epsilon, int& width, int& height, thrust::host_vector<int>& indices,
+              CachedAllocator& allocator)
 {
     auto par = thrust::cuda::par(allocator);
     thrust::device_vector<float2> devicePoints2D = points2D;
@@ -133,9 +179,35 @@ void organize(const thrust::host_vector<float2>& points2D, int maximumWidth, int
     float distanceY = boundingBox.w - minY;
     thrust::counting_iterator<int> first(0);
     thrust::counting_iterator<int> last = first + long(numPoints);
-    float minDistance = thrust::transform_reduce(par, first, last,
-                                                 DistanceTransform{ devicePoints2D.begin(), int(numPoints), maxValue },
-                                                 maxValue, DistanceReduce());
+    float minDistance;
+
+    if(spacingPercentile > 0)
+    {
+        // Retrieve the requested percentile of the nearest neighbor distances of the points with neighbor,
+        // so isolated points don't collapse the grid:
+
+        thrust::device_vector<float> distances(numPoints);
+        thrust::transform(par, first, last, distances.begin(),
+                          NearestDistanceTransform{ devicePoints2D.begin(), int(numPoints), maxValue });
+
+        auto distancesEnd = thrust::remove_if(par, distances.begin(), distances.end(),
+                                              NoNeighborPredicate{ maxValue });
+        auto numNeighborDistances = std::size_t(distancesEnd - distances.begin());
+        minDistance = 0;
+
+        if(numNeighborDistances)
+        {
+            thrust::sort(par, distances.begin(), distancesEnd);
+            minDistance = distances[std::size_t(spacingPercentile * (numNeighborDistances - 1))];
+        }
+    }
+    else
+    {
+        minDistance = thrust::transform_reduce(par, first, last,
+                                               DistanceTransform{ devicePoints2D.begin(), int(numPoints), maxValue },
+                                               maxValue, DistanceReduce());
+    }
+
     minDistance = std::sqrt(minDistance);
 
     // Retrieve output cloud size and cell size:
@@ -24,10 +24,20 @@
 #define BOOST_COMPUTE_HAVE_THREAD_LOCAL
 
 #include "boost/compute/command_queue.hpp"
+#include "boost/compute/container/vector.hpp"
 #include "boost/compute/container/mapped_view.hpp"
 #include "boost/compute/iterator/counting_iterator.hpp"
+#include "boost/compute/algorithm/fill.hpp"
+#include "boost/compute/algorithm/copy_n.hpp"
+#include "boost/compute/algorithm/count_if.hpp"
+#include "boost/compute/algorithm/for_each.hpp"
 #include "boost/compute/algorithm/transform.hpp"
+#include "boost/compute/algorithm/nth_element.hpp"
+#include "boost/compute/algorithm/exclusive_scan.hpp"
 #include "boost/compute/algorithm/transform_reduce.hpp"
+#include "boost/compute/memory/local_buffer.hpp"
+#include "boost/compute/utility/source.hpp"
+#include "boost/compute/utility/program_cache.hpp"
 
 // Allow closure pointers:
 // https://groups.google.com/forum/#!topic/boost-compute/5D2A_vJ83B8
@@ -37,6 +37,26 @@ bool Cloud::hasValidSize() const noexcept
     return int(points.size()) == width * height;
 }
 
+float Cloud::getFillRatio() const noexcept
+{
+    if(points.empty())
+    {
+        return 0;
+    }
+
+    std::size_t numFinitePoints = 0;
+
+    for(const Point& point : points)
+    {
+        if(point.isFinite())
+        {
+            ++numFinitePoints;
+        }
+    }
+
+    return float(double(numFinitePoints) / points.size());
+}
+
 void Cloud::copyTo(Cloud& other) const
 {
     other.points.clear();
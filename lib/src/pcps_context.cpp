@@ -0,0 +1,320 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_context.h"
+
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include "pcps_logger.h"
+#include "pcps_thread_pool.h"
+#include "pcps_device_cloud.h"
+#include "pcps_normal_region.h"
+#include "pcps_normal_splitter.h"
+#include "pcps_plane_segmentator.h"
+
+#ifdef PCPS_OPENCL
+    #include "pcps_program_cache.h"
+    #include "pcps_device_buffer_pool.h"
+#endif
+
+namespace pcps
+{
+
+namespace
+{
+    constexpr int minCalibrationSide = 32;
+    constexpr int maxCalibrationSide = 2048;
+    constexpr int calibrationRuns = 3;
+    const char* calibrationHeader = "pcps_calibration";
+
+    void buildWarmUpCloud(int width, int height, float step, Cloud& cloud)
+    {
+        // Two planes, so all segmentation stages have something to do:
+        // a flat one (z = 1) in the first half of the rows and a 45 degrees slope rising from its edge in the other.
+
+        cloud.points.clear();
+        cloud.points.reserve(std::size_t(width) * std::size_t(height));
+        cloud.width = width;
+        cloud.height = height;
+
+        float edgeY = (height / 2) * step;
+
+        for(int row = 0; row < height; ++row)
+        {
+            for(int column = 0; column < width; ++column)
+            {
+                float x = column * step;
+                float y = row * step;
+                float z = row < height / 2 ? 1 : 1 + y - edgeY;
+                cloud.points.push_back(Point{ x, y, z, 0 });
+            }
+        }
+    }
+
+    #if defined(PCPS_OPENCL) || defined(PCPS_CUDA)
+        void buildCalibrationCloud(int side, Cloud& cloud)
+        {
+            // Smoothly varying normals, so regions are split a few levels as in real clouds:
+
+            cloud.points.clear();
+            cloud.points.reserve(std::size_t(side * side));
+            cloud.width = side;
+            cloud.height = side;
+
+            for(int row = 0; row < side; ++row)
+            {
+                for(int column = 0; column < side; ++column)
+                {
+                    Point normal{ 0.2f * std::sin(column * 0.05f), 0.2f * std::cos(row * 0.05f), 1, 0 };
+                    float length = std::sqrt(normal.dot(normal));
+                    cloud.points.push_back(Point{ normal.x / length, normal.y / length, normal.z / length, 1 });
+                }
+            }
+        }
+
+        bool getSplitElapsedMcs(const DeviceCloud& normalDeviceCloud, int maxCpuRegionArea, Context& context,
+                                std::int64_t& elapsedMcs)
+        {
+            NormalSplitter normalSplitter;
+            std::vector<NormalRegion> normalRegions;
+
+            if(! context.setSplitterMaxCpuRegionArea(maxCpuRegionArea))
+            {
+                return false;
+            }
+
+            // The first split builds the device programs, so it is not timed:
+
+            if(! normalSplitter.split(normalDeviceCloud, normalRegions, context))
+            {
+                return false;
+            }
+
+            elapsedMcs = std::numeric_limits<std::int64_t>::max();
+
+            for(int run = 0; run < calibrationRuns; ++run)
+            {
+                normalRegions.clear();
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+                bool success = normalSplitter.split(normalDeviceCloud, normalRegions, context);
+                auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+
+                if(! success)
+                {
+                    return false;
+                }
+
+                auto runElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+                elapsedMcs = std::min(elapsedMcs, std::int64_t(runElapsedMcs));
+            }
+
+            return true;
+        }
+    #endif
+}
+
+Context::Context() noexcept = default;
+
+Context::~Context() = default;
+
+int Context::getThreads() const noexcept
+{
+    std::lock_guard<std::mutex> lock(_threadPoolMutex);
+    return _threads;
+}
+
+bool Context::setThreads(int threads) noexcept
+{
+    if(threads < 1)
+    {
+        PCPS_LOG_ERROR << "Invalid threads: " << threads << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_threadPoolMutex);
+    _threads = threads;
+    return true;
+}
+
+int Context::getSplitterMaxCpuRegionArea() const noexcept
+{
+    return _splitterMaxCpuRegionArea;
+}
+
+bool Context::setSplitterMaxCpuRegionArea(int maxCpuRegionArea) noexcept
+{
+    if(maxCpuRegionArea < 1)
+    {
+        PCPS_LOG_ERROR << "Invalid maxCpuRegionArea: " << maxCpuRegionArea << std::endl;
+        return false;
+    }
+
+    _splitterMaxCpuRegionArea = maxCpuRegionArea;
+    return true;
+}
+
+bool Context::calibrate()
+{
+    #if defined(PCPS_OPENCL) || defined(PCPS_CUDA)
+        // The crossover is the smallest area from which the device is faster in all bigger areas,
+        // so a noisy small area doesn't move it down:
+
+        int oldMaxCpuRegionArea = _splitterMaxCpuRegionArea;
+        int crossoverArea = std::numeric_limits<int>::max();
+
+        for(int side = maxCalibrationSide; side >= minCalibrationSide; side /= 2)
+        {
+            Cloud normalCloud;
+            buildCalibrationCloud(side, normalCloud);
+
+            DeviceCloud normalDeviceCloud(normalCloud, *this);
+            int area = side * side;
+            std::int64_t cpuElapsedMcs;
+            std::int64_t deviceElapsedMcs;
+
+            if(! getSplitElapsedMcs(normalDeviceCloud, std::numeric_limits<int>::max(), *this, cpuElapsedMcs) ||
+                    ! getSplitElapsedMcs(normalDeviceCloud, 1, *this, deviceElapsedMcs))
+            {
+                PCPS_LOG_ERROR << "Normal split failed" << std::endl;
+                _splitterMaxCpuRegionArea = oldMaxCpuRegionArea;
+                return false;
+            }
+
+            if(deviceElapsedMcs >= cpuElapsedMcs)
+            {
+                break;
+            }
+
+            crossoverArea = area;
+        }
+
+        _splitterMaxCpuRegionArea = crossoverArea;
+    #endif
+
+    return true;
+}
+
+bool Context::saveCalibration(const std::string& filePath) const
+{
+    std::ofstream file(filePath);
+
+    if(! file)
+    {
+        PCPS_LOG_ERROR << "Calibration file open failed: " << filePath << std::endl;
+        return false;
+    }
+
+    file << calibrationHeader << '\n';
+    file << "splitterMaxCpuRegionArea " << _splitterMaxCpuRegionArea << '\n';
+
+    if(! file)
+    {
+        PCPS_LOG_ERROR << "Calibration file write failed: " << filePath << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Context::loadCalibration(const std::string& filePath)
+{
+    std::ifstream file(filePath);
+
+    if(! file)
+    {
+        PCPS_LOG_ERROR << "Calibration file open failed: " << filePath << std::endl;
+        return false;
+    }
+
+    std::string header;
+    std::string name;
+    int splitterMaxCpuRegionArea = 0;
+
+    if(! (file >> header >> name >> splitterMaxCpuRegionArea) || header != calibrationHeader ||
+            name != "splitterMaxCpuRegionArea")
+    {
+        PCPS_LOG_ERROR << "Invalid calibration file: " << filePath << std::endl;
+        return false;
+    }
+
+    return setSplitterMaxCpuRegionArea(splitterMaxCpuRegionArea);
+}
+
+bool Context::warmUp(int width, int height, int neighborLevels)
+{
+    if(width < 1 || height < 1)
+    {
+        PCPS_LOG_ERROR << "Invalid cloud size: " << width << ", " << height << std::endl;
+        return false;
+    }
+
+    if(neighborLevels < 1)
+    {
+        PCPS_LOG_ERROR << "Invalid neighbor levels: " << neighborLevels << std::endl;
+        return false;
+    }
+
+    // The normal extractor retrieves floor(searchRadius / cellDistance) neighbor levels:
+
+    PlaneSegmentator planeSegmentator;
+    float step = planeSegmentator.normalExtractor.getSearchRadius() / (neighborLevels + 0.5f);
+
+    Cloud organizedCloud;
+    buildWarmUpCloud(width, height, step, organizedCloud);
+
+    Cloud unorganizedCloud = organizedCloud;
+    unorganizedCloud.width = int(unorganizedCloud.points.size());
+    unorganizedCloud.height = 1;
+
+    std::vector<Plane> planes;
+
+    if(! planeSegmentator.segmentate(unorganizedCloud, planes, *this))
+    {
+        PCPS_LOG_ERROR << "Unorganized cloud segmentation failed" << std::endl;
+        return false;
+    }
+
+    if(! planeSegmentator.segmentate(organizedCloud, planes, *this))
+    {
+        PCPS_LOG_ERROR << "Organized cloud segmentation failed" << std::endl;
+        return false;
+    }
+
+    DeviceCloud organizedDeviceCloud(organizedCloud, *this);
+
+    if(! planeSegmentator.segmentate(organizedDeviceCloud, planes, *this))
+    {
+        PCPS_LOG_ERROR << "Organized device cloud segmentation failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<ThreadPool> Context::getThreadPool()
+{
+    std::lock_guard<std::mutex> lock(_threadPoolMutex);
+
+    if(! _threadPool || _threadPool->getThreads() != _threads)
+    {
+        // The old pool is destroyed when its last user releases it:
+        _threadPool = std::make_shared<ThreadPool>(_threads);
+    }
+
+    return _threadPool;
+}
+
+int Context::_getDefaultThreads() noexcept
+{
+    return std::max(int(std::thread::hardware_concurrency()), 1);
+}
+
+}
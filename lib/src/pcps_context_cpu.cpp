@@ -6,6 +6,9 @@
 
 #include "pcps_context.h"
 
+#include <limits>
+#include "pcps_thread_pool.h"
+
 namespace pcps
 {
 
@@ -14,4 +17,16 @@ std::unique_ptr<Context> Context::buildDefault()
     return std::unique_ptr<Context>(new Context());
 }
 
+int Context::_getDefaultSplitterMaxCpuRegionArea() noexcept
+{
+    // There's no device, so all regions are reduced on the host:
+    return std::numeric_limits<int>::max();
+}
+
+bool Context::isThreadSafe() const noexcept
+{
+    // Host algorithms only share the thread pool, which runs nested tasks in the calling thread:
+    return true;
+}
+
 }
@@ -6,6 +6,8 @@
 
 #include "pcps_context.h"
 
+#include "pcps_tweak_me.h"
+#include "pcps_thread_pool.h"
 #include "pcps_thrust_cached_allocator.h"
 
 namespace pcps
@@ -36,4 +38,15 @@ Context::Context(pcps_thrust::CachedAllocator& _allocator) noexcept :
 {
 }
 
+int Context::_getDefaultSplitterMaxCpuRegionArea() noexcept
+{
+    return PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA;
+}
+
+bool Context::isThreadSafe() const noexcept
+{
+    // The cached allocator is not synchronized:
+    return false;
+}
+
 }
@@ -6,7 +6,13 @@
 
 #include "pcps_context.h"
 
-#include "pcps_boost_compute.h"
+#include <cstdio>
+#include <fstream>
+#include "pcps_logger.h"
+#include "pcps_tweak_me.h"
+#include "pcps_thread_pool.h"
+#include "pcps_program_cache.h"
+#include "pcps_device_buffer_pool.h"
 
 namespace bpc = boost::compute;
 
@@ -48,4 +54,94 @@ Context::Context(const bpc::context& _context, bpc::command_queue& _queue) noexc
 {
 }
 
+bool Context::hasZeroCopyHostMemory()
+{
+    return getDeviceBufferPool().isZeroCopy();
+}
+
+std::uint64_t Context::getDeviceBufferAllocations()
+{
+    return getDeviceBufferPool().getAllocations();
+}
+
+std::uint64_t Context::getDeviceBufferReuses()
+{
+    return getDeviceBufferPool().getReuses();
+}
+
+DeviceBufferPool& Context::getDeviceBufferPool()
+{
+    if(! _deviceBufferPool)
+    {
+        _deviceBufferPool.reset(new DeviceBufferPool(*context));
+    }
+
+    return *_deviceBufferPool;
+}
+
+const std::string& Context::getProgramCacheDirectory()
+{
+    return getProgramCache().getDirectory();
+}
+
+bool Context::setProgramCacheDirectory(const std::string& directory)
+{
+    if(! directory.empty())
+    {
+        std::string probePath = directory + "/pcps_probe.tmp";
+        bool writable = bool(std::ofstream(probePath));
+        std::remove(probePath.c_str());
+
+        if(! writable)
+        {
+            PCPS_LOG_ERROR << "Invalid program cache directory: " << directory << std::endl;
+            return false;
+        }
+    }
+
+    getProgramCache().setDirectory(directory);
+    return true;
+}
+
+std::uint64_t Context::getProgramCacheDiskHits()
+{
+    return getProgramCache().getDiskHits();
+}
+
+std::uint64_t Context::getProgramBuilds()
+{
+    return getProgramCache().getBuilds();
+}
+
+bool Context::specializeCloudGeometry()
+{
+    return getProgramCache().specializeCloudGeometry();
+}
+
+void Context::setSpecializeCloudGeometry(bool specialize)
+{
+    getProgramCache().setSpecializeCloudGeometry(specialize);
+}
+
+ProgramCache& Context::getProgramCache()
+{
+    if(! _programCache)
+    {
+        _programCache.reset(new ProgramCache(*context));
+    }
+
+    return *_programCache;
+}
+
+int Context::_getDefaultSplitterMaxCpuRegionArea() noexcept
+{
+    return PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA;
+}
+
+bool Context::isThreadSafe() const noexcept
+{
+    // Kernels and temporary buffers are shared through the program cache and the in-order queue:
+    return false;
+}
+
 }
@@ -0,0 +1,60 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_CPU_PARALLEL_H
+#define PCPS_CPU_PARALLEL_H
+
+#include <algorithm>
+#include "pcps_thread_pool.h"
+
+namespace pcps
+{
+
+///@cond INTERNAL
+
+/**
+ * @brief Retrieves in how many chunks a range should be split to be processed in parallel.
+ * @param count Range size.
+ * @param minChunkSize Minimum number of items per chunk.
+ * @param threads Maximum number of threads.
+ * @return Number of chunks [1..threads].
+ */
+inline int getParallelChunks(std::size_t count, std::size_t minChunkSize, int threads) noexcept
+{
+    std::size_t maxChunks = count / std::max(minChunkSize, std::size_t(1));
+    return int(std::max(std::min(maxChunks, std::size_t(std::max(threads, 1))), std::size_t(1)));
+}
+
+/**
+ * @brief Splits a range in contiguous chunks and processes them in parallel with the given thread pool.
+ *
+ * @param threadPool Pool of threads which process the chunks.
+ * @param count Range size.
+ * @param chunks Number of chunks.
+ * @param function Callable with the signature void(int chunk, std::size_t begin, std::size_t end).
+ */
+template<class Function>
+void parallelChunks(ThreadPool& threadPool, std::size_t count, int chunks, const Function& function)
+{
+    if(chunks <= 1)
+    {
+        function(0, std::size_t(0), count);
+        return;
+    }
+
+    threadPool.run(chunks, [&function, count, chunks](int chunk)
+    {
+        std::size_t begin = (count * std::size_t(chunk)) / std::size_t(chunks);
+        std::size_t end = (count * std::size_t(chunk + 1)) / std::size_t(chunks);
+        function(chunk, begin, end);
+    });
+}
+
+///@endcond
+
+}
+
+#endif
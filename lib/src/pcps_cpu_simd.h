@@ -0,0 +1,55 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_CPU_SIMD_H
+#define PCPS_CPU_SIMD_H
+
+// Vector code is compiled per function with target attributes and selected at runtime,
+// so the library does not require any instruction set flag:
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define PCPS_CPU_SIMD_X86
+    #define PCPS_CPU_SIMD_SSE4_2 __attribute__((target("sse4.2")))
+    #define PCPS_CPU_SIMD_AVX2 __attribute__((target("avx2")))
+
+    #include <immintrin.h>
+#endif
+
+namespace pcps
+{
+
+///@cond INTERNAL
+
+/**
+ * @brief Indicates if the running CPU supports SSE4.2 instructions.
+ */
+inline bool cpuSupportsSse42() noexcept
+{
+    #ifdef PCPS_CPU_SIMD_X86
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    #else
+        return false;
+    #endif
+}
+
+/**
+ * @brief Indicates if the running CPU supports AVX2 instructions.
+ */
+inline bool cpuSupportsAvx2() noexcept
+{
+    #ifdef PCPS_CPU_SIMD_X86
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #else
+        return false;
+    #endif
+}
+
+///@endcond
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_device_buffer_pool.h"
+
+#include "pcps_tweak_me.h"
+
+namespace bpc = boost::compute;
+
+namespace pcps
+{
+
+namespace
+{
+    bool isZeroCopyDevice(const bpc::device& device)
+    {
+        if(device.type() & CL_DEVICE_TYPE_CPU)
+        {
+            return true;
+        }
+
+        if(device.get_info<cl_bool>(CL_DEVICE_HOST_UNIFIED_MEMORY))
+        {
+            return true;
+        }
+
+        return device.platform().name().find("Portable Computing Language") != std::string::npos;
+    }
+
+    std::size_t getBucketBytes(std::size_t bytes) noexcept
+    {
+        std::size_t bucketBytes = PCPS_OPENCL_BUFFER_POOL_MIN_BYTES;
+
+        while(bucketBytes < bytes)
+        {
+            bucketBytes *= 2;
+        }
+
+        return bucketBytes;
+    }
+}
+
+DeviceBufferPool::DeviceBufferPool(const bpc::context& context) :
+    _context(&context),
+    _zeroCopy(isZeroCopyDevice(context.get_device()))
+{
+}
+
+bpc::buffer DeviceBufferPool::acquire(std::size_t bytes)
+{
+    return _acquire(_deviceBuckets, bytes, bpc::buffer::read_write);
+}
+
+void DeviceBufferPool::release(const bpc::buffer& buffer)
+{
+    _release(_deviceBuckets, buffer);
+}
+
+bpc::buffer DeviceBufferPool::acquireStaging(std::size_t bytes)
+{
+    return _acquire(_stagingBuckets, bytes, bpc::buffer::read_write | bpc::buffer::alloc_host_ptr);
+}
+
+void DeviceBufferPool::releaseStaging(const bpc::buffer& buffer)
+{
+    _release(_stagingBuckets, buffer);
+}
+
+void DeviceBufferPool::clear()
+{
+    _deviceBuckets.clear();
+    _stagingBuckets.clear();
+}
+
+bpc::buffer DeviceBufferPool::_acquire(Buckets& buckets, std::size_t bytes, cl_mem_flags flags)
+{
+    std::size_t bucketBytes = getBucketBytes(bytes);
+    std::vector<bpc::buffer>& bucket = buckets[bucketBytes];
+
+    if(bucket.empty())
+    {
+        ++_allocations;
+        return bpc::buffer(*_context, bucketBytes, flags);
+    }
+
+    bpc::buffer result = bucket.back();
+    bucket.pop_back();
+    ++_reuses;
+    return result;
+}
+
+void DeviceBufferPool::_release(Buckets& buckets, const bpc::buffer& buffer)
+{
+    // Buffers whose size is not a bucket one were not acquired from this pool:
+
+    std::size_t bytes = buffer.size();
+
+    if(bytes != getBucketBytes(bytes))
+    {
+        return;
+    }
+
+    std::vector<bpc::buffer>& bucket = buckets[bytes];
+
+    if(bucket.size() < PCPS_OPENCL_BUFFER_POOL_MAX_BUCKET_BUFFERS)
+    {
+        bucket.push_back(buffer);
+    }
+}
+
+}
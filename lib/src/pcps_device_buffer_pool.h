@@ -0,0 +1,278 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_DEVICE_BUFFER_POOL_H
+#define PCPS_DEVICE_BUFFER_POOL_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "pcps_boost_compute.h"
+
+namespace pcps
+{
+
+///@cond INTERNAL
+
+/**
+ * @brief Typed view of the first elements of a device buffer, which can be bigger than the view.
+ *
+ * It provides the same interface as boost::compute::mapped_view, so kernels can capture both of them.
+ */
+template<class Type>
+class DeviceBuffer
+{
+
+public:
+    using value_type = Type;
+    using iterator = boost::compute::buffer_iterator<Type>;
+    using const_iterator = boost::compute::buffer_iterator<Type>;
+
+    DeviceBuffer() = default;
+
+    DeviceBuffer(const boost::compute::buffer& buffer, std::size_t count) :
+        _buffer(buffer),
+        _count(count)
+    {
+    }
+
+    const_iterator begin() const
+    {
+        return boost::compute::make_buffer_iterator<Type>(_buffer, 0);
+    }
+
+    const_iterator end() const
+    {
+        return boost::compute::make_buffer_iterator<Type>(_buffer, _count);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return _count;
+    }
+
+    const boost::compute::buffer& get_buffer() const noexcept
+    {
+        return _buffer;
+    }
+
+private:
+    boost::compute::buffer _buffer;
+    std::size_t _count = 0;
+};
+
+/**
+ * @brief Size-bucketed pool of device buffers and pinned host staging buffers, reused across frames.
+ *
+ * Buffers are rounded up to the next power of two, so a buffer released by a frame
+ * can be acquired again by the next one if its size is similar.
+ * Buffers which are not released are freed when they are no longer referenced, as usual.
+ *
+ * Released buffers can be acquired again right away, since all commands go through the same in-order queue.
+ */
+class DeviceBufferPool
+{
+
+public:
+    explicit DeviceBufferPool(const boost::compute::context& context);
+
+    /**
+     * @brief Indicates if the device can access host memory without copies,
+     * as CPU devices, integrated GPUs or PoCL ones.
+     */
+    bool isZeroCopy() const noexcept
+    {
+        return _zeroCopy;
+    }
+
+    /**
+     * @brief Retrieves a device buffer with at least the given size in bytes.
+     */
+    boost::compute::buffer acquire(std::size_t bytes);
+
+    /**
+     * @brief Retrieves a device buffer with room for at least the given number of elements.
+     */
+    template<class Type>
+    DeviceBuffer<Type> acquire(std::size_t count)
+    {
+        return DeviceBuffer<Type>(acquire(count * sizeof(Type)), count);
+    }
+
+    /**
+     * @brief Retrieves a device buffer with a copy of the given host elements.
+     */
+    template<class Type>
+    DeviceBuffer<Type> upload(const Type* data, std::size_t count, boost::compute::command_queue& queue)
+    {
+        DeviceBuffer<Type> result = acquire<Type>(count);
+        queue.enqueue_write_buffer(result.get_buffer(), 0, count * sizeof(Type), data);
+        return result;
+    }
+
+    /**
+     * @brief Gives back the given device buffer, so it can be acquired again.
+     */
+    void release(const boost::compute::buffer& buffer);
+
+    /**
+     * @brief Gives back the given device buffer, so it can be acquired again.
+     */
+    template<class Type>
+    void release(const DeviceBuffer<Type>& buffer)
+    {
+        release(buffer.get_buffer());
+    }
+
+    /**
+     * @brief Retrieves a pinned host staging buffer with at least the given size in bytes.
+     */
+    boost::compute::buffer acquireStaging(std::size_t bytes);
+
+    /**
+     * @brief Gives back the given pinned host staging buffer, so it can be acquired again.
+     */
+    void releaseStaging(const boost::compute::buffer& buffer);
+
+    /**
+     * @brief Retrieves the number of buffers allocated since the pool was created.
+     */
+    std::uint64_t getAllocations() const noexcept
+    {
+        return _allocations;
+    }
+
+    /**
+     * @brief Retrieves the number of buffers acquired from the pool without allocating them.
+     */
+    std::uint64_t getReuses() const noexcept
+    {
+        return _reuses;
+    }
+
+    /**
+     * @brief Frees all released buffers.
+     */
+    void clear();
+
+private:
+    using Buckets = std::map<std::size_t, std::vector<boost::compute::buffer>>;
+
+    const boost::compute::context* _context;
+    Buckets _deviceBuckets;
+    Buckets _stagingBuckets;
+    std::uint64_t _allocations = 0;
+    std::uint64_t _reuses = 0;
+    bool _zeroCopy;
+
+    boost::compute::buffer _acquire(Buckets& buckets, std::size_t bytes, cl_mem_flags flags);
+
+    void _release(Buckets& buckets, const boost::compute::buffer& buffer);
+};
+
+/**
+ * @brief Acquires device buffers from a pool and gives them back when it goes out of scope.
+ */
+class DeviceBufferScope
+{
+
+public:
+    DeviceBufferScope(DeviceBufferPool& pool, boost::compute::command_queue& queue) :
+        _pool(pool),
+        _queue(queue)
+    {
+    }
+
+    DeviceBufferScope(const DeviceBufferScope& other) = delete;
+
+    DeviceBufferScope& operator=(const DeviceBufferScope& other) = delete;
+
+    ~DeviceBufferScope()
+    {
+        for(const boost::compute::buffer& buffer : _buffers)
+        {
+            _pool.release(buffer);
+        }
+    }
+
+    /**
+     * @brief Retrieves a device buffer with room for at least the given number of elements.
+     */
+    template<class Type>
+    DeviceBuffer<Type> acquire(std::size_t count)
+    {
+        DeviceBuffer<Type> result = _pool.acquire<Type>(count);
+        _buffers.push_back(result.get_buffer());
+        return result;
+    }
+
+    /**
+     * @brief Retrieves a device buffer with a copy of the given host elements.
+     */
+    template<class Type>
+    DeviceBuffer<Type> upload(const Type* data, std::size_t count)
+    {
+        DeviceBuffer<Type> result = _pool.upload(data, count, _queue);
+        _buffers.push_back(result.get_buffer());
+        return result;
+    }
+
+private:
+    DeviceBufferPool& _pool;
+    boost::compute::command_queue& _queue;
+    std::vector<boost::compute::buffer> _buffers;
+};
+
+///@endcond
+
+}
+
+namespace boost
+{
+    namespace compute
+    {
+        template<>
+        inline const char* type_name<pcps::DeviceBuffer<int>>()
+        {
+            return "__global int *";
+        }
+
+        template<>
+        inline const char* type_name<pcps::DeviceBuffer<float>>()
+        {
+            return "__global float *";
+        }
+
+        template<>
+        inline const char* type_name<pcps::DeviceBuffer<float4_>>()
+        {
+            return "__global float4 *";
+        }
+
+        namespace detail
+        {
+            inline meta_kernel& operator<<(meta_kernel& kernel, const pcps::DeviceBuffer<int>& deviceBuffer)
+            {
+                kernel << kernel.var<int*>(kernel.get_buffer_identifier<int>(deviceBuffer.get_buffer()));
+                return kernel;
+            }
+
+            inline meta_kernel& operator<<(meta_kernel& kernel, const pcps::DeviceBuffer<float>& deviceBuffer)
+            {
+                kernel << kernel.var<float*>(kernel.get_buffer_identifier<float>(deviceBuffer.get_buffer()));
+                return kernel;
+            }
+
+            inline meta_kernel& operator<<(meta_kernel& kernel, const pcps::DeviceBuffer<float4_>& deviceBuffer)
+            {
+                kernel << kernel.var<float4_*>(kernel.get_buffer_identifier<float4_>(deviceBuffer.get_buffer()));
+                return kernel;
+            }
+        }
+    }
+}
+
+#endif
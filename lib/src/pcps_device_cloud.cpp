@@ -14,6 +14,10 @@ namespace pcps
 DeviceCloud::DeviceCloud(DeviceCloud&& other) noexcept :
     _hostCloud(nullptr),
     _deviceData(nullptr),
+    #ifdef PCPS_OPENCL
+        _context(nullptr),
+        _pooledDeviceData(false),
+    #endif
     _constHostCloud(false)
 {
     *this = std::move(other);
@@ -23,6 +27,12 @@ DeviceCloud& DeviceCloud::operator=(DeviceCloud&& other) noexcept
 {
     std::swap(_hostCloud, other._hostCloud);
     std::swap(_deviceData, other._deviceData);
+
+    #ifdef PCPS_OPENCL
+        std::swap(_context, other._context);
+        std::swap(_pooledDeviceData, other._pooledDeviceData);
+    #endif
+
     std::swap(_constHostCloud, other._constHostCloud);
     return *this;
 }
@@ -6,40 +6,79 @@
 
 #include "pcps_device_cloud.h"
 
+#include <cstring>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_context.h"
-#include "pcps_boost_compute.h"
+#include "pcps_device_buffer_pool.h"
 
 namespace bpc = boost::compute;
-using DeviceView = bpc::mapped_view<bpc::float4_>;
+using DeviceView = pcps::DeviceBuffer<bpc::float4_>;
 
 namespace pcps
 {
 
 static_assert(sizeof(Point) == sizeof(bpc::float4_), "");
 
+namespace
+{
+    DeviceView* createDevicePoints(const std::vector<Point>& points, bool& pooled, Context& context)
+    {
+        DeviceBufferPool& pool = context.getDeviceBufferPool();
+        std::size_t bytes = points.size() * sizeof(Point);
+
+        // Zero-copy devices read and write host memory directly:
+
+        if(pool.isZeroCopy())
+        {
+            pooled = false;
+
+            bpc::buffer buffer(*context.context, bytes, bpc::buffer::read_write | bpc::buffer::use_host_ptr,
+                               const_cast<Point*>(points.data()));
+            return new DeviceView(buffer, points.size());
+        }
+
+        // Otherwise, points are uploaded to a pooled device buffer through a pinned staging buffer:
+
+        pooled = true;
+
+        bpc::command_queue& queue = *context.queue;
+        bpc::buffer deviceBuffer = pool.acquire(bytes);
+        bpc::buffer stagingBuffer = pool.acquireStaging(bytes);
+        void* stagingData = queue.enqueue_map_buffer(stagingBuffer, CL_MAP_WRITE, 0, bytes);
+        std::memcpy(stagingData, points.data(), bytes);
+        queue.enqueue_unmap_buffer(stagingBuffer, stagingData);
+        queue.enqueue_copy_buffer(stagingBuffer, deviceBuffer, 0, 0, bytes);
+        pool.releaseStaging(stagingBuffer);
+        return new DeviceView(deviceBuffer, points.size());
+    }
+}
+
 DeviceCloud::DeviceCloud(const Cloud& hostCloud, Context& context) :
     _hostCloud(const_cast<Cloud*>(&hostCloud)),
+    _context(&context),
     _constHostCloud(true)
 {
-    const std::vector<Point>& points = hostCloud.points;
-    auto pointsPtr = reinterpret_cast<const bpc::float4_*>(points.data());
-    _deviceData = new DeviceView(pointsPtr, points.size(), *context.context);
+    _deviceData = createDevicePoints(hostCloud.points, _pooledDeviceData, context);
 }
 
 DeviceCloud::DeviceCloud(Cloud& hostCloud, Context& context) :
     _hostCloud(&hostCloud),
+    _context(&context),
     _constHostCloud(false)
 {
-    std::vector<Point>& points = hostCloud.points;
-    auto pointsPtr = reinterpret_cast<bpc::float4_*>(points.data());
-    _deviceData = new DeviceView(pointsPtr, points.size(), *context.context);
+    _deviceData = createDevicePoints(hostCloud.points, _pooledDeviceData, context);
 }
 
 DeviceCloud::~DeviceCloud() noexcept
 {
     auto deviceView = static_cast<DeviceView*>(_deviceData);
+
+    if(deviceView && _pooledDeviceData)
+    {
+        _context->getDeviceBufferPool().release(*deviceView);
+    }
+
     delete deviceView;
     _deviceData = nullptr;
 }
@@ -53,7 +92,29 @@ bool DeviceCloud::updateHostCloud(Context& context)
     }
 
     auto deviceView = static_cast<DeviceView*>(_deviceData);
-    deviceView->map(*context.queue);
+    const bpc::buffer& deviceBuffer = deviceView->get_buffer();
+    std::vector<Point>& points = _hostCloud->points;
+    std::size_t bytes = points.size() * sizeof(Point);
+    bpc::command_queue& queue = *context.queue;
+
+    if(! _pooledDeviceData)
+    {
+        // Mapping a host pointer buffer synchronizes the host memory with the device one:
+
+        void* mappedData = queue.enqueue_map_buffer(deviceBuffer, CL_MAP_READ, 0, bytes);
+        queue.enqueue_unmap_buffer(deviceBuffer, mappedData);
+        queue.finish();
+        return true;
+    }
+
+    DeviceBufferPool& pool = context.getDeviceBufferPool();
+    bpc::buffer stagingBuffer = pool.acquireStaging(bytes);
+    queue.enqueue_copy_buffer(deviceBuffer, stagingBuffer, 0, 0, bytes);
+
+    void* stagingData = queue.enqueue_map_buffer(stagingBuffer, CL_MAP_READ, 0, bytes);
+    std::memcpy(points.data(), stagingData, bytes);
+    queue.enqueue_unmap_buffer(stagingBuffer, stagingData);
+    pool.releaseStaging(stagingBuffer);
     return true;
 }
 
@@ -11,10 +11,26 @@
 #include "pcps_device_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_epsilon.h"
+#include "pcps_cpu_simd.h"
 
 namespace pcps
 {
 
+NormalExtractor::CpuInstructions NormalExtractor::getMaxCpuInstructions() noexcept
+{
+    if(cpuSupportsAvx2())
+    {
+        return CpuInstructions::AVX2;
+    }
+
+    if(cpuSupportsSse42())
+    {
+        return CpuInstructions::SSE4_2;
+    }
+
+    return CpuInstructions::SCALAR;
+}
+
 float NormalExtractor::getSearchRadius() const noexcept
 {
     return _searchRadius;
@@ -52,11 +68,55 @@ void NormalExtractor::setFlipViewPoint(const Point& flipViewPoint) noexcept
     _flipViewPoint = flipViewPoint;
 }
 
+bool NormalExtractor::useIntegralImages() const noexcept
+{
+    return _useIntegralImages;
+}
+
+void NormalExtractor::setUseIntegralImages(bool useIntegralImages) noexcept
+{
+    _useIntegralImages = useIntegralImages;
+}
+
+bool NormalExtractor::useLocalMemory() const noexcept
+{
+    return _useLocalMemory;
+}
+
+void NormalExtractor::setUseLocalMemory(bool useLocalMemory) noexcept
+{
+    _useLocalMemory = useLocalMemory;
+}
+
+NormalExtractor::CpuInstructions NormalExtractor::getCpuInstructions() const noexcept
+{
+    return _cpuInstructions;
+}
+
+bool NormalExtractor::setCpuInstructions(CpuInstructions cpuInstructions) noexcept
+{
+    if(int(cpuInstructions) < int(CpuInstructions::SCALAR) || int(cpuInstructions) > int(getMaxCpuInstructions()))
+    {
+        PCPS_LOG_ERROR << "Invalid cpuInstructions: " << int(cpuInstructions) << std::endl;
+        return false;
+    }
+
+    _cpuInstructions = cpuInstructions;
+    return true;
+}
+
 bool NormalExtractor::extract(const Cloud& inputPointCloud, Cloud& outputNormalCloud, Context& context) const
 {
+    if(inputPointCloud.points.empty())
+    {
+        PCPS_LOG_ERROR << "Point cloud is empty" << std::endl;
+        return false;
+    }
+
+    DeviceCloud inputPointDeviceCloud(inputPointCloud, context);
     int neighborLevels = 0;
 
-    if(! _getNeighborLevels(inputPointCloud, neighborLevels))
+    if(! _getNeighborLevels(inputPointDeviceCloud, neighborLevels, context))
     {
         PCPS_LOG_ERROR << "Neighbor levels calculation failed" << std::endl;
         return false;
@@ -67,7 +127,6 @@ bool NormalExtractor::extract(const Cloud& inputPointCloud, Cloud& outputNormalC
     outputNormalCloud.sensorOrigin = inputPointCloud.sensorOrigin;
     outputNormalCloud.points.resize(inputPointCloud.points.size());
 
-    DeviceCloud inputPointDeviceCloud(inputPointCloud, context);
     DeviceCloud outputNormalDeviceCloud(outputNormalCloud, context);
     void* outputNormalDeviceData = outputNormalDeviceCloud.getDeviceData();
 
@@ -77,7 +136,9 @@ bool NormalExtractor::extract(const Cloud& inputPointCloud, Cloud& outputNormalC
         return false;
     }
 
-    if(! _extract(inputPointDeviceCloud, neighborLevels, outputNormalDeviceData, context))
+    bool statisticsBuilt = false;
+
+    if(! _extract(inputPointDeviceCloud, neighborLevels, outputNormalDeviceData, nullptr, statisticsBuilt, context))
     {
         PCPS_LOG_ERROR << "Extraction failed" << std::endl;
         return false;
@@ -94,12 +155,19 @@ bool NormalExtractor::extract(const Cloud& inputPointCloud, Cloud& outputNormalC
 
 bool NormalExtractor::extract(const DeviceCloud& inputPointDeviceCloud, DeviceCloud& outputNormalDeviceCloud,
                               Context& context) const
+{
+    bool statisticsBuilt = false;
+    return _extract(inputPointDeviceCloud, outputNormalDeviceCloud, nullptr, statisticsBuilt, context);
+}
+
+bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, DeviceCloud& outputNormalDeviceCloud,
+                               NormalStatistics* normalStatistics, bool& statisticsBuilt, Context& context) const
 {
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
     const Cloud& outputNormalCloud = outputNormalDeviceCloud.getHostCloud();
     int neighborLevels = 0;
 
-    if(! _getNeighborLevels(inputPointCloud, neighborLevels))
+    if(! _getNeighborLevels(inputPointDeviceCloud, neighborLevels, context))
     {
         PCPS_LOG_ERROR << "Neighbor levels calculation failed" << std::endl;
         return false;
@@ -125,7 +193,8 @@ bool NormalExtractor::extract(const DeviceCloud& inputPointDeviceCloud, DeviceCl
         return false;
     }
 
-    if(! _extract(inputPointDeviceCloud, neighborLevels, outputNormalDeviceData, context))
+    if(! _extract(inputPointDeviceCloud, neighborLevels, outputNormalDeviceData, normalStatistics, statisticsBuilt,
+                  context))
     {
         PCPS_LOG_ERROR << "Extraction failed" << std::endl;
         return false;
@@ -217,8 +286,10 @@ float NormalExtractor::_getCellDistance(const Cloud& cloud) noexcept
     return 0;
 }
 
-bool NormalExtractor::_getNeighborLevels(const Cloud& cloud, int& neighborLevels) const noexcept
+bool NormalExtractor::_getNeighborLevels(const DeviceCloud& deviceCloud, int& neighborLevels, Context& context) const
 {
+    const Cloud& cloud = deviceCloud.getHostCloud();
+
     if(cloud.points.empty())
     {
         PCPS_LOG_ERROR << "Point cloud is empty" << std::endl;
@@ -231,9 +302,15 @@ bool NormalExtractor::_getNeighborLevels(const Cloud& cloud, int& neighborLevels
         return false;
     }
 
-    float cellDistance = _getCellDistance(cloud);
+    float cellDistance = 0;
     neighborLevels = 0;
 
+    if(! _getCellDistance(deviceCloud, cellDistance, context))
+    {
+        PCPS_LOG_ERROR << "Cell distance retrieve failed" << std::endl;
+        return false;
+    }
+
     if(cellDistance > 0)
     {
         neighborLevels = std::max(1, int(_searchRadius / cellDistance));
@@ -11,13 +11,24 @@
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_epsilon.h"
+#include "pcps_context.h"
+#include "pcps_tweak_me.h"
+#include "pcps_cpu_simd.h"
 #include "pcps_device_cloud.h"
+#include "pcps_cpu_parallel.h"
+#include "pcps_normal_statistics.h"
 
 namespace pcps
 {
 
 namespace
 {
+    int getRowChunks(int cols, int rows, ThreadPool& threadPool) noexcept
+    {
+        auto minRows = std::size_t(PCPS_CPU_NORMAL_EXTRACTOR_MIN_POINTS_PER_THREAD / std::max(cols, 1));
+        return getParallelChunks(std::size_t(rows), minRows, threadPool.getThreads());
+    }
+
     void computeCircleIndices(int x0, int y0, int radius, int cols, int rows, std::vector<int>& indices)
     {
         int xMin = std::max(-radius, -x0);
@@ -45,41 +56,15 @@ namespace
     }
 
     /**
-     * @brief Compute the 3x3 covariance matrix of a given set of points using their indices.
-     *
-     * http://docs.pointclouds.org/trunk/group__common.html#ga72dfb6e965df9752c88790e026a8ab5f
+     * @brief Compute the 3x3 covariance matrix from the accumulated coordinates of a set of points.
      *
-     * @param points The input cloud points.
-     * @param indices The point cloud indices that need to be used.
+     * @param accum Sums of xx, xy, xz, yy, yz, zz, x, y and z. They are divided by the points count.
+     * @param pointCount The finite points count.
      * @param covarianceMatrix The resultant 3x3 covariance matrix.
-     * @return The finite points count.
      */
-    std::size_t computeCovarianceMatrix(const std::vector<Point>& points, const std::vector<int>& indices,
-            std::array<float, 9>& covarianceMatrix) noexcept
+    void computeCovarianceMatrix(std::array<float, 9>& accum, std::size_t pointCount,
+                                 std::array<float, 9>& covarianceMatrix) noexcept
     {
-        std::size_t pointCount = 0;
-        std::array<float, 9> accum = { 0 };
-
-        for(int index : indices)
-        {
-            const Point& point = points[std::size_t(index)];
-
-            if(point.isFinite())
-            {
-                ++pointCount;
-
-                accum[0] += point.x * point.x;
-                accum[1] += point.x * point.y;
-                accum[2] += point.x * point.z;
-                accum[3] += point.y * point.y;
-                accum[4] += point.y * point.z;
-                accum[5] += point.z * point.z;
-                accum[6] += point.x;
-                accum[7] += point.y;
-                accum[8] += point.z;
-            }
-        }
-
         if(pointCount > 0)
         {
             for(float& accumValue : accum)
@@ -97,7 +82,56 @@ namespace
             covarianceMatrix[6] = covarianceMatrix[2];
             covarianceMatrix[7] = covarianceMatrix[5];
         }
+    }
 
+    /**
+     * @brief Adds the coordinates of the given point to the covariance matrix sums if it is finite.
+     *
+     * @param point Point to add.
+     * @param accum Sums of xx, xy, xz, yy, yz, zz, x, y and z.
+     * @param pointCount The finite points count.
+     */
+    inline void accumulatePoint(const Point& point, std::array<float, 9>& accum, std::size_t& pointCount) noexcept
+    {
+        // Same as Point::isFinite, but it can be inlined in the stencil loops:
+        if(std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z))
+        {
+            ++pointCount;
+
+            accum[0] += point.x * point.x;
+            accum[1] += point.x * point.y;
+            accum[2] += point.x * point.z;
+            accum[3] += point.y * point.y;
+            accum[4] += point.y * point.z;
+            accum[5] += point.z * point.z;
+            accum[6] += point.x;
+            accum[7] += point.y;
+            accum[8] += point.z;
+        }
+    }
+
+    /**
+     * @brief Compute the 3x3 covariance matrix of a given set of points using their indices.
+     *
+     * http://docs.pointclouds.org/trunk/group__common.html#ga72dfb6e965df9752c88790e026a8ab5f
+     *
+     * @param points The input cloud points.
+     * @param indices The point cloud indices that need to be used.
+     * @param covarianceMatrix The resultant 3x3 covariance matrix.
+     * @return The finite points count.
+     */
+    std::size_t computeCovarianceMatrix(const std::vector<Point>& points, const std::vector<int>& indices,
+            std::array<float, 9>& covarianceMatrix) noexcept
+    {
+        std::size_t pointCount = 0;
+        std::array<float, 9> accum = { 0 };
+
+        for(int index : indices)
+        {
+            accumulatePoint(points[std::size_t(index)], accum, pointCount);
+        }
+
+        computeCovarianceMatrix(accum, pointCount, covarianceMatrix);
         return pointCount;
     }
 
@@ -275,21 +309,18 @@ namespace
     }
 
     /**
-     * @brief Compute the Least-Squares plane fit for a given set of points, using their indices,
+     * @brief Compute the Least-Squares plane fit for a given 3x3 covariance matrix
      * and return the estimated plane parameters.
      *
-     * http://docs.pointclouds.org/trunk/group__features.html#gacd392447cd77d22a66f1f7b885f923e1
-     *
-     * @param cloud The input cloud points.
-     * @param indices The point cloud indices that need to be used.
+     * @param covarianceMatrix The 3x3 covariance matrix.
+     * @param pointCount The finite points count used to compute the covariance matrix.
      * @return The resultant plane parameters as: a, b, c, d (ax + by + cz + d = 0).
      */
-    Point computePointNormal(const std::vector<Point>& points, const std::vector<int>& indices) noexcept
+    Point computePointNormal(std::array<float, 9>& covarianceMatrix, std::size_t pointCount) noexcept
     {
-        std::array<float, 9> covarianceMatrix;
         Point result;
 
-        if(computeCovarianceMatrix(points, indices, covarianceMatrix))
+        if(pointCount)
         {
             result = solvePlaneParameters(covarianceMatrix);
 
@@ -310,6 +341,23 @@ namespace
         return result;
     }
 
+    /**
+     * @brief Compute the Least-Squares plane fit for a given set of points, using their indices,
+     * and return the estimated plane parameters.
+     *
+     * http://docs.pointclouds.org/trunk/group__features.html#gacd392447cd77d22a66f1f7b885f923e1
+     *
+     * @param cloud The input cloud points.
+     * @param indices The point cloud indices that need to be used.
+     * @return The resultant plane parameters as: a, b, c, d (ax + by + cz + d = 0).
+     */
+    Point computePointNormal(const std::vector<Point>& points, const std::vector<int>& indices) noexcept
+    {
+        std::array<float, 9> covarianceMatrix;
+        std::size_t pointCount = computeCovarianceMatrix(points, indices, covarianceMatrix);
+        return computePointNormal(covarianceMatrix, pointCount);
+    }
+
     /**
      * @brief Flip the estimated normal of a point towards a given viewpoint.
      *
@@ -335,30 +383,681 @@ namespace
         }
     }
 
-    void computeNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols, int rows,
-                        int neighborLevels, Point* normals)
+    /**
+     * @brief Retrieves the half width of the given row of a circle stencil.
+     * @param radius Circle radius.
+     * @param y Row relative to the circle center [-radius..radius].
+     * @param x Half width candidate.
+     * @return Largest x which satisfies x * x + y * y <= radius * radius.
+     */
+    constexpr int getCircleHalfWidth(int radius, int y, int x = 0)
+    {
+        return ((x + 1) * (x + 1)) + (y * y) <= radius * radius ? getCircleHalfWidth(radius, y, x + 1) : x;
+    }
+
+    /**
+     * @brief Accumulates the circle stencil rows [Y..Radius] of an interior point,
+     * with compile-time row extents.
+     */
+    template<int Radius, int Y, bool End = (Y > Radius)>
+    struct FixedStencilRows
+    {
+        static void accumulate(const Point* center, int cols, std::array<float, 9>& accum,
+                               std::size_t& pointCount) noexcept
+        {
+            constexpr int halfWidth = getCircleHalfWidth(Radius, Y);
+            const Point* rowPoints = center + (Y * cols);
+
+            for(int x = -halfWidth; x <= halfWidth; ++x)
+            {
+                accumulatePoint(rowPoints[x], accum, pointCount);
+            }
+
+            FixedStencilRows<Radius, Y + 1>::accumulate(center, cols, accum, pointCount);
+        }
+    };
+
+    template<int Radius, int Y>
+    struct FixedStencilRows<Radius, Y, true>
+    {
+        static void accumulate(const Point*, int, std::array<float, 9>&, std::size_t&) noexcept
+        {
+        }
+    };
+
+    /**
+     * @brief Circle stencil with a compile-time radius.
+     */
+    template<int Radius>
+    class FixedStencil
     {
-        std::vector<int> indices;
-        std::size_t index = 0;
 
-        for(int row = 0; row < rows; ++row)
+    public:
+        int getRadius() const noexcept
         {
-            for(int col = 0; col < cols; ++col)
+            return Radius;
+        }
+
+        std::size_t computeCovarianceMatrix(const Point* center, int cols,
+                                            std::array<float, 9>& covarianceMatrix) const noexcept
+        {
+            std::size_t pointCount = 0;
+            std::array<float, 9> accum = { 0 };
+            FixedStencilRows<Radius, -Radius>::accumulate(center, cols, accum, pointCount);
+            pcps::computeCovarianceMatrix(accum, pointCount, covarianceMatrix);
+            return pointCount;
+        }
+    };
+
+    /**
+     * @brief Circle stencil with a runtime radius, whose row extents are computed once.
+     */
+    class RuntimeStencil
+    {
+
+    public:
+        explicit RuntimeStencil(int radius) :
+            _radius(radius)
+        {
+            for(int y = -radius; y <= radius; ++y)
             {
-                computeCircleIndices(col, row, neighborLevels, cols, rows, indices);
+                _halfWidths.push_back(getCircleHalfWidth(radius, y));
+            }
+        }
+
+        int getRadius() const noexcept
+        {
+            return _radius;
+        }
+
+        std::size_t computeCovarianceMatrix(const Point* center, int cols,
+                                            std::array<float, 9>& covarianceMatrix) const noexcept
+        {
+            std::size_t pointCount = 0;
+            std::array<float, 9> accum = { 0 };
+            const Point* rowPoints = center - (_radius * cols);
+
+            for(int halfWidth : _halfWidths)
+            {
+                for(int x = -halfWidth; x <= halfWidth; ++x)
+                {
+                    accumulatePoint(rowPoints[x], accum, pointCount);
+                }
+
+                rowPoints += cols;
+            }
+
+            pcps::computeCovarianceMatrix(accum, pointCount, covarianceMatrix);
+            return pointCount;
+        }
+
+    private:
+        std::vector<int> _halfWidths;
+        int _radius;
+    };
+
+    /**
+     * @brief Estimates the normals of interior points with the given stencil, without bounds checks,
+     * and the normals of the border band with clamped circle indices.
+     */
+    template<class Stencil>
+    void computeStencilNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols, int rows,
+                               const Stencil& stencil, ThreadPool& threadPool, Point* normals,
+                               NormalStatistics* normalStatistics)
+    {
+        int radius = stencil.getRadius();
+        int chunks = getRowChunks(cols, rows, threadPool);
+
+        parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstRow, std::size_t lastRow)
+        {
+            std::vector<int> indices;
 
-                const Point& point = points[index];
+            auto computeBorderNormal = [&](int col, int row)
+            {
+                computeCircleIndices(col, row, radius, cols, rows, indices);
+
+                std::size_t index = std::size_t((row * cols) + col);
                 Point& normal = normals[index];
                 normal = computePointNormal(points, indices);
-                flipNormalTowardsViewpoint(point, flipViewPoint, normal);
-                ++index;
+                flipNormalTowardsViewpoint(points[index], flipViewPoint, normal);
+            };
+
+            for(auto row = int(firstRow); row < int(lastRow); ++row)
+            {
+                int firstInteriorCol = std::min(radius, cols);
+                int lastInteriorCol = std::max(cols - radius, firstInteriorCol);
+
+                if(row < radius || row >= rows - radius)
+                {
+                    firstInteriorCol = cols;
+                    lastInteriorCol = cols;
+                }
+
+                for(int col = 0; col < firstInteriorCol; ++col)
+                {
+                    computeBorderNormal(col, row);
+                }
+
+                for(int col = firstInteriorCol; col < lastInteriorCol; ++col)
+                {
+                    std::size_t index = std::size_t((row * cols) + col);
+                    const Point& point = points[index];
+                    std::array<float, 9> covarianceMatrix;
+                    std::size_t pointCount = stencil.computeCovarianceMatrix(&point, cols, covarianceMatrix);
+
+                    Point& normal = normals[index];
+                    normal = computePointNormal(covarianceMatrix, pointCount);
+                    flipNormalTowardsViewpoint(point, flipViewPoint, normal);
+                }
+
+                for(int col = lastInteriorCol; col < cols; ++col)
+                {
+                    computeBorderNormal(col, row);
+                }
+
+                if(normalStatistics)
+                {
+                    normalStatistics->accumulateRow(normals, row);
+                }
             }
+        });
+    }
+
+    template<int Radius>
+    void computeFixedStencilNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols,
+                                    int rows, int neighborLevels, ThreadPool& threadPool, Point* normals,
+                                    NormalStatistics* normalStatistics)
+    {
+        if(neighborLevels == Radius)
+        {
+            computeStencilNormals(points, flipViewPoint, cols, rows, FixedStencil<Radius>(), threadPool, normals,
+                                  normalStatistics);
+        }
+        else
+        {
+            computeFixedStencilNormals<Radius + 1>(points, flipViewPoint, cols, rows, neighborLevels, threadPool,
+                                                   normals, normalStatistics);
         }
     }
+
+    template<>
+    void computeFixedStencilNormals<PCPS_CPU_NORMAL_EXTRACTOR_MAX_FIXED_STENCIL_RADIUS + 1>(
+            const std::vector<Point>& points, const Point& flipViewPoint, int cols, int rows, int neighborLevels,
+            ThreadPool& threadPool, Point* normals, NormalStatistics* normalStatistics)
+    {
+        computeStencilNormals(points, flipViewPoint, cols, rows, RuntimeStencil(neighborLevels), threadPool,
+                              normals, normalStatistics);
+    }
+
+    void computeNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols, int rows,
+                        int neighborLevels, ThreadPool& threadPool, Point* normals,
+                        NormalStatistics* normalStatistics)
+    {
+        computeFixedStencilNormals<1>(points, flipViewPoint, cols, rows, neighborLevels, threadPool, normals,
+                                      normalStatistics);
+    }
+
+    /**
+     * @brief Structure-of-arrays copy of the input points, padded with invalid points,
+     * so the neighbors of a batch of consecutive points can be loaded in lockstep without bounds checks.
+     *
+     * Invalid points are stored as zeros with a zero valid flag, so adding them does not change any sum.
+     */
+    class BatchStaging
+    {
+
+    public:
+        static constexpr int lanes = 8;
+
+        // Sums of xx, xy, xz, yy, yz, zz, x, y, z and finite points count:
+        static constexpr int channels = 10;
+
+        // Channel sums of each batch point (channel * lanes + lane):
+        using Sums = std::array<float, channels * lanes>;
+
+        void build(const std::vector<Point>& points, int cols, int rows, int radius, ThreadPool& threadPool)
+        {
+            _padding = radius;
+            _cols = cols + (radius * 2) + lanes;
+
+            int paddedRows = rows + (radius * 2);
+            auto size = std::size_t(_cols * paddedRows);
+            _x.assign(size, 0);
+            _y.assign(size, 0);
+            _z.assign(size, 0);
+            _valid.assign(size, 0);
+
+            int chunks = getRowChunks(cols, rows, threadPool);
+
+            parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstRow, std::size_t lastRow)
+            {
+                for(auto row = int(firstRow); row < int(lastRow); ++row)
+                {
+                    const Point* rowPoints = points.data() + (row * cols);
+                    std::size_t index = getIndex(0, row);
+
+                    for(int col = 0; col < cols; ++col)
+                    {
+                        const Point& point = rowPoints[col];
+
+                        if(point.isFinite())
+                        {
+                            _x[index] = point.x;
+                            _y[index] = point.y;
+                            _z[index] = point.z;
+                            _valid[index] = 1;
+                        }
+
+                        ++index;
+                    }
+                }
+            });
+
+            // Same neighbors and order as computeCircleIndices:
+
+            int r2 = radius * radius;
+            _offsets.clear();
+
+            for(int y = -radius; y <= radius; ++y)
+            {
+                for(int x = -radius; x <= radius; ++x)
+                {
+                    if((x * x) + (y * y) <= r2)
+                    {
+                        _offsets.push_back((y * _cols) + x);
+                    }
+                }
+            }
+        }
+
+        std::size_t getIndex(int col, int row) const noexcept
+        {
+            return std::size_t(((row + _padding) * _cols) + col + _padding);
+        }
+
+        const float* getX() const noexcept
+        {
+            return _x.data();
+        }
+
+        const float* getY() const noexcept
+        {
+            return _y.data();
+        }
+
+        const float* getZ() const noexcept
+        {
+            return _z.data();
+        }
+
+        const float* getValid() const noexcept
+        {
+            return _valid.data();
+        }
+
+        const std::vector<int>& getOffsets() const noexcept
+        {
+            return _offsets;
+        }
+
+    private:
+        std::vector<float> _x;
+        std::vector<float> _y;
+        std::vector<float> _z;
+        std::vector<float> _valid;
+        std::vector<int> _offsets;
+        int _padding = 0;
+        int _cols = 0;
+    };
+
+    using AccumulateBatchFunction = void(*)(const BatchStaging& staging, std::size_t index,
+                                            BatchStaging::Sums& sums);
+
+    #ifdef PCPS_CPU_SIMD_X86
+        PCPS_CPU_SIMD_SSE4_2 void accumulateBatchSse42(const BatchStaging& staging, std::size_t index,
+                                                       BatchStaging::Sums& sums)
+        {
+            const std::vector<int>& offsets = staging.getOffsets();
+            float* output = sums.data();
+
+            for(int half = 0; half < BatchStaging::lanes; half += 4)
+            {
+                const float* xs = staging.getX() + index + half;
+                const float* ys = staging.getY() + index + half;
+                const float* zs = staging.getZ() + index + half;
+                const float* valids = staging.getValid() + index + half;
+                __m128 xx = _mm_setzero_ps();
+                __m128 xy = _mm_setzero_ps();
+                __m128 xz = _mm_setzero_ps();
+                __m128 yy = _mm_setzero_ps();
+                __m128 yz = _mm_setzero_ps();
+                __m128 zz = _mm_setzero_ps();
+                __m128 sx = _mm_setzero_ps();
+                __m128 sy = _mm_setzero_ps();
+                __m128 sz = _mm_setzero_ps();
+                __m128 count = _mm_setzero_ps();
+
+                for(int offset : offsets)
+                {
+                    __m128 x = _mm_loadu_ps(xs + offset);
+                    __m128 y = _mm_loadu_ps(ys + offset);
+                    __m128 z = _mm_loadu_ps(zs + offset);
+                    xx = _mm_add_ps(xx, _mm_mul_ps(x, x));
+                    xy = _mm_add_ps(xy, _mm_mul_ps(x, y));
+                    xz = _mm_add_ps(xz, _mm_mul_ps(x, z));
+                    yy = _mm_add_ps(yy, _mm_mul_ps(y, y));
+                    yz = _mm_add_ps(yz, _mm_mul_ps(y, z));
+                    zz = _mm_add_ps(zz, _mm_mul_ps(z, z));
+                    sx = _mm_add_ps(sx, x);
+                    sy = _mm_add_ps(sy, y);
+                    sz = _mm_add_ps(sz, z);
+                    count = _mm_add_ps(count, _mm_loadu_ps(valids + offset));
+                }
+
+                _mm_storeu_ps(output + (0 * BatchStaging::lanes) + half, xx);
+                _mm_storeu_ps(output + (1 * BatchStaging::lanes) + half, xy);
+                _mm_storeu_ps(output + (2 * BatchStaging::lanes) + half, xz);
+                _mm_storeu_ps(output + (3 * BatchStaging::lanes) + half, yy);
+                _mm_storeu_ps(output + (4 * BatchStaging::lanes) + half, yz);
+                _mm_storeu_ps(output + (5 * BatchStaging::lanes) + half, zz);
+                _mm_storeu_ps(output + (6 * BatchStaging::lanes) + half, sx);
+                _mm_storeu_ps(output + (7 * BatchStaging::lanes) + half, sy);
+                _mm_storeu_ps(output + (8 * BatchStaging::lanes) + half, sz);
+                _mm_storeu_ps(output + (9 * BatchStaging::lanes) + half, count);
+            }
+        }
+
+        PCPS_CPU_SIMD_AVX2 void accumulateBatchAvx2(const BatchStaging& staging, std::size_t index,
+                                                    BatchStaging::Sums& sums)
+        {
+            const std::vector<int>& offsets = staging.getOffsets();
+            const float* xs = staging.getX() + index;
+            const float* ys = staging.getY() + index;
+            const float* zs = staging.getZ() + index;
+            const float* valids = staging.getValid() + index;
+            float* output = sums.data();
+            __m256 xx = _mm256_setzero_ps();
+            __m256 xy = _mm256_setzero_ps();
+            __m256 xz = _mm256_setzero_ps();
+            __m256 yy = _mm256_setzero_ps();
+            __m256 yz = _mm256_setzero_ps();
+            __m256 zz = _mm256_setzero_ps();
+            __m256 sx = _mm256_setzero_ps();
+            __m256 sy = _mm256_setzero_ps();
+            __m256 sz = _mm256_setzero_ps();
+            __m256 count = _mm256_setzero_ps();
+
+            for(int offset : offsets)
+            {
+                __m256 x = _mm256_loadu_ps(xs + offset);
+                __m256 y = _mm256_loadu_ps(ys + offset);
+                __m256 z = _mm256_loadu_ps(zs + offset);
+                xx = _mm256_add_ps(xx, _mm256_mul_ps(x, x));
+                xy = _mm256_add_ps(xy, _mm256_mul_ps(x, y));
+                xz = _mm256_add_ps(xz, _mm256_mul_ps(x, z));
+                yy = _mm256_add_ps(yy, _mm256_mul_ps(y, y));
+                yz = _mm256_add_ps(yz, _mm256_mul_ps(y, z));
+                zz = _mm256_add_ps(zz, _mm256_mul_ps(z, z));
+                sx = _mm256_add_ps(sx, x);
+                sy = _mm256_add_ps(sy, y);
+                sz = _mm256_add_ps(sz, z);
+                count = _mm256_add_ps(count, _mm256_loadu_ps(valids + offset));
+            }
+
+            _mm256_storeu_ps(output + (0 * BatchStaging::lanes), xx);
+            _mm256_storeu_ps(output + (1 * BatchStaging::lanes), xy);
+            _mm256_storeu_ps(output + (2 * BatchStaging::lanes), xz);
+            _mm256_storeu_ps(output + (3 * BatchStaging::lanes), yy);
+            _mm256_storeu_ps(output + (4 * BatchStaging::lanes), yz);
+            _mm256_storeu_ps(output + (5 * BatchStaging::lanes), zz);
+            _mm256_storeu_ps(output + (6 * BatchStaging::lanes), sx);
+            _mm256_storeu_ps(output + (7 * BatchStaging::lanes), sy);
+            _mm256_storeu_ps(output + (8 * BatchStaging::lanes), sz);
+            _mm256_storeu_ps(output + (9 * BatchStaging::lanes), count);
+        }
+    #endif
+
+    void computeBatchNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols, int rows,
+                             int neighborLevels, AccumulateBatchFunction accumulateBatch, ThreadPool& threadPool,
+                             Point* normals, NormalStatistics* normalStatistics)
+    {
+        BatchStaging staging;
+        staging.build(points, cols, rows, neighborLevels, threadPool);
+
+        int chunks = getRowChunks(cols, rows, threadPool);
+
+        parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstRow, std::size_t lastRow)
+        {
+            BatchStaging::Sums sums;
+
+            for(auto row = int(firstRow); row < int(lastRow); ++row)
+            {
+                for(int firstCol = 0; firstCol < cols; firstCol += BatchStaging::lanes)
+                {
+                    accumulateBatch(staging, staging.getIndex(firstCol, row), sums);
+
+                    int lanes = std::min(int(BatchStaging::lanes), cols - firstCol);
+                    std::size_t index = std::size_t((row * cols) + firstCol);
+
+                    for(int lane = 0; lane < lanes; ++lane)
+                    {
+                        std::array<float, 9> accum;
+
+                        for(std::size_t channel = 0; channel < 9; ++channel)
+                        {
+                            accum[channel] = sums[(channel * BatchStaging::lanes) + std::size_t(lane)];
+                        }
+
+                        auto pointCount = std::size_t(sums[(9 * BatchStaging::lanes) + std::size_t(lane)]);
+                        std::array<float, 9> covarianceMatrix;
+                        computeCovarianceMatrix(accum, pointCount, covarianceMatrix);
+
+                        const Point& point = points[index];
+                        Point& normal = normals[index];
+                        normal = computePointNormal(covarianceMatrix, pointCount);
+                        flipNormalTowardsViewpoint(point, flipViewPoint, normal);
+                        ++index;
+                    }
+                }
+
+                if(normalStatistics)
+                {
+                    normalStatistics->accumulateRow(normals, row);
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief Summed-area tables of the finite point coordinates and their products.
+     *
+     * Coordinates are stored relative to a reference point and accumulated in double precision
+     * to limit the cancellation error of the covariance matrix.
+     */
+    class IntegralImage
+    {
+
+    public:
+        static constexpr std::size_t channels = 10;
+
+        using Sums = std::array<double, channels>;
+
+        void build(const std::vector<Point>& points, int cols, int rows, ThreadPool& threadPool)
+        {
+            _cols = cols + 1;
+            _sums.assign(std::size_t(_cols * (rows + 1)), Sums{ { 0 } });
+            _reference = Point{ 0, 0, 0, 0 };
+
+            for(const Point& point : points)
+            {
+                if(point.isFinite())
+                {
+                    _reference = point;
+                    break;
+                }
+            }
+
+            // Accumulate each row horizontally:
+
+            int chunks = getRowChunks(cols, rows, threadPool);
+
+            parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstRow, std::size_t lastRow)
+            {
+                for(auto row = int(firstRow); row < int(lastRow); ++row)
+                {
+                    Sums rowSums = { { 0 } };
+                    const Point* rowPoints = points.data() + (row * cols);
+                    Sums* outputSums = _sums.data() + ((row + 1) * _cols) + 1;
+
+                    for(int col = 0; col < cols; ++col)
+                    {
+                        const Point& point = rowPoints[col];
+
+                        if(point.isFinite())
+                        {
+                            double x = double(point.x) - double(_reference.x);
+                            double y = double(point.y) - double(_reference.y);
+                            double z = double(point.z) - double(_reference.z);
+                            rowSums[0] += 1;
+                            rowSums[1] += x;
+                            rowSums[2] += y;
+                            rowSums[3] += z;
+                            rowSums[4] += x * x;
+                            rowSums[5] += x * y;
+                            rowSums[6] += x * z;
+                            rowSums[7] += y * y;
+                            rowSums[8] += y * z;
+                            rowSums[9] += z * z;
+                        }
+
+                        outputSums[col] = rowSums;
+                    }
+                }
+            });
+
+            // Accumulate each column vertically:
+
+            chunks = getRowChunks(rows, cols, threadPool);
+
+            parallelChunks(threadPool, std::size_t(cols), chunks, [&](int, std::size_t firstCol, std::size_t lastCol)
+            {
+                for(int row = 1; row < rows; ++row)
+                {
+                    const Sums* upSums = _sums.data() + (row * _cols) + 1;
+                    Sums* outputSums = _sums.data() + ((row + 1) * _cols) + 1;
+
+                    for(auto col = int(firstCol); col < int(lastCol); ++col)
+                    {
+                        const Sums& up = upSums[col];
+                        Sums& output = outputSums[col];
+
+                        for(std::size_t channel = 0; channel < channels; ++channel)
+                        {
+                            output[channel] += up[channel];
+                        }
+                    }
+                }
+            });
+        }
+
+        /**
+         * @brief Retrieves the covariance matrix of the finite points inside the given rectangle.
+         * @return The finite points count.
+         */
+        std::size_t computeCovarianceMatrix(int firstCol, int firstRow, int lastCol, int lastRow,
+                                            std::array<float, 9>& covarianceMatrix) const noexcept
+        {
+            const Sums& a = _sums[std::size_t((firstRow * _cols) + firstCol)];
+            const Sums& b = _sums[std::size_t((firstRow * _cols) + lastCol + 1)];
+            const Sums& c = _sums[std::size_t(((lastRow + 1) * _cols) + firstCol)];
+            const Sums& d = _sums[std::size_t(((lastRow + 1) * _cols) + lastCol + 1)];
+            Sums accum;
+
+            for(std::size_t channel = 0; channel < channels; ++channel)
+            {
+                accum[channel] = d[channel] - b[channel] - c[channel] + a[channel];
+            }
+
+            auto pointCount = std::size_t(accum[0] + 0.5);
+
+            if(pointCount > 0)
+            {
+                double pointCountInv = 1 / accum[0];
+
+                for(double& accumValue : accum)
+                {
+                    accumValue *= pointCountInv;
+                }
+
+                covarianceMatrix[0] = float(accum[4] - accum[1] * accum[1]);
+                covarianceMatrix[1] = float(accum[5] - accum[1] * accum[2]);
+                covarianceMatrix[2] = float(accum[6] - accum[1] * accum[3]);
+                covarianceMatrix[4] = float(accum[7] - accum[2] * accum[2]);
+                covarianceMatrix[5] = float(accum[8] - accum[2] * accum[3]);
+                covarianceMatrix[8] = float(accum[9] - accum[3] * accum[3]);
+                covarianceMatrix[3] = covarianceMatrix[1];
+                covarianceMatrix[6] = covarianceMatrix[2];
+                covarianceMatrix[7] = covarianceMatrix[5];
+            }
+
+            return pointCount;
+        }
+
+    private:
+        std::vector<Sums> _sums;
+        Point _reference;
+        int _cols = 0;
+    };
+
+    void computeIntegralImageNormals(const std::vector<Point>& points, const Point& flipViewPoint, int cols,
+                                     int rows, int neighborLevels, ThreadPool& threadPool, Point* normals,
+                                     NormalStatistics* normalStatistics)
+    {
+        IntegralImage integralImage;
+        integralImage.build(points, cols, rows, threadPool);
+
+        // Use a square with the same area as the search circumference:
+
+        int halfSize = std::max(int(std::round(neighborLevels * std::sqrt(3.14159265f) / 2)), 1);
+        int chunks = getRowChunks(cols, rows, threadPool);
+
+        parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstOutputRow,
+                       std::size_t lastOutputRow)
+        {
+            std::size_t index = firstOutputRow * std::size_t(cols);
+
+            for(auto row = int(firstOutputRow); row < int(lastOutputRow); ++row)
+            {
+                int firstRow = std::max(row - halfSize, 0);
+                int lastRow = std::min(row + halfSize, rows - 1);
+
+                for(int col = 0; col < cols; ++col)
+                {
+                    int firstCol = std::max(col - halfSize, 0);
+                    int lastCol = std::min(col + halfSize, cols - 1);
+                    std::array<float, 9> covarianceMatrix;
+                    std::size_t pointCount = integralImage.computeCovarianceMatrix(firstCol, firstRow, lastCol,
+                                                                                   lastRow, covarianceMatrix);
+
+                    const Point& point = points[index];
+                    Point& normal = normals[index];
+                    normal = computePointNormal(covarianceMatrix, pointCount);
+                    flipNormalTowardsViewpoint(point, flipViewPoint, normal);
+                    ++index;
+                }
+
+                if(normalStatistics)
+                {
+                    normalStatistics->accumulateRow(normals, row);
+                }
+            }
+        });
+    }
 }
 
 bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int neighborLevels,
-                               void* outputNormalDeviceData, Context&) const
+                               void* outputNormalDeviceData, NormalStatistics* normalStatistics,
+                               bool& statisticsBuilt, Context& context) const
 {
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
     const Point& sensorOrigin = inputPointCloud.sensorOrigin;
@@ -366,7 +1065,60 @@ bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int nei
     int cols = inputPointCloud.width;
     int rows = inputPointCloud.height;
     auto outputNormals = static_cast<Point*>(outputNormalDeviceData);
-    computeNormals(inputPointCloud.points, flipViewPoint, cols, rows, neighborLevels, outputNormals);
+    std::shared_ptr<ThreadPool> sharedThreadPool = context.getThreadPool();
+    ThreadPool& threadPool = *sharedThreadPool;
+
+    // Normal statistics rows are accumulated as soon as their normals are computed, while they are still cached:
+
+    if(normalStatistics)
+    {
+        normalStatistics->reset(cols, rows);
+    }
+
+    if(_useIntegralImages)
+    {
+        computeIntegralImageNormals(inputPointCloud.points, flipViewPoint, cols, rows, neighborLevels, threadPool,
+                                    outputNormals, normalStatistics);
+    }
+    else
+    {
+        AccumulateBatchFunction accumulateBatch = nullptr;
+
+        #ifdef PCPS_CPU_SIMD_X86
+            if(_cpuInstructions == CpuInstructions::AVX2)
+            {
+                accumulateBatch = accumulateBatchAvx2;
+            }
+            else if(_cpuInstructions == CpuInstructions::SSE4_2)
+            {
+                accumulateBatch = accumulateBatchSse42;
+            }
+        #endif
+
+        if(accumulateBatch)
+        {
+            computeBatchNormals(inputPointCloud.points, flipViewPoint, cols, rows, neighborLevels, accumulateBatch,
+                                threadPool, outputNormals, normalStatistics);
+        }
+        else
+        {
+            computeNormals(inputPointCloud.points, flipViewPoint, cols, rows, neighborLevels, threadPool,
+                           outputNormals, normalStatistics);
+        }
+    }
+
+    if(normalStatistics)
+    {
+        normalStatistics->finish(threadPool);
+    }
+
+    statisticsBuilt = normalStatistics != nullptr;
+    return true;
+}
+
+bool NormalExtractor::_getCellDistance(const DeviceCloud& deviceCloud, float& cellDistance, Context&)
+{
+    cellDistance = _getCellDistance(deviceCloud.getHostCloud());
     return true;
 }
 
@@ -18,8 +18,12 @@ namespace pcps
 static_assert(sizeof(Point) == sizeof(float4), "");
 
 bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int neighborLevels,
-                               void* outputNormalDeviceData, Context& context) const
+                               void* outputNormalDeviceData, NormalStatistics*, bool& statisticsBuilt,
+                               Context& context) const
 {
+    // Normal statistics are built by the splitter from the host normal cloud:
+    statisticsBuilt = false;
+
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
     const Point& sensorOrigin = inputPointCloud.sensorOrigin;
     Point flipViewPoint = _flipNormals ? _flipViewPoint : sensorOrigin;
@@ -31,4 +35,10 @@ bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int nei
     return true;
 }
 
+bool NormalExtractor::_getCellDistance(const DeviceCloud& deviceCloud, float& cellDistance, Context&)
+{
+    cellDistance = _getCellDistance(deviceCloud.getHostCloud());
+    return true;
+}
+
 }
@@ -6,15 +6,19 @@
 
 #include "pcps_normal_extractor.h"
 
+#include <cmath>
+#include <limits>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_context.h"
 #include "pcps_epsilon.h"
+#include "pcps_tweak_me.h"
 #include "pcps_device_cloud.h"
-#include "pcps_boost_compute.h"
+#include "pcps_program_cache.h"
+#include "pcps_device_buffer_pool.h"
 
 namespace bpc = boost::compute;
-using DeviceView = bpc::mapped_view<bpc::float4_>;
+using DeviceView = pcps::DeviceBuffer<bpc::float4_>;
 
 namespace pcps
 {
@@ -23,68 +27,38 @@ namespace
 {
     static_assert(sizeof(Point) == sizeof(bpc::float4_), "");
 
-    bool computeNormals(const DeviceView& devicePoints, const Point& flipViewPoint, int cols, int rows,
-                        int neighborLevels, DeviceView& deviceNormals, Context& context)
-    {
-        std::array<int, 3> intArgs = { neighborLevels, cols, rows };
-        bpc::mapped_view<int> deviceIntArgs(intArgs.data(), intArgs.size(), *context.context);
-        std::array<float, 4> floatArgs = { flipViewPoint.x, flipViewPoint.y, flipViewPoint.z, epsilon };
-        bpc::mapped_view<float> deviceFloatArgs(floatArgs.data(), floatArgs.size(), *context.context);
-
-        BOOST_COMPUTE_CLOSURE(bpc::float4_, normalTransform, (int index), (devicePoints, deviceIntArgs, deviceFloatArgs),
+    // Neighbor levels and flip mode are defined at build time (PCPS_NEIGHBOR_LEVELS and PCPS_FLIP_NORMALS),
+    // so the stencil loops have constant bounds and the unused view point is discarded.
+    // Cloud size (PCPS_COLS and PCPS_ROWS) is defined with the numeric values only if the context specializes
+    // cloud geometry, since each cloud size builds a new program; otherwise it is defined as the kernel arguments.
+    //
+    // computeNormals reads each neighborhood from global memory.
+    // computeNormalsTiled stages a tile of PCPS_TILE_SIZE x PCPS_TILE_SIZE points plus a halo of PCPS_NEIGHBOR_LEVELS
+    // points in local memory, so each point is read from global memory once per work-group:
+    const char* computeNormalsSource = BOOST_COMPUTE_STRINGIZE_SOURCE(
+        void accumulatePoint(float4 point, float* accum, int* pointCount)
         {
-            int neighborLevels = deviceIntArgs[0];
-            int cols = deviceIntArgs[1];
-            int rows = deviceIntArgs[2];
-
-            float4 flipViewPoint = (float4)(deviceFloatArgs[0], deviceFloatArgs[1], deviceFloatArgs[2], 0);
-            float epsilon = deviceFloatArgs[3];
+            float pX = point.x;
+            float pY = point.y;
+            float pZ = point.z;
 
-            // computeCovarianceMatrix:
-
-            int pointCount = 0;
-            float accum[9] = { 0 };
-            int x0 = index % cols;
-            int y0 = index / cols;
-            int r2 = neighborLevels * neighborLevels;
-            int xMin = max(-neighborLevels, -x0);
-            int xMax = min(neighborLevels, cols - x0 - 1);
-            int yMin = max(-neighborLevels, -y0);
-            int yMax = min(neighborLevels, rows - y0 - 1);
-
-            for(int y = yMin; y <= yMax; ++y)
+            if(! isnan(pX) && ! isnan(pY) && ! isnan(pZ))
             {
-                int pointIndex = ((y0 + y) * cols) + (x0 + xMin);
-                int y2 = y * y;
-
-                for(int x = xMin; x <= xMax; ++x)
-                {
-                    if((x * x) + y2 <= r2)
-                    {
-                        float4 point = devicePoints[pointIndex];
-                        float pX = point.x;
-                        float pY = point.y;
-                        float pZ = point.z;
-
-                        if(! isnan(pX) && ! isnan(pY) && ! isnan(pZ))
-                        {
-                            accum[0] += pX * pX;
-                            accum[1] += pX * pY;
-                            accum[2] += pX * pZ;
-                            accum[3] += pY * pY;
-                            accum[4] += pY * pZ;
-                            accum[5] += pZ * pZ;
-                            accum[6] += pX;
-                            accum[7] += pY;
-                            accum[8] += pZ;
-                            ++pointCount;
-                        }
-                    }
-
-                    ++pointIndex;
-                }
+                accum[0] += pX * pX;
+                accum[1] += pX * pY;
+                accum[2] += pX * pZ;
+                accum[3] += pY * pY;
+                accum[4] += pY * pZ;
+                accum[5] += pZ * pZ;
+                accum[6] += pX;
+                accum[7] += pY;
+                accum[8] += pZ;
+                ++(*pointCount);
             }
+        }
 
+        float4 solveNormal(float* accum, int pointCount, float4 point, float4 flipViewPoint, float epsilon)
+        {
             if(! pointCount)
             {
                 return (float4)(0, 0, 0, 0);
@@ -275,7 +249,6 @@ namespace
 
                 // Flip the estimated normal of a point towards the given viewpoint:
 
-                float4 point = devicePoints[index];
                 float4 viewPoint = flipViewPoint;
                 viewPoint.x -= point.x;
                 viewPoint.y -= point.y;
@@ -296,14 +269,201 @@ namespace
             }
 
             return normal;
+        }
+
+        __kernel void computeNormals(__global const float4* points, int cols, int rows, float4 flipViewPoint,
+                                     float4 sensorOrigin, float epsilon, __global float4* normals)
+        {
+            int index = get_global_id(0);
+
+            if(index >= PCPS_COLS * PCPS_ROWS)
+            {
+                return;
+            }
+
+            // computeCovarianceMatrix:
+
+            int pointCount = 0;
+            float accum[9] = { 0 };
+            int y0 = index / PCPS_COLS;
+            int x0 = index - (y0 * PCPS_COLS);
+
+            for(int y = -PCPS_NEIGHBOR_LEVELS; y <= PCPS_NEIGHBOR_LEVELS; ++y)
+            {
+                int row = y0 + y;
+
+                if(row >= 0 && row < PCPS_ROWS)
+                {
+                    for(int x = -PCPS_NEIGHBOR_LEVELS; x <= PCPS_NEIGHBOR_LEVELS; ++x)
+                    {
+                        int col = x0 + x;
+
+                        if(col >= 0 && col < PCPS_COLS &&
+                                (x * x) + (y * y) <= PCPS_NEIGHBOR_LEVELS * PCPS_NEIGHBOR_LEVELS)
+                        {
+                            accumulatePoint(points[(row * PCPS_COLS) + col], accum, &pointCount);
+                        }
+                    }
+                }
+            }
+
+            float4 viewPoint = PCPS_FLIP_NORMALS ? flipViewPoint : sensorOrigin;
+            normals[index] = solveNormal(accum, pointCount, points[index], viewPoint, epsilon);
+        }
+
+        __kernel void computeNormalsTiled(__global const float4* points, int cols, int rows, float4 flipViewPoint,
+                                          float4 sensorOrigin, float epsilon, __global float4* normals,
+                                          __local float4* tile)
+        {
+            int haloSize = PCPS_TILE_SIZE + (2 * PCPS_NEIGHBOR_LEVELS);
+            int localX = get_local_id(0);
+            int localY = get_local_id(1);
+            int tileX = (get_group_id(0) * PCPS_TILE_SIZE) - PCPS_NEIGHBOR_LEVELS;
+            int tileY = (get_group_id(1) * PCPS_TILE_SIZE) - PCPS_NEIGHBOR_LEVELS;
+
+            // Points outside the cloud are stored as NaN, so they are discarded as invalid ones:
+
+            for(int tileIndex = (localY * PCPS_TILE_SIZE) + localX; tileIndex < haloSize * haloSize;
+                tileIndex += PCPS_TILE_SIZE * PCPS_TILE_SIZE)
+            {
+                int haloRow = tileIndex / haloSize;
+                int haloCol = tileIndex - (haloRow * haloSize);
+                int row = tileY + haloRow;
+                int col = tileX + haloCol;
+
+                if(row >= 0 && row < PCPS_ROWS && col >= 0 && col < PCPS_COLS)
+                {
+                    tile[tileIndex] = points[(row * PCPS_COLS) + col];
+                }
+                else
+                {
+                    tile[tileIndex] = (float4)(NAN, NAN, NAN, 0);
+                }
+            }
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            int x0 = get_global_id(0);
+            int y0 = get_global_id(1);
+
+            if(x0 >= PCPS_COLS || y0 >= PCPS_ROWS)
+            {
+                return;
+            }
+
+            // computeCovarianceMatrix:
+
+            int pointCount = 0;
+            float accum[9] = { 0 };
+
+            for(int y = -PCPS_NEIGHBOR_LEVELS; y <= PCPS_NEIGHBOR_LEVELS; ++y)
+            {
+                int tileRowIndex = (localY + PCPS_NEIGHBOR_LEVELS + y) * haloSize;
+
+                for(int x = -PCPS_NEIGHBOR_LEVELS; x <= PCPS_NEIGHBOR_LEVELS; ++x)
+                {
+                    if((x * x) + (y * y) <= PCPS_NEIGHBOR_LEVELS * PCPS_NEIGHBOR_LEVELS)
+                    {
+                        accumulatePoint(tile[tileRowIndex + localX + PCPS_NEIGHBOR_LEVELS + x], accum, &pointCount);
+                    }
+                }
+            }
+
+            int index = (y0 * PCPS_COLS) + x0;
+            float4 point = tile[((localY + PCPS_NEIGHBOR_LEVELS) * haloSize) + localX + PCPS_NEIGHBOR_LEVELS];
+            float4 viewPoint = PCPS_FLIP_NORMALS ? flipViewPoint : sensorOrigin;
+            normals[index] = solveNormal(accum, pointCount, point, viewPoint, epsilon);
+        }
+    );
+
+    bool computeTiledNormals(const bpc::program& program, const DeviceView& devicePoints,
+                             const bpc::float4_& flipViewPoint, const bpc::float4_& sensorOrigin, int cols, int rows,
+                             int neighborLevels, DeviceView& deviceNormals, Context& context)
+    {
+        // The tile must fit in a work-group, and the tile plus its halo must fit in local memory:
+
+        bpc::kernel kernel = program.create_kernel("computeNormalsTiled");
+        bpc::device device = context.queue->get_device();
+        std::size_t tileSize = PCPS_OPENCL_NORMAL_EXTRACTOR_TILE_SIZE;
+        std::size_t haloSize = tileSize + std::size_t(2 * neighborLevels);
+        std::size_t tileBytes = haloSize * haloSize * sizeof(bpc::float4_);
+        auto maxWorkGroupSize = kernel.get_work_group_info<std::size_t>(device, CL_KERNEL_WORK_GROUP_SIZE);
+        auto usedLocalMemory = kernel.get_work_group_info<cl_ulong>(device, CL_KERNEL_LOCAL_MEM_SIZE);
+        cl_ulong localMemory = device.local_memory_size();
+
+        if(tileSize * tileSize > maxWorkGroupSize || usedLocalMemory + tileBytes > localMemory)
+        {
+            return false;
+        }
+
+        std::size_t globalWorkSize[] = { ((std::size_t(cols) + tileSize - 1) / tileSize) * tileSize,
+                                         ((std::size_t(rows) + tileSize - 1) / tileSize) * tileSize };
+        std::size_t localWorkSize[] = { tileSize, tileSize };
+        kernel.set_args(devicePoints.get_buffer(), cols, rows, flipViewPoint, sensorOrigin, epsilon,
+                        deviceNormals.get_buffer(), bpc::local_buffer<bpc::float4_>(haloSize * haloSize));
+        context.queue->enqueue_nd_range_kernel(kernel, 2, nullptr, globalWorkSize, localWorkSize);
+        return true;
+    }
+
+    bool computeNormals(const DeviceView& devicePoints, bool flipNormals, const Point& flipViewPoint,
+                        const Point& sensorOrigin, int cols, int rows, int neighborLevels, bool useLocalMemory,
+                        DeviceView& deviceNormals, Context& context)
+    {
+        ProgramCache& programCache = context.getProgramCache();
+        bpc::program program;
+
+        try
+        {
+            std::string options = ProgramCache::getDefine("PCPS_NEIGHBOR_LEVELS", neighborLevels) + ' ' +
+                    ProgramCache::getDefine("PCPS_TILE_SIZE", PCPS_OPENCL_NORMAL_EXTRACTOR_TILE_SIZE) + ' ' +
+                    ProgramCache::getDefine("PCPS_FLIP_NORMALS", flipNormals) + ' ' +
+                    programCache.getGeometryDefine("PCPS_COLS", "cols", cols) + ' ' +
+                    programCache.getGeometryDefine("PCPS_ROWS", "rows", rows);
+            program = programCache.getOrBuild(computeNormalsSource, options);
+        }
+        catch(const bpc::program_build_failure& programBuildFailure)
+        {
+            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
+            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+            return false;
+        }
+
+        bpc::float4_ deviceFlipViewPoint(flipViewPoint.x, flipViewPoint.y, flipViewPoint.z, 0);
+        bpc::float4_ deviceSensorOrigin(sensorOrigin.x, sensorOrigin.y, sensorOrigin.z, 0);
+
+        if(useLocalMemory && computeTiledNormals(program, devicePoints, deviceFlipViewPoint, deviceSensorOrigin,
+                                                 cols, rows, neighborLevels, deviceNormals, context))
+        {
+            return true;
+        }
+
+        bpc::kernel kernel = program.create_kernel("computeNormals");
+        kernel.set_args(devicePoints.get_buffer(), cols, rows, deviceFlipViewPoint, deviceSensorOrigin, epsilon,
+                        deviceNormals.get_buffer());
+        context.queue->enqueue_1d_range_kernel(kernel, 0, std::size_t(rows * cols), 0);
+        return true;
+    }
+
+    template<class Transform>
+    bool getFirstIndex(const Transform& transform, int count, int& firstIndex, Context& context)
+    {
+        BOOST_COMPUTE_FUNCTION(int, firstIndexReduce, (int a, int b),
+        {
+            return a < b ? a : b;
         });
 
         bpc::counting_iterator<int> first(0);
-        bpc::counting_iterator<int> last = first + (rows * cols);
+        bpc::counting_iterator<int> last = first + count;
+        firstIndex = std::numeric_limits<int>::max();
+
+        if(count <= 0)
+        {
+            return true;
+        }
 
         try
         {
-            bpc::transform(first, last, deviceNormals.begin(), normalTransform, *context.queue);
+            bpc::transform_reduce(first, last, &firstIndex, transform, firstIndexReduce, *context.queue);
         }
         catch(const bpc::program_build_failure& programBuildFailure)
         {
@@ -314,20 +474,44 @@ namespace
 
         return true;
     }
+
+    void readPoints(const DeviceView& devicePoints, int index, int count, Point* points, Context& context)
+    {
+        context.queue->enqueue_read_buffer(devicePoints.get_buffer(), std::size_t(index) * sizeof(Point),
+                                           std::size_t(count) * sizeof(Point), points);
+    }
+
+    float getDistance(const Point& a, const Point& b) noexcept
+    {
+        float distanceX = a.x - b.x;
+        float distanceY = a.y - b.y;
+        return std::sqrt((distanceX * distanceX) + (distanceY * distanceY));
+    }
+
+    float getDistance(const DeviceView& devicePoints, int aIndex, int bIndex, Context& context)
+    {
+        std::array<Point, 2> points;
+        readPoints(devicePoints, aIndex, 1, &points[0], context);
+        readPoints(devicePoints, bIndex, 1, &points[1], context);
+        return getDistance(points[0], points[1]);
+    }
 }
 
 bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int neighborLevels,
-                               void* outputNormalDeviceData, Context& context) const
+                               void* outputNormalDeviceData, NormalStatistics*, bool& statisticsBuilt,
+                               Context& context) const
 {
+    // Normal statistics are built by the splitter from the host normal cloud:
+    statisticsBuilt = false;
+
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
     auto inputDevicePoints = static_cast<const DeviceView*>(inputPointDeviceCloud.getDeviceData());
     auto outputDeviceNormals = static_cast<DeviceView*>(outputNormalDeviceData);
-    const Point& sensorOrigin = inputPointCloud.sensorOrigin;
-    Point flipViewPoint = _flipNormals ? _flipViewPoint : sensorOrigin;
     int cols = inputPointCloud.width;
     int rows = inputPointCloud.height;
 
-    if(! computeNormals(*inputDevicePoints, flipViewPoint, cols, rows, neighborLevels, *outputDeviceNormals, context))
+    if(! computeNormals(*inputDevicePoints, _flipNormals, _flipViewPoint, inputPointCloud.sensorOrigin, cols, rows,
+                        neighborLevels, _useLocalMemory, *outputDeviceNormals, context))
     {
         PCPS_LOG_ERROR << "Normals computation failed" << std::endl;
         return false;
@@ -336,4 +520,145 @@ bool NormalExtractor::_extract(const DeviceCloud& inputPointDeviceCloud, int nei
     return true;
 }
 
+bool NormalExtractor::_getCellDistance(const DeviceCloud& deviceCloud, float& cellDistance, Context& context)
+{
+    // Same search as the host version, but only the points of the found pair are read back from the device:
+
+    const Cloud& cloud = deviceCloud.getHostCloud();
+    const DeviceView& devicePoints = *static_cast<const DeviceView*>(deviceCloud.getDeviceData());
+    int cols = cloud.width;
+    int rows = cloud.height;
+    DeviceBufferScope deviceBuffers(context.getDeviceBufferPool(), *context.queue);
+    std::array<int, 2> intArgs = { cols, rows };
+    DeviceBuffer<int> deviceIntArgs = deviceBuffers.upload(intArgs.data(), intArgs.size());
+    int firstIndex;
+    cellDistance = 0;
+
+    BOOST_COMPUTE_CLOSURE(int, upDownTransform, (int index), (devicePoints, deviceIntArgs),
+    {
+        int cols = deviceIntArgs[0];
+        int rows = deviceIntArgs[1];
+        int upRowIndex = index / cols;
+        int colIndex = index - (upRowIndex * cols);
+        int downRowIndex = rows - upRowIndex - 1;
+        float4 upPoint = devicePoints[(upRowIndex * cols) + colIndex];
+        float4 downPoint = devicePoints[(downRowIndex * cols) + colIndex];
+
+        if(isfinite(upPoint.x) && isfinite(upPoint.y) && isfinite(upPoint.z) &&
+                isfinite(downPoint.x) && isfinite(downPoint.y) && isfinite(downPoint.z))
+        {
+            return index;
+        }
+
+        return INT_MAX;
+    });
+
+    if(! getFirstIndex(upDownTransform, (rows / 2) * cols, firstIndex, context))
+    {
+        return false;
+    }
+
+    if(firstIndex != std::numeric_limits<int>::max())
+    {
+        int upRowIndex = firstIndex / cols;
+        int colIndex = firstIndex % cols;
+        int downRowIndex = rows - upRowIndex - 1;
+        float distance = getDistance(devicePoints, (upRowIndex * cols) + colIndex,
+                                           (downRowIndex * cols) + colIndex, context);
+        cellDistance = distance / (downRowIndex - upRowIndex);
+        return true;
+    }
+
+    BOOST_COMPUTE_CLOSURE(int, leftRightTransform, (int index), (devicePoints, deviceIntArgs),
+    {
+        int cols = deviceIntArgs[0];
+        int halfCols = cols / 2;
+        int rowIndex = index / halfCols;
+        int leftColIndex = index - (rowIndex * halfCols);
+        int rightColIndex = cols - leftColIndex - 1;
+        float4 leftPoint = devicePoints[(rowIndex * cols) + leftColIndex];
+        float4 rightPoint = devicePoints[(rowIndex * cols) + rightColIndex];
+
+        if(isfinite(leftPoint.x) && isfinite(leftPoint.y) && isfinite(leftPoint.z) &&
+                isfinite(rightPoint.x) && isfinite(rightPoint.y) && isfinite(rightPoint.z))
+        {
+            return index;
+        }
+
+        return INT_MAX;
+    });
+
+    if(! getFirstIndex(leftRightTransform, rows * (cols / 2), firstIndex, context))
+    {
+        return false;
+    }
+
+    if(firstIndex != std::numeric_limits<int>::max())
+    {
+        int halfCols = cols / 2;
+        int rowIndex = firstIndex / halfCols;
+        int leftColIndex = firstIndex % halfCols;
+        int rightColIndex = cols - leftColIndex - 1;
+        float distance = getDistance(devicePoints, (rowIndex * cols) + leftColIndex,
+                                           (rowIndex * cols) + rightColIndex, context);
+        cellDistance = distance / (rightColIndex - leftColIndex);
+        return true;
+    }
+
+    BOOST_COMPUTE_CLOSURE(int, neighborTransform, (int index), (devicePoints, deviceIntArgs),
+    {
+        int cols = deviceIntArgs[0];
+        int rows = deviceIntArgs[1];
+        int rowIndex = index / (cols - 1);
+        int colIndex = index - (rowIndex * (cols - 1));
+        int pointIndex = (rowIndex * cols) + colIndex;
+        float4 point = devicePoints[pointIndex];
+
+        if(isfinite(point.x) && isfinite(point.y) && isfinite(point.z))
+        {
+            float4 rightPoint = devicePoints[pointIndex + 1];
+
+            if(isfinite(rightPoint.x) && isfinite(rightPoint.y) && isfinite(rightPoint.z))
+            {
+                return index;
+            }
+
+            if(rowIndex + 1 < rows)
+            {
+                float4 downPoint = devicePoints[pointIndex + cols];
+
+                if(isfinite(downPoint.x) && isfinite(downPoint.y) && isfinite(downPoint.z))
+                {
+                    return index;
+                }
+            }
+        }
+
+        return INT_MAX;
+    });
+
+    if(! getFirstIndex(neighborTransform, rows * (cols - 1), firstIndex, context))
+    {
+        return false;
+    }
+
+    if(firstIndex != std::numeric_limits<int>::max())
+    {
+        int rowIndex = firstIndex / (cols - 1);
+        int colIndex = firstIndex % (cols - 1);
+        int pointIndex = (rowIndex * cols) + colIndex;
+        std::array<Point, 2> points;
+        readPoints(devicePoints, pointIndex, 2, points.data(), context);
+
+        if(! points[1].isFinite())
+        {
+            readPoints(devicePoints, pointIndex + cols, 1, &points[1], context);
+        }
+
+        cellDistance = getDistance(points[0], points[1]);
+    }
+
+    return true;
+}
+
 }
@@ -7,9 +7,15 @@
 #include "pcps_normal_merger.h"
 
 #include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
 #include "pcps_plane.h"
 #include "pcps_logger.h"
+#include "pcps_context.h"
 #include "pcps_epsilon.h"
+#include "pcps_tweak_me.h"
+#include "pcps_cpu_parallel.h"
 
 namespace pcps
 {
@@ -43,9 +49,66 @@ bool NormalMerger::setStdDsvThresholds(float minimumStdDsvThreshold, float maxim
     return true;
 }
 
+NormalMerger::MergeOrder NormalMerger::getMergeOrder() const noexcept
+{
+    return _mergeOrder;
+}
+
+bool NormalMerger::setMergeOrder(MergeOrder mergeOrder) noexcept
+{
+    if(int(mergeOrder) < int(MergeOrder::GREEDY) || int(mergeOrder) > int(MergeOrder::PARALLEL))
+    {
+        PCPS_LOG_ERROR << "Invalid mergeOrder: " << int(mergeOrder) << std::endl;
+        return false;
+    }
+
+    _mergeOrder = mergeOrder;
+    return true;
+}
+
+bool NormalMerger::getDisjointRegions() const noexcept
+{
+    return _disjointRegions;
+}
+
+void NormalMerger::setDisjointRegions(bool disjointRegions) noexcept
+{
+    _disjointRegions = disjointRegions;
+}
+
+const std::vector<std::int64_t>& NormalMergerWorkspace::getLastRoundsElapsedMcs() const noexcept
+{
+    return _roundsElapsedMcs;
+}
+
 void NormalMerger::merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes)
+{
+    ThreadPool threadPool(1);
+    _merge(normalRegions, planes, _workspace, threadPool);
+}
+
+void NormalMerger::merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes,
+                         Context& context)
+{
+    _merge(normalRegions, planes, _workspace, *context.getThreadPool());
+}
+
+void NormalMerger::merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes,
+                         NormalMergerWorkspace& workspace, Context& context) const
+{
+    _merge(normalRegions, planes, workspace, *context.getThreadPool());
+}
+
+const std::vector<std::int64_t>& NormalMerger::getLastRoundsElapsedMcs() const noexcept
+{
+    return _workspace.getLastRoundsElapsedMcs();
+}
+
+void NormalMerger::_merge(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes,
+                          NormalMergerWorkspace& workspace, ThreadPool& threadPool) const
 {
     std::size_t numNormalRegions = normalRegions.size();
+    workspace._roundsElapsedMcs.clear();
 
     if(numNormalRegions == 0)
     {
@@ -56,150 +119,1009 @@ void NormalMerger::merge(const std::vector<NormalRegion>& normalRegions, std::ve
     if(numNormalRegions == 1)
     {
         planes.resize(1);
-        planes[0].regions.resize(1, normalRegions[0]);
+        planes[0].regions.assign(1, normalRegions[0]);
         return;
     }
 
-    _setupGroups(normalRegions);
+    workspace._minimumStdDsvThreshold = _minimumStdDsvThreshold;
+    workspace._maximumStdDsvThreshold = _maximumStdDsvThreshold;
+    workspace._disjointRegions = _disjointRegions;
+    workspace._setupGroups(normalRegions);
 
-    for(std::size_t index = 0, limit = _groups.size(); index < limit; ++index)
+    if(_mergeOrder == MergeOrder::PRIORITY_QUEUE)
     {
-        std::size_t bestNeighborIndex;
+        workspace._priorityQueueMerge();
+    }
+    else if(_mergeOrder == MergeOrder::PARALLEL)
+    {
+        workspace._parallelMerge(threadPool);
+    }
+    else
+    {
+        workspace._greedyMerge();
+    }
 
-        while(_getBestNeighborGroupIndex(index, bestNeighborIndex))
+    workspace._buildPlanes(normalRegions, planes);
+}
+
+namespace
+{
+    constexpr std::size_t invalidIndex = std::numeric_limits<std::size_t>::max();
+
+    template<class Type, class Key>
+    void countingSort(const std::vector<Type>& input, std::vector<Type>& output, std::vector<std::size_t>& counts,
+                      int maxKey, const Key& key)
+    {
+        counts.assign(std::size_t(maxKey) + 2, 0);
+
+        for(const Type& value : input)
         {
-            _mergeGroups(index, bestNeighborIndex);
+            ++counts[std::size_t(key(value)) + 1];
+        }
+
+        for(std::size_t index = 1, limit = counts.size(); index < limit; ++index)
+        {
+            counts[index] += counts[index - 1];
+        }
+
+        output.resize(input.size());
+
+        for(const Type& value : input)
+        {
+            output[counts[std::size_t(key(value))]++] = value;
+        }
+    }
+}
+
+void NormalMergerWorkspace::_setupGroups(const std::vector<NormalRegion>& normalRegions)
+{
+    std::size_t numNormalRegions = normalRegions.size();
+    _groups.resize(numNormalRegions);
+
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    {
+        const NormalRegion& normalRegion = normalRegions[index];
+        Group& group = _groups[index];
+        group.normal = normalRegion.normal;
+        group.area = normalRegion.width * normalRegion.height;
+        group.version = 0;
+        group.absorberIndex = index;
+    }
+
+    _neighborPairs.clear();
+
+    if(_disjointRegions)
+    {
+        _findDisjointNeighborPairs(normalRegions);
+    }
+    else
+    {
+        _findRunNeighborPairs(normalRegions);
+    }
+
+    // Build the regions adjacency graph in compressed sparse row format.
+    // First count the neighbors of each region and store them in place:
+
+    std::vector<std::size_t>& offsets = _neighborOffsets;
+    std::vector<std::size_t>& neighbors = _neighborIndexes;
+    offsets.assign(numNormalRegions + 1, 0);
+
+    for(const NeighborPair& neighborPair : _neighborPairs)
+    {
+        ++offsets[neighborPair.aIndex + 1];
+        ++offsets[neighborPair.bIndex + 1];
+    }
+
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    {
+        offsets[index + 1] += offsets[index];
+    }
+
+    neighbors.resize(offsets[numNormalRegions]);
+
+    for(const NeighborPair& neighborPair : _neighborPairs)
+    {
+        neighbors[offsets[neighborPair.aIndex]++] = neighborPair.bIndex;
+        neighbors[offsets[neighborPair.bIndex]++] = neighborPair.aIndex;
+    }
+
+    // Now offsets[i] is the end of the row i, so shift them to get the beginning of each row back:
+
+    for(std::size_t index = numNormalRegions; index > 0; --index)
+    {
+        offsets[index] = offsets[index - 1];
+    }
+
+    offsets[0] = 0;
+
+    // Remove repeated neighbors:
+
+    std::size_t rowBegin = 0;
+    std::size_t outputIndex = 0;
+
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    {
+        auto first = neighbors.begin() + long(rowBegin);
+        auto last = neighbors.begin() + long(offsets[index + 1]);
+        std::sort(first, last);
+        last = std::unique(first, last);
+        rowBegin = offsets[index + 1];
+        offsets[index] = outputIndex;
+        outputIndex = std::size_t(std::copy(first, last, neighbors.begin() + long(outputIndex)) - neighbors.begin());
+    }
+
+    offsets[numNormalRegions] = outputIndex;
+    neighbors.resize(outputIndex);
+
+    // The neighbors of each group are a linked list of graph entries, so merged groups just join their lists:
+
+    _nextNeighbors.resize(outputIndex);
+    _neighborMarks.assign(numNormalRegions, 0);
+    _neighborMark = 0;
+
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    {
+        Group& group = _groups[index];
+        std::size_t begin = offsets[index];
+        std::size_t end = offsets[index + 1];
+
+        if(begin == end)
+        {
+            group.firstNeighbor = invalidIndex;
+            group.lastNeighbor = invalidIndex;
+        }
+        else
+        {
+            for(std::size_t entry = begin; entry < end - 1; ++entry)
+            {
+                _nextNeighbors[entry] = entry + 1;
+            }
+
+            _nextNeighbors[end - 1] = invalidIndex;
+            group.firstNeighbor = begin;
+            group.lastNeighbor = end - 1;
         }
     }
+}
+
+void NormalMergerWorkspace::_findDisjointNeighborPairs(const std::vector<NormalRegion>& normalRegions)
+{
+    // Two disjoint regions touch if the far side of one of them and the near side of the other one
+    // are on the same line and they overlap (coordinates are expected to be positive, as NormalSplitter ones):
+
+    for(int axis = 0; axis < 2; ++axis)
+    {
+        int maxBegin = 0;
+        int maxPosition = 0;
+        _regionSides.clear();
+
+        for(std::size_t index = 0, limit = normalRegions.size(); index < limit; ++index)
+        {
+            const NormalRegion& normalRegion = normalRegions[index];
+            int near = axis ? normalRegion.y : normalRegion.x;
+            int far = near + (axis ? normalRegion.height : normalRegion.width);
+            int begin = axis ? normalRegion.x : normalRegion.y;
+            int end = begin + (axis ? normalRegion.width : normalRegion.height);
+
+            if(begin < end && near < far)
+            {
+                maxBegin = std::max(maxBegin, begin);
+                maxPosition = std::max(maxPosition, far);
+                _regionSides.push_back(RegionSide{ far, 0, begin, end, index });
+                _regionSides.push_back(RegionSide{ near, 1, begin, end, index });
+            }
+        }
+
+        // Sort sides by line, with far sides first, and then by their beginning.
+        // Coordinates are bounded, so it is done with two stable counting sorts instead of comparisons:
+
+        countingSort(_regionSides, _sortedRegionSides, _sideCounts, maxBegin,
+                     [](const RegionSide& regionSide) { return regionSide.begin; });
+        countingSort(_sortedRegionSides, _regionSides, _sideCounts, (maxPosition * 2) + 1,
+                     [](const RegionSide& regionSide) { return (regionSide.position * 2) + regionSide.nearSide; });
+
+        // Far and near sides of each line are sorted by their beginning, so they are matched in a single pass:
+
+        auto it = _regionSides.begin();
+        auto end = _regionSides.end();
+
+        while(it != end)
+        {
+            int position = it->position;
+            auto farIt = it;
+
+            while(it != end && it->position == position && ! it->nearSide)
+            {
+                ++it;
+            }
+
+            auto farEnd = it;
+            auto nearIt = it;
+
+            while(it != end && it->position == position)
+            {
+                ++it;
+            }
+
+            auto nearEnd = it;
 
-    _buildPlanes(normalRegions, planes);
+            while(farIt != farEnd && nearIt != nearEnd)
+            {
+                if(std::max(farIt->begin, nearIt->begin) < std::min(farIt->end, nearIt->end))
+                {
+                    _neighborPairs.push_back(NeighborPair{ farIt->regionIndex, nearIt->regionIndex });
+                }
+
+                if(farIt->end < nearIt->end)
+                {
+                    ++farIt;
+                }
+                else
+                {
+                    ++nearIt;
+                }
+            }
+        }
+    }
 }
 
-void NormalMerger::_setupGroups(const std::vector<NormalRegion>& normalRegions)
+void NormalMergerWorkspace::_findRunNeighborPairs(const std::vector<NormalRegion>& normalRegions)
 {
-    int width = 0;
+    // Sort region indexes by row, keeping the region order in each row:
+
     int height = 0;
 
     for(const NormalRegion& normalRegion : normalRegions)
     {
-        width = std::max(width, normalRegion.x + normalRegion.width);
         height = std::max(height, normalRegion.y + normalRegion.height);
     }
 
-    ++width;
-    ++height;
-    _pointCloudIds.clear();
-    _pointCloudIds.resize(std::size_t(width * height), 0);
+    std::vector<std::size_t>& rowOffsets = _rowOffsets;
+    rowOffsets.assign(std::size_t(height) + 1, 0);
 
-    int* pointCloudIdsData = _pointCloudIds.data();
-    std::size_t numNormalRegions = normalRegions.size();
-    _groups.resize(numNormalRegions);
+    for(const NormalRegion& normalRegion : normalRegions)
+    {
+        if(normalRegion.width > 0)
+        {
+            for(int y = std::max(normalRegion.y, 0), yl = normalRegion.y + normalRegion.height; y < yl; ++y)
+            {
+                ++rowOffsets[std::size_t(y) + 1];
+            }
+        }
+    }
 
-    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    for(std::size_t y = 0; y < std::size_t(height); ++y)
+    {
+        rowOffsets[y + 1] += rowOffsets[y];
+    }
+
+    _rowRegionIndexes.resize(rowOffsets[std::size_t(height)]);
+
+    for(std::size_t index = 0, limit = normalRegions.size(); index < limit; ++index)
     {
         const NormalRegion& normalRegion = normalRegions[index];
-        Group& group = _groups[index];
-        group.regionIndexes.clear();
-        group.regionIndexes.push_back(index);
-        group.neighborGroupIndexes.clear();
-        group.normal = normalRegion.normal;
-        group.area = normalRegion.width * normalRegion.height;
 
-        int id = int(index) + 1;
-        int xi = normalRegion.x;
-        int xl = normalRegion.x + normalRegion.width;
-        int yi = normalRegion.y;
-        int yl = normalRegion.y + normalRegion.height;
+        if(normalRegion.width > 0)
+        {
+            for(int y = std::max(normalRegion.y, 0), yl = normalRegion.y + normalRegion.height; y < yl; ++y)
+            {
+                _rowRegionIndexes[rowOffsets[std::size_t(y)]++] = index;
+            }
+        }
+    }
+
+    for(std::size_t y = std::size_t(height); y > 0; --y)
+    {
+        rowOffsets[y] = rowOffsets[y - 1];
+    }
+
+    rowOffsets[0] = 0;
+
+    // Paint each row as a list of runs, with later regions overwriting the previous ones,
+    // and find the touching runs of the same row and of the previous one:
+
+    _runs.clear();
+
+    for(std::size_t y = 0; y < std::size_t(height); ++y)
+    {
+        std::swap(_runs, _previousRuns);
+        _runs.clear();
+
+        for(std::size_t entry = rowOffsets[y], end = rowOffsets[y + 1]; entry < end; ++entry)
+        {
+            std::size_t regionIndex = _rowRegionIndexes[entry];
+            const NormalRegion& normalRegion = normalRegions[regionIndex];
+            _paintRun(Run{ std::max(normalRegion.x, 0), normalRegion.x + normalRegion.width, regionIndex });
+        }
+
+        for(std::size_t index = 1, limit = _runs.size(); index < limit; ++index)
+        {
+            const Run& leftRun = _runs[index - 1];
+            const Run& rightRun = _runs[index];
+
+            if(leftRun.end == rightRun.begin && leftRun.regionIndex != rightRun.regionIndex)
+            {
+                _neighborPairs.push_back(NeighborPair{ leftRun.regionIndex, rightRun.regionIndex });
+            }
+        }
+
+        auto upIt = _previousRuns.begin();
+        auto upEnd = _previousRuns.end();
+        auto it = _runs.begin();
+        auto end = _runs.end();
 
-        for(int y = yi; y < yl; ++y)
+        while(upIt != upEnd && it != end)
         {
-            int* pointCloudIdsRow = pointCloudIdsData + (y * width);
+            if(std::max(upIt->begin, it->begin) < std::min(upIt->end, it->end) &&
+                    upIt->regionIndex != it->regionIndex)
+            {
+                _neighborPairs.push_back(NeighborPair{ upIt->regionIndex, it->regionIndex });
+            }
 
-            for(int x = xi; x < xl; ++x)
+            if(upIt->end < it->end)
+            {
+                ++upIt;
+            }
+            else
             {
-                pointCloudIdsRow[x] = id;
+                ++it;
             }
         }
     }
+}
 
-    Group* groupsData = _groups.data();
+void NormalMergerWorkspace::_paintRun(const Run& run)
+{
+    if(run.begin >= run.end)
+    {
+        return;
+    }
 
-    for(int y = 0; y < height - 1; ++y)
+    // Runs are sorted and disjoint, so the ones overlapped by the new run are contiguous:
+
+    std::vector<Run>& runs = _runs;
+    auto first = std::lower_bound(runs.begin(), runs.end(), run.begin, [](const Run& other, int begin)
+    {
+        return other.end <= begin;
+    });
+
+    auto last = first;
+
+    while(last != runs.end() && last->begin < run.end)
     {
-        const int* pointCloudIdsRow = pointCloudIdsData + (y * width);
-        const int* downPointCloudIdsRow = pointCloudIdsData + ((y + 1) * width);
+        ++last;
+    }
+
+    Run leftRun;
+    Run rightRun;
+    bool hasLeftRun = first != last && first->begin < run.begin;
+    bool hasRightRun = first != last && (last - 1)->end > run.end;
 
-        for(int x = 0; x < width - 1; ++x)
+    if(hasLeftRun)
+    {
+        leftRun = Run{ first->begin, run.begin, first->regionIndex };
+    }
+
+    if(hasRightRun)
+    {
+        rightRun = Run{ run.end, (last - 1)->end, (last - 1)->regionIndex };
+    }
+
+    auto it = runs.erase(first, last);
+
+    if(hasLeftRun)
+    {
+        it = runs.insert(it, leftRun) + 1;
+    }
+
+    it = runs.insert(it, run) + 1;
+
+    if(hasRightRun)
+    {
+        runs.insert(it, rightRun);
+    }
+}
+
+void NormalMergerWorkspace::_greedyMerge()
+{
+    for(std::size_t index = 0, limit = _groups.size(); index < limit; ++index)
+    {
+        std::size_t bestNeighborIndex;
+
+        while(_getBestNeighborGroupIndex(index, bestNeighborIndex))
+        {
+            _mergeGroups(index, bestNeighborIndex);
+        }
+    }
+}
+
+namespace
+{
+    // Heap order: the edge with the highest cosine (the lowest angle) is on top, ties are broken by group indexes:
+    template<class Edge>
+    bool edgeLess(const Edge& a, const Edge& b) noexcept
+    {
+        if(a.cosine < b.cosine)
+        {
+            return true;
+        }
+
+        if(b.cosine < a.cosine)
         {
-            if(int a = pointCloudIdsRow[x])
+            return false;
+        }
+
+        if(a.aIndex != b.aIndex)
+        {
+            return a.aIndex > b.aIndex;
+        }
+
+        return a.bIndex > b.bIndex;
+    }
+}
+
+void NormalMergerWorkspace::_priorityQueueMerge()
+{
+    // Neighbor groups are merged if the angle between their normals is lower than the maximum threshold,
+    // which is the same as their dot product being higher than its cosine.
+    // Neighbor groups which can't be merged are kept as dormant edges of both of them:
+
+    std::size_t numGroups = _groups.size();
+    float minimumCosine = std::cos(_maximumStdDsvThreshold);
+    auto less = [](const Edge& a, const Edge& b) { return edgeLess(a, b); };
+    _edges.clear();
+    _dormantEdges.clear();
+    _firstDormantEdges.assign(numGroups, invalidIndex);
+    _lastDormantEdges.assign(numGroups, invalidIndex);
+
+    for(std::size_t index = 0; index < numGroups; ++index)
+    {
+        for(std::size_t entry = _neighborOffsets[index], end = _neighborOffsets[index + 1]; entry < end; ++entry)
+        {
+            std::size_t neighborIndex = _neighborIndexes[entry];
+
+            if(index < neighborIndex && ! _pushEdge(index, neighborIndex, minimumCosine))
             {
-                if(int b = pointCloudIdsRow[x + 1])
+                _addDormantEdge(index, neighborIndex);
+            }
+        }
+    }
+
+    std::make_heap(_edges.begin(), _edges.end(), less);
+
+    // Edges are not updated when their groups change. When an edge reaches the top of the heap,
+    // its groups are replaced by the ones which absorbed them, and if any of them has changed since the edge
+    // was pushed, the edge is pushed again with the current cosine (or it becomes dormant).
+    // Merged groups can become mergeable with neighbors which were not before, so their dormant edges are checked:
+
+    while(! _edges.empty())
+    {
+        std::pop_heap(_edges.begin(), _edges.end(), less);
+
+        Edge edge = _edges.back();
+        _edges.pop_back();
+
+        std::size_t aIndex = _getAbsorberGroupIndex(edge.aIndex);
+        std::size_t bIndex = _getAbsorberGroupIndex(edge.bIndex);
+
+        if(aIndex == bIndex)
+        {
+            continue;
+        }
+
+        if(aIndex == edge.aIndex && bIndex == edge.bIndex && _groups[aIndex].version == edge.aVersion &&
+                _groups[bIndex].version == edge.bVersion)
+        {
+            _mergeGroups(aIndex, bIndex);
+            _joinDormantEdges(aIndex, bIndex);
+            _pushDormantEdges(aIndex, minimumCosine);
+        }
+        else if(_pushEdge(std::min(aIndex, bIndex), std::max(aIndex, bIndex), minimumCosine))
+        {
+            std::push_heap(_edges.begin(), _edges.end(), less);
+        }
+        else
+        {
+            _addDormantEdge(aIndex, bIndex);
+        }
+    }
+}
+
+void NormalMergerWorkspace::_parallelMerge(ThreadPool& threadPool)
+{
+    // Each round works on the graph of the groups which are still alive, with a row of neighbors for each group:
+
+    std::size_t numGroups = _groups.size();
+    _liveGroupIndexes.resize(numGroups);
+    _bestNeighborIndexes.resize(numGroups);
+    _rootIndexes.resize(numGroups);
+    _nextRootIndexes.resize(numGroups);
+    _hookFlags.resize(numGroups);
+    _nextHookFlags.resize(numGroups);
+    _rootSlots.resize(numGroups);
+    _rowBegins.resize(numGroups);
+    _rowEnds.resize(numGroups);
+    _roundNeighborIndexes = _neighborIndexes;
+
+    for(std::size_t index = 0; index < numGroups; ++index)
+    {
+        _liveGroupIndexes[index] = index;
+        _rowBegins[index] = _neighborOffsets[index];
+        _rowEnds[index] = _neighborOffsets[index + 1];
+    }
+
+    bool merged = true;
+
+    while(merged)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        merged = _parallelMergeRound(threadPool);
+
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        _roundsElapsedMcs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count());
+    }
+}
+
+bool NormalMergerWorkspace::_parallelMergeRound(ThreadPool& threadPool)
+{
+    // Each group picks the neighbor with the highest cosine, and ties are broken by the lowest neighbor index.
+    // Since all groups use the same order, picks form trees whose roots are pairs of groups which picked each other:
+
+    float minimumCosine = std::cos(_maximumStdDsvThreshold);
+    std::size_t numLiveGroups = _liveGroupIndexes.size();
+    int chunks = getParallelChunks(numLiveGroups, PCPS_CPU_MERGER_MIN_GROUPS_PER_THREAD, threadPool.getThreads());
+
+    parallelChunks(threadPool, numLiveGroups, chunks, [this, minimumCosine](int, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t liveIndex = begin; liveIndex < end; ++liveIndex)
+        {
+            std::size_t groupIndex = _liveGroupIndexes[liveIndex];
+            const Point& normal = _groups[groupIndex].normal;
+            std::size_t bestNeighborIndex = invalidIndex;
+            float bestCosine = minimumCosine;
+
+            for(std::size_t entry = _rowBegins[groupIndex], last = _rowEnds[groupIndex]; entry < last; ++entry)
+            {
+                std::size_t neighborIndex = _roundNeighborIndexes[entry];
+                const Point& neighborNormal = _groups[neighborIndex].normal;
+                float dotProduct = normal.x * neighborNormal.x + normal.y * neighborNormal.y +
+                        normal.z * neighborNormal.z;
+                bool better = dotProduct > bestCosine;
+
+                if(! better && bestNeighborIndex != invalidIndex && ! (dotProduct < bestCosine))
                 {
-                    if(a != b)
-                    {
-                        groupsData[a - 1].neighborGroupIndexes.insert(std::size_t(b - 1));
-                        groupsData[b - 1].neighborGroupIndexes.insert(std::size_t(a - 1));
-                    }
+                    better = neighborIndex < bestNeighborIndex;
+                }
+
+                if(better)
+                {
+                    bestNeighborIndex = neighborIndex;
+                    bestCosine = dotProduct;
                 }
+            }
+
+            _bestNeighborIndexes[groupIndex] = bestNeighborIndex;
+        }
+    });
+
+    // Find the root of each tree:
+
+    parallelChunks(threadPool, numLiveGroups, chunks, [this](int, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t liveIndex = begin; liveIndex < end; ++liveIndex)
+        {
+            std::size_t groupIndex = _liveGroupIndexes[liveIndex];
+            _rootIndexes[groupIndex] = _getParentGroupIndex(groupIndex);
+            _hookFlags[groupIndex] = 1;
+        }
+    });
+
+    _findRootGroups(threadPool, chunks);
+
+    // Chains of similar groups can drift away from their root, so groups are only hooked to their root
+    // if they and all groups between them and the root are similar to it:
+
+    parallelChunks(threadPool, numLiveGroups, chunks, [this, minimumCosine](int, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t liveIndex = begin; liveIndex < end; ++liveIndex)
+        {
+            std::size_t groupIndex = _liveGroupIndexes[liveIndex];
+            const Point& normal = _groups[groupIndex].normal;
+            const Point& rootNormal = _groups[_rootIndexes[groupIndex]].normal;
+            float dotProduct = normal.x * rootNormal.x + normal.y * rootNormal.y + normal.z * rootNormal.z;
+            _hookFlags[groupIndex] = _rootIndexes[groupIndex] == groupIndex || dotProduct > minimumCosine;
+        }
+    });
+
+    parallelChunks(threadPool, numLiveGroups, chunks, [this](int, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t liveIndex = begin; liveIndex < end; ++liveIndex)
+        {
+            std::size_t groupIndex = _liveGroupIndexes[liveIndex];
+            _rootIndexes[groupIndex] = _getParentGroupIndex(groupIndex);
+        }
+    });
+
+    _findRootGroups(threadPool, chunks);
+
+    // Unhooked groups become roots, and the groups of each tree are sorted by their root.
+    // The row of each root is reserved with room for the neighbors of all groups of its tree:
+
+    bool merged = false;
+    _nextLiveGroupIndexes.clear();
+
+    for(std::size_t groupIndex : _liveGroupIndexes)
+    {
+        std::size_t rootIndex = _hookFlags[groupIndex] ? _rootIndexes[groupIndex] : groupIndex;
+        _rootIndexes[groupIndex] = rootIndex;
 
-                if(int b = downPointCloudIdsRow[x])
+        if(rootIndex == groupIndex)
+        {
+            _rootSlots[groupIndex] = _nextLiveGroupIndexes.size();
+            _nextLiveGroupIndexes.push_back(groupIndex);
+        }
+        else
+        {
+            merged = true;
+        }
+    }
+
+    if(! merged)
+    {
+        return false;
+    }
+
+    std::size_t numNextLiveGroups = _nextLiveGroupIndexes.size();
+    _memberOffsets.assign(numNextLiveGroups + 1, 0);
+    _nextRowBegins.assign(numNextLiveGroups + 1, 0);
+
+    for(std::size_t groupIndex : _liveGroupIndexes)
+    {
+        std::size_t rootSlot = _rootSlots[_rootIndexes[groupIndex]];
+        ++_memberOffsets[rootSlot + 1];
+        _nextRowBegins[rootSlot + 1] += _rowEnds[groupIndex] - _rowBegins[groupIndex];
+    }
+
+    for(std::size_t rootSlot = 0; rootSlot < numNextLiveGroups; ++rootSlot)
+    {
+        _memberOffsets[rootSlot + 1] += _memberOffsets[rootSlot];
+        _nextRowBegins[rootSlot + 1] += _nextRowBegins[rootSlot];
+    }
+
+    _memberIndexes.resize(numLiveGroups);
+
+    for(std::size_t groupIndex : _liveGroupIndexes)
+    {
+        std::size_t& memberOffset = _memberOffsets[_rootSlots[_rootIndexes[groupIndex]]];
+        _memberIndexes[memberOffset] = groupIndex;
+        ++memberOffset;
+    }
+
+    // Trees are merged concurrently, since each group belongs to one tree only.
+    // Neighbors are replaced by their roots without duplicates, and the rows of the groups of a tree
+    // are only read by the thread which merges it, so their limits can be updated in place:
+
+    _nextRoundNeighborIndexes.resize(_nextRowBegins[numNextLiveGroups]);
+    chunks = getParallelChunks(numNextLiveGroups, PCPS_CPU_MERGER_MIN_GROUPS_PER_THREAD, threadPool.getThreads());
+
+    parallelChunks(threadPool, numNextLiveGroups, chunks, [this](int, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t rootSlot = begin; rootSlot < end; ++rootSlot)
+        {
+            std::size_t rootIndex = _nextLiveGroupIndexes[rootSlot];
+            std::size_t firstMember = rootSlot ? _memberOffsets[rootSlot - 1] : 0;
+            std::size_t lastMember = _memberOffsets[rootSlot];
+            std::size_t rowBegin = _nextRowBegins[rootSlot];
+            std::size_t rowEnd = rowBegin;
+
+            for(std::size_t member = firstMember; member < lastMember; ++member)
+            {
+                std::size_t groupIndex = _memberIndexes[member];
+
+                for(std::size_t entry = _rowBegins[groupIndex], last = _rowEnds[groupIndex]; entry < last; ++entry)
                 {
-                    if(a != b)
+                    std::size_t neighborRootIndex = _rootIndexes[_roundNeighborIndexes[entry]];
+
+                    if(neighborRootIndex != rootIndex)
                     {
-                        groupsData[a - 1].neighborGroupIndexes.insert(std::size_t(b - 1));
-                        groupsData[b - 1].neighborGroupIndexes.insert(std::size_t(a - 1));
+                        _nextRoundNeighborIndexes[rowEnd] = neighborRootIndex;
+                        ++rowEnd;
                     }
                 }
+
+                if(groupIndex != rootIndex)
+                {
+                    _mergeGroups(rootIndex, groupIndex);
+                }
             }
+
+            auto first = _nextRoundNeighborIndexes.begin() + std::ptrdiff_t(rowBegin);
+            auto last = _nextRoundNeighborIndexes.begin() + std::ptrdiff_t(rowEnd);
+            std::sort(first, last);
+            _rowBegins[rootIndex] = rowBegin;
+            _rowEnds[rootIndex] = rowBegin + std::size_t(std::unique(first, last) - first);
         }
+    });
+
+    _liveGroupIndexes.swap(_nextLiveGroupIndexes);
+    _roundNeighborIndexes.swap(_nextRoundNeighborIndexes);
+    return true;
+}
+
+std::size_t NormalMergerWorkspace::_getParentGroupIndex(std::size_t groupIndex) const noexcept
+{
+    // The group with the lowest index of each pair of groups which picked each other is the root of its tree:
+
+    std::size_t bestNeighborIndex = _bestNeighborIndexes[groupIndex];
+
+    if(bestNeighborIndex == invalidIndex ||
+            (groupIndex < bestNeighborIndex && _bestNeighborIndexes[bestNeighborIndex] == groupIndex))
+    {
+        return groupIndex;
     }
+
+    return bestNeighborIndex;
 }
 
-bool NormalMerger::_getBestNeighborGroupIndex(std::size_t groupIndex, std::size_t& bestNeighborGroupIndex) const noexcept
+void NormalMergerWorkspace::_findRootGroups(ThreadPool& threadPool, int chunks)
 {
-    const Group& group = _groups[groupIndex];
+    // Pointer jumping: each group replaces its parent with the parent of its parent until all of them reach a root.
+    // Hook flags are propagated from the root to the leaves on the way:
+
+    std::size_t numLiveGroups = _liveGroupIndexes.size();
+    std::vector<int> chunkJumps(std::size_t(chunks), 0);
+    bool jumped = true;
+
+    while(jumped)
+    {
+        parallelChunks(threadPool, numLiveGroups, chunks, [this, &chunkJumps](int chunk, std::size_t begin,
+                       std::size_t end)
+        {
+            int jumps = 0;
+
+            for(std::size_t liveIndex = begin; liveIndex < end; ++liveIndex)
+            {
+                std::size_t groupIndex = _liveGroupIndexes[liveIndex];
+                std::size_t parentIndex = _rootIndexes[groupIndex];
+                std::size_t grandParentIndex = _rootIndexes[parentIndex];
+                _nextRootIndexes[groupIndex] = grandParentIndex;
+                _nextHookFlags[groupIndex] = _hookFlags[groupIndex] & _hookFlags[parentIndex];
+                jumps += grandParentIndex != parentIndex;
+            }
+
+            chunkJumps[std::size_t(chunk)] = jumps;
+        });
+
+        _rootIndexes.swap(_nextRootIndexes);
+        _hookFlags.swap(_nextHookFlags);
+        jumped = std::any_of(chunkJumps.begin(), chunkJumps.end(), [](int jumps) { return jumps > 0; });
+    }
+}
+
+bool NormalMergerWorkspace::_pushEdge(std::size_t aIndex, std::size_t bIndex, float minimumCosine)
+{
+    const Group& aGroup = _groups[aIndex];
+    const Group& bGroup = _groups[bIndex];
+    const Point& aNormal = aGroup.normal;
+    const Point& bNormal = bGroup.normal;
+    float dotProduct = aNormal.x * bNormal.x + aNormal.y * bNormal.y + aNormal.z * bNormal.z;
+
+    if(dotProduct > minimumCosine)
+    {
+        _edges.push_back(Edge{ dotProduct, aIndex, bIndex, aGroup.version, bGroup.version });
+        return true;
+    }
+
+    return false;
+}
+
+void NormalMergerWorkspace::_addDormantEdge(std::size_t aIndex, std::size_t bIndex)
+{
+    for(int side = 0; side < 2; ++side)
+    {
+        std::size_t groupIndex = side ? bIndex : aIndex;
+        std::size_t entry = _dormantEdges.size();
+        _dormantEdges.push_back(DormantEdge{ side ? aIndex : bIndex, _firstDormantEdges[groupIndex] });
+
+        if(_firstDormantEdges[groupIndex] == invalidIndex)
+        {
+            _lastDormantEdges[groupIndex] = entry;
+        }
+
+        _firstDormantEdges[groupIndex] = entry;
+    }
+}
+
+void NormalMergerWorkspace::_joinDormantEdges(std::size_t aIndex, std::size_t bIndex) noexcept
+{
+    std::size_t bFirstEntry = _firstDormantEdges[bIndex];
+
+    if(bFirstEntry != invalidIndex)
+    {
+        if(_firstDormantEdges[aIndex] == invalidIndex)
+        {
+            _lastDormantEdges[aIndex] = _lastDormantEdges[bIndex];
+        }
+        else
+        {
+            _dormantEdges[_lastDormantEdges[bIndex]].next = _firstDormantEdges[aIndex];
+        }
+
+        _firstDormantEdges[aIndex] = bFirstEntry;
+        _firstDormantEdges[bIndex] = invalidIndex;
+        _lastDormantEdges[bIndex] = invalidIndex;
+    }
+}
+
+void NormalMergerWorkspace::_pushDormantEdges(std::size_t groupIndex, float minimumCosine)
+{
+    // Dormant edges are resolved to their current groups, and the ones which point to this group,
+    // to an already visited neighbor or to a neighbor which can be merged now are unlinked:
+
+    auto less = [](const Edge& a, const Edge& b) { return edgeLess(a, b); };
+    unsigned neighborMark = ++_neighborMark;
+
+    if(! neighborMark)
+    {
+        std::fill(_neighborMarks.begin(), _neighborMarks.end(), 0);
+        neighborMark = ++_neighborMark;
+    }
+
+    _neighborMarks[groupIndex] = neighborMark;
+
+    std::size_t previousEntry = invalidIndex;
+    std::size_t entry = _firstDormantEdges[groupIndex];
+
+    while(entry != invalidIndex)
+    {
+        DormantEdge& dormantEdge = _dormantEdges[entry];
+        std::size_t nextEntry = dormantEdge.next;
+        std::size_t neighborGroupIndex = _getAbsorberGroupIndex(dormantEdge.groupIndex);
+        bool unlink = _neighborMarks[neighborGroupIndex] == neighborMark;
+
+        if(! unlink)
+        {
+            _neighborMarks[neighborGroupIndex] = neighborMark;
+            dormantEdge.groupIndex = neighborGroupIndex;
+
+            if(_pushEdge(std::min(groupIndex, neighborGroupIndex), std::max(groupIndex, neighborGroupIndex),
+                         minimumCosine))
+            {
+                std::push_heap(_edges.begin(), _edges.end(), less);
+                unlink = true;
+            }
+        }
+
+        if(unlink)
+        {
+            if(previousEntry == invalidIndex)
+            {
+                _firstDormantEdges[groupIndex] = nextEntry;
+            }
+            else
+            {
+                _dormantEdges[previousEntry].next = nextEntry;
+            }
+
+            if(entry == _lastDormantEdges[groupIndex])
+            {
+                _lastDormantEdges[groupIndex] = previousEntry;
+            }
+        }
+        else
+        {
+            previousEntry = entry;
+        }
+
+        entry = nextEntry;
+    }
+}
+
+std::size_t NormalMergerWorkspace::_getAbsorberGroupIndex(std::size_t groupIndex) noexcept
+{
+    std::size_t absorberIndex = groupIndex;
+
+    while(_groups[absorberIndex].absorberIndex != absorberIndex)
+    {
+        absorberIndex = _groups[absorberIndex].absorberIndex;
+    }
+
+    // Path compression:
+
+    while(_groups[groupIndex].absorberIndex != absorberIndex)
+    {
+        std::size_t nextIndex = _groups[groupIndex].absorberIndex;
+        _groups[groupIndex].absorberIndex = absorberIndex;
+        groupIndex = nextIndex;
+    }
+
+    return absorberIndex;
+}
+
+bool NormalMergerWorkspace::_getBestNeighborGroupIndex(std::size_t groupIndex, std::size_t& bestNeighborGroupIndex) noexcept
+{
+    Group& group = _groups[groupIndex];
 
     if(! group.area)
     {
         return false;
     }
 
+    // Neighbor entries are resolved to their current groups,
+    // and the ones which point to this group or to an already visited neighbor are unlinked:
+
+    unsigned neighborMark = ++_neighborMark;
+
+    if(! neighborMark)
+    {
+        std::fill(_neighborMarks.begin(), _neighborMarks.end(), 0);
+        neighborMark = ++_neighborMark;
+    }
+
+    _neighborMarks[groupIndex] = neighborMark;
+
     const Point& normal = group.normal;
     float minimumStdDsvThreshold = _minimumStdDsvThreshold;
     float bestStdDsv = _maximumStdDsvThreshold;
     bool neighborFound = false;
+    std::size_t previousEntry = invalidIndex;
+    std::size_t entry = group.firstNeighbor;
 
-    for(std::size_t neighborGroupIndex : group.neighborGroupIndexes)
+    while(entry != invalidIndex)
     {
-        const Group& neighborGroup = _groups[neighborGroupIndex];
-        const Point& neighborNormal = neighborGroup.normal;
-        float dotProduct = normal.x * neighborNormal.x + normal.y * neighborNormal.y + normal.z * neighborNormal.z;
-        float stdDsv = std::acos(dotProduct);
+        std::size_t nextEntry = _nextNeighbors[entry];
+        std::size_t neighborGroupIndex = _getAbsorberGroupIndex(_neighborIndexes[entry]);
+
+        if(_neighborMarks[neighborGroupIndex] == neighborMark)
+        {
+            if(previousEntry == invalidIndex)
+            {
+                group.firstNeighbor = nextEntry;
+            }
+            else
+            {
+                _nextNeighbors[previousEntry] = nextEntry;
+            }
 
-        if(stdDsv < bestStdDsv)
+            if(entry == group.lastNeighbor)
+            {
+                group.lastNeighbor = previousEntry;
+            }
+        }
+        else
         {
-            bestNeighborGroupIndex = neighborGroupIndex;
-            bestStdDsv = stdDsv;
-            neighborFound = true;
+            _neighborMarks[neighborGroupIndex] = neighborMark;
+            _neighborIndexes[entry] = neighborGroupIndex;
+            previousEntry = entry;
 
-            if(stdDsv < minimumStdDsvThreshold)
+            const Point& neighborNormal = _groups[neighborGroupIndex].normal;
+            float dotProduct = normal.x * neighborNormal.x + normal.y * neighborNormal.y +
+                    normal.z * neighborNormal.z;
+            float stdDsv = std::acos(dotProduct);
+
+            if(stdDsv < bestStdDsv)
             {
-                break;
+                bestNeighborGroupIndex = neighborGroupIndex;
+                bestStdDsv = stdDsv;
+                neighborFound = true;
+
+                if(stdDsv < minimumStdDsvThreshold)
+                {
+                    break;
+                }
             }
         }
+
+        entry = nextEntry;
     }
 
     return neighborFound;
 }
 
-void NormalMerger::_mergeGroups(std::size_t aIndex, std::size_t bIndex)
+void NormalMergerWorkspace::_mergeGroups(std::size_t aIndex, std::size_t bIndex) noexcept
 {
     Group& aGroup = _groups[aIndex];
     Group& bGroup = _groups[bIndex];
-    std::vector<std::size_t>& aRegionIndexes = aGroup.regionIndexes;
-    const std::vector<std::size_t>& bRegionIndexes = bGroup.regionIndexes;
-    aRegionIndexes.insert(aRegionIndexes.end(), bRegionIndexes.begin(), bRegionIndexes.end());
-
     Point& aNormal = aGroup.normal;
     const Point& bNormal = bGroup.normal;
     int aArea = aGroup.area;
@@ -209,48 +1131,63 @@ void NormalMerger::_mergeGroups(std::size_t aIndex, std::size_t bIndex)
     aNormal.y = (aNormal.y * aArea + bNormal.y * bArea) / areaSum;
     aNormal.z = (aNormal.z * aArea + bNormal.z * bArea) / areaSum;
     aGroup.area = areaSum;
+    ++aGroup.version;
     bGroup.area = 0;
+    bGroup.absorberIndex = aIndex;
 
-    std::unordered_set<std::size_t>& aNeighbors = aGroup.neighborGroupIndexes;
-    aNeighbors.erase(bIndex);
+    // The neighbors of the absorbed group are inserted first, since they are the most likely to be merged next:
 
-    for(std::size_t bNeighborIndex : bGroup.neighborGroupIndexes)
+    if(bGroup.firstNeighbor != invalidIndex)
     {
-        if(bNeighborIndex != aIndex)
+        if(aGroup.firstNeighbor == invalidIndex)
         {
-            aNeighbors.insert(bNeighborIndex);
-
-            Group& bNeighborGroup = _groups[bNeighborIndex];
-            std::unordered_set<std::size_t>& bNeighborNeighbors = bNeighborGroup.neighborGroupIndexes;
-            bNeighborNeighbors.erase(bIndex);
-            bNeighborNeighbors.insert(aIndex);
+            aGroup.lastNeighbor = bGroup.lastNeighbor;
         }
+        else
+        {
+            _nextNeighbors[bGroup.lastNeighbor] = aGroup.firstNeighbor;
+        }
+
+        aGroup.firstNeighbor = bGroup.firstNeighbor;
+        bGroup.firstNeighbor = invalidIndex;
+        bGroup.lastNeighbor = invalidIndex;
     }
 }
 
-void NormalMerger::_buildPlanes(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes) const
+void NormalMergerWorkspace::_buildPlanes(const std::vector<NormalRegion>& normalRegions, std::vector<Plane>& planes)
 {
-    std::size_t planeIndex = 0;
-    planes.resize(_groups.size());
+    // Planes are sorted by the index of their group, and regions by their own index.
+    // Zero-area regions which have not been absorbed by other groups don't belong to any plane:
+
+    std::size_t numNormalRegions = normalRegions.size();
+    std::size_t numPlanes = 0;
+    _planeIndexes.resize(numNormalRegions);
 
-    for(const Group& group : _groups)
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
     {
-        if(group.area)
+        if(_groups[index].area)
         {
-            Plane& plane = planes[planeIndex];
-            std::vector<NormalRegion>& planeRegions = plane.regions;
-            planeRegions.clear();
-            planeRegions.reserve(group.regionIndexes.size());
-            ++planeIndex;
-
-            for(std::size_t regionIndex : group.regionIndexes)
-            {
-                planeRegions.push_back(normalRegions[regionIndex]);
-            }
+            _planeIndexes[index] = numPlanes;
+            ++numPlanes;
         }
     }
 
-    planes.resize(planeIndex);
+    planes.resize(numPlanes);
+
+    for(Plane& plane : planes)
+    {
+        plane.regions.clear();
+    }
+
+    for(std::size_t index = 0; index < numNormalRegions; ++index)
+    {
+        std::size_t absorberIndex = _getAbsorberGroupIndex(index);
+
+        if(_groups[absorberIndex].area)
+        {
+            planes[_planeIndexes[absorberIndex]].regions.push_back(normalRegions[index]);
+        }
+    }
 }
 
 }
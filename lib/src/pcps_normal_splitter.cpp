@@ -7,9 +7,14 @@
 #include "pcps_normal_splitter.h"
 
 #include <cmath>
+#include <atomic>
+#include <algorithm>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
+#include "pcps_context.h"
 #include "pcps_epsilon.h"
+#include "pcps_tweak_me.h"
+#include "pcps_thread_pool.h"
 #include "pcps_device_cloud.h"
 #include "pcps_normal_region.h"
 
@@ -86,8 +91,9 @@ bool NormalSplitter::split(const Cloud& inputNormalCloud, std::vector<NormalRegi
 
     DeviceCloud inputNormalDeviceCloud(inputNormalCloud, context);
     NormalRegion initialNormalRegion{ Point(), 0, 0, inputNormalCloud.width, inputNormalCloud.height };
+    NormalSplitterWorkspace workspace;
 
-    if(! _split(inputNormalDeviceCloud, initialNormalRegion, outputNormalRegions, context))
+    if(! _split(inputNormalDeviceCloud, nullptr, initialNormalRegion, outputNormalRegions, workspace, context))
     {
         PCPS_LOG_ERROR << "Initial normal region split failed" << std::endl;
         return false;
@@ -103,6 +109,20 @@ bool NormalSplitter::split(const Cloud& inputNormalCloud, std::vector<NormalRegi
 
 bool NormalSplitter::split(const DeviceCloud& inputNormalDeviceCloud, std::vector<NormalRegion>& outputNormalRegions,
                            Context& context) const
+{
+    NormalSplitterWorkspace workspace;
+    return _split(inputNormalDeviceCloud, nullptr, outputNormalRegions, workspace, context);
+}
+
+bool NormalSplitter::split(const DeviceCloud& inputNormalDeviceCloud, std::vector<NormalRegion>& outputNormalRegions,
+                           NormalSplitterWorkspace& workspace, Context& context) const
+{
+    return _split(inputNormalDeviceCloud, nullptr, outputNormalRegions, workspace, context);
+}
+
+bool NormalSplitter::_split(const DeviceCloud& inputNormalDeviceCloud, const NormalStatistics* normalStatistics,
+                            std::vector<NormalRegion>& outputNormalRegions, NormalSplitterWorkspace& workspace,
+                            Context& context) const
 {
     const Cloud& inputNormalCloud = inputNormalDeviceCloud.getHostCloud();
     outputNormalRegions.clear();
@@ -121,7 +141,8 @@ bool NormalSplitter::split(const DeviceCloud& inputNormalDeviceCloud, std::vecto
 
     NormalRegion initialNormalRegion{ Point(), 0, 0, inputNormalCloud.width, inputNormalCloud.height };
 
-    if(! _split(inputNormalDeviceCloud, initialNormalRegion, outputNormalRegions, context))
+    if(! _split(inputNormalDeviceCloud, normalStatistics, initialNormalRegion, outputNormalRegions, workspace,
+                context))
     {
         PCPS_LOG_ERROR << "Initial normal region split failed" << std::endl;
         return false;
@@ -135,82 +156,272 @@ bool NormalSplitter::split(const DeviceCloud& inputNormalDeviceCloud, std::vecto
     return true;
 }
 
-bool NormalSplitter::_split(const DeviceCloud& inputNormalDeviceCloud, const NormalRegion& normalRegion,
-                            std::vector<NormalRegion>& outputNormalRegions, Context& context) const
+bool NormalSplitter::_getStatistics(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion,
+                                    Point& mean, int& numValidNormals, bool& split, Context& context) const
 {
-    if(normalRegion.width >= _minimumRegionWidth && normalRegion.height >= _minimumRegionHeight)
+    split = false;
+
+    if(! _getMean(normalDeviceCloud, normalRegion, mean, numValidNormals, context))
     {
-        Point mean;
-        int numValidNormals;
+        PCPS_LOG_ERROR << "Mean calculation failed" << std::endl;
+        return false;
+    }
+
+    if(numValidNormals)
+    {
+        float stdDev = 0;
+
+        if(! _getStdDev(normalDeviceCloud, normalRegion, mean, numValidNormals, stdDev, context))
+        {
+            PCPS_LOG_ERROR << "Standard deviation calculation failed" << std::endl;
+            return false;
+        }
+
+        split = stdDev >= _stdDsvThreshold;
+    }
+
+    return true;
+}
+
+bool NormalSplitter::_split(const DeviceCloud& inputNormalDeviceCloud, const NormalStatistics* normalStatistics,
+                            const NormalRegion& initialNormalRegion, std::vector<NormalRegion>& outputNormalRegions,
+                            NormalSplitterWorkspace& workspace, Context& context) const
+{
+    bool levelSplit = false;
+
+    if(! _splitLevels(inputNormalDeviceCloud, initialNormalRegion, outputNormalRegions, levelSplit, context))
+    {
+        PCPS_LOG_ERROR << "Level split failed" << std::endl;
+        return false;
+    }
+
+    if(levelSplit)
+    {
+        return true;
+    }
+
+    RegionStatistics regionStatistics;
+    bool threadSafe = false;
+
+    if(! _getRegionStatistics(inputNormalDeviceCloud, normalStatistics, regionStatistics, threadSafe, context))
+    {
+        PCPS_LOG_ERROR << "Region statistics retrieve failed" << std::endl;
+        return false;
+    }
+
+    if(threadSafe && context.getThreads() > 1)
+    {
+        return _parallelSplit(regionStatistics, initialNormalRegion, outputNormalRegions, workspace,
+                              *context.getThreadPool());
+    }
+
+    return _split(regionStatistics, initialNormalRegion, outputNormalRegions, workspace._stack);
+}
+
+bool NormalSplitter::_split(const RegionStatistics& regionStatistics, const NormalRegion& initialNormalRegion,
+                            std::vector<NormalRegion>& outputNormalRegions, std::vector<NormalRegion>& stack) const
+{
+    // Depth-first traversal with an explicit stack (the first half of each split region is processed first):
+
+    stack.clear();
+    stack.push_back(initialNormalRegion);
+
+    while(! stack.empty())
+    {
+        NormalRegion normalRegion = stack.back();
+        stack.pop_back();
 
-        if(! _getMean(inputNormalDeviceCloud, normalRegion, mean, numValidNormals, context))
+        NormalRegion firstNormalRegion;
+        NormalRegion secondNormalRegion;
+        bool split;
+
+        if(! _splitRegion(regionStatistics, normalRegion, outputNormalRegions, split, firstNormalRegion,
+                          secondNormalRegion))
         {
-            PCPS_LOG_ERROR << "Mean calculation failed" << std::endl;
             return false;
         }
 
-        if(numValidNormals)
+        if(split)
         {
-            float stdDev = 0;
+            stack.push_back(secondNormalRegion);
+            stack.push_back(firstNormalRegion);
+        }
+    }
 
-            if(! _getStdDev(inputNormalDeviceCloud, normalRegion, mean, numValidNormals, stdDev, context))
+    return true;
+}
+
+bool NormalSplitter::_parallelSplit(const RegionStatistics& regionStatistics, const NormalRegion& initialNormalRegion,
+                                    std::vector<NormalRegion>& outputNormalRegions, NormalSplitterWorkspace& workspace,
+                                    ThreadPool& threadPool) const
+{
+    using Item = NormalSplitterWorkspace::Item;
+    using TaskOutput = NormalSplitterWorkspace::TaskOutput;
+
+    // Split the largest regions in the calling thread, and keep the smaller ones as tasks in depth-first order:
+
+    int threads = threadPool.getThreads();
+    int initialArea = initialNormalRegion.width * initialNormalRegion.height;
+    int minTaskArea = std::max(initialArea / (threads * PCPS_CPU_SPLITTER_TASKS_PER_THREAD),
+                               PCPS_CPU_SPLITTER_MIN_TASK_AREA);
+    std::vector<Item>& items = workspace._items;
+    std::vector<NormalRegion>& tasks = workspace._tasks;
+    std::vector<NormalRegion>& stack = workspace._stack;
+    items.clear();
+    tasks.clear();
+    stack.clear();
+    stack.push_back(initialNormalRegion);
+
+    while(! stack.empty())
+    {
+        NormalRegion normalRegion = stack.back();
+        stack.pop_back();
+
+        if(normalRegion.width * normalRegion.height <= minTaskArea)
+        {
+            items.push_back(Item{ normalRegion, int(tasks.size()) });
+            tasks.push_back(normalRegion);
+            continue;
+        }
+
+        std::size_t numOutputNormalRegions = outputNormalRegions.size();
+        NormalRegion firstNormalRegion;
+        NormalRegion secondNormalRegion;
+        bool split;
+
+        if(! _splitRegion(regionStatistics, normalRegion, outputNormalRegions, split, firstNormalRegion,
+                          secondNormalRegion))
+        {
+            return false;
+        }
+
+        if(split)
+        {
+            stack.push_back(secondNormalRegion);
+            stack.push_back(firstNormalRegion);
+        }
+        else if(outputNormalRegions.size() > numOutputNormalRegions)
+        {
+            items.push_back(Item{ outputNormalRegions.back(), -1 });
+            outputNormalRegions.pop_back();
+        }
+    }
+
+    // Each worker takes the next pending task and appends its regions to its own buffer.
+    // Tasks are known before the workers start and there are only a few of them per thread,
+    // so a shared counter balances them without work stealing:
+
+    int workers = std::min(threads, int(tasks.size()));
+    std::size_t numWorkers = std::size_t(std::max(workers, 1));
+    std::vector<std::vector<NormalRegion>>& workerNormalRegions = workspace._workerNormalRegions;
+    std::vector<std::vector<NormalRegion>>& workerStacks = workspace._workerStacks;
+    std::vector<TaskOutput>& taskOutputs = workspace._taskOutputs;
+
+    if(workerNormalRegions.size() < numWorkers)
+    {
+        workerNormalRegions.resize(numWorkers);
+        workerStacks.resize(numWorkers);
+    }
+
+    for(std::size_t worker = 0; worker < numWorkers; ++worker)
+    {
+        workerNormalRegions[worker].clear();
+    }
+
+    taskOutputs.resize(tasks.size());
+
+    std::atomic<int> nextTask(0);
+    std::atomic<bool> success(true);
+
+    threadPool.run(workers, [&](int worker)
+    {
+        std::vector<NormalRegion>& normalRegions = workerNormalRegions[std::size_t(worker)];
+        std::vector<NormalRegion>& workerStack = workerStacks[std::size_t(worker)];
+
+        for(int task = nextTask++; task < int(tasks.size()); task = nextTask++)
+        {
+            std::size_t begin = normalRegions.size();
+
+            if(! _split(regionStatistics, tasks[std::size_t(task)], normalRegions, workerStack))
             {
-                PCPS_LOG_ERROR << "Standard deviation calculation failed" << std::endl;
-                return false;
+                success = false;
             }
 
-            if(stdDev >= _stdDsvThreshold)
+            taskOutputs[std::size_t(task)] = TaskOutput{ worker, begin, normalRegions.size() };
+        }
+    });
+
+    if(! success)
+    {
+        return false;
+    }
+
+    // Merge the regions in depth-first order, so they are the same as the serial ones:
+
+    for(const Item& item : items)
+    {
+        if(item.task >= 0)
+        {
+            const TaskOutput& taskOutput = taskOutputs[std::size_t(item.task)];
+            const std::vector<NormalRegion>& normalRegions = workerNormalRegions[std::size_t(taskOutput.worker)];
+            outputNormalRegions.insert(outputNormalRegions.end(), normalRegions.begin() + long(taskOutput.begin),
+                                       normalRegions.begin() + long(taskOutput.end));
+        }
+        else
+        {
+            outputNormalRegions.push_back(item.normalRegion);
+        }
+    }
+
+    return true;
+}
+
+bool NormalSplitter::_splitRegion(const RegionStatistics& regionStatistics, const NormalRegion& normalRegion,
+                                  std::vector<NormalRegion>& outputNormalRegions, bool& split,
+                                  NormalRegion& firstNormalRegion, NormalRegion& secondNormalRegion) const
+{
+    split = false;
+
+    if(normalRegion.width >= _minimumRegionWidth && normalRegion.height >= _minimumRegionHeight)
+    {
+        Point mean;
+        int numValidNormals;
+
+        if(! regionStatistics(normalRegion, mean, numValidNormals, split))
+        {
+            PCPS_LOG_ERROR << "Statistics calculation failed" << std::endl;
+            return false;
+        }
+
+        if(! numValidNormals)
+        {
+            split = false;
+        }
+        else if(split)
+        {
+            if(normalRegion.width > normalRegion.height)
             {
-                if(normalRegion.width > normalRegion.height)
-                {
-                    int halfWidth = normalRegion.width / 2;
-                    NormalRegion leftNormalRegion{ Point(), normalRegion.x, normalRegion.y, halfWidth,
-                                normalRegion.height };
-
-                    if(! _split(inputNormalDeviceCloud, leftNormalRegion, outputNormalRegions, context))
-                    {
-                        PCPS_LOG_ERROR << "Left normal region split failed" << std::endl;
-                        return false;
-                    }
-
-                    NormalRegion rightNormalRegion{ Point(), normalRegion.x + halfWidth, normalRegion.y,
-                                normalRegion.width - halfWidth, normalRegion.height };
-
-                    if(! _split(inputNormalDeviceCloud, rightNormalRegion, outputNormalRegions, context))
-                    {
-                        PCPS_LOG_ERROR << "Right normal region split failed" << std::endl;
-                        return false;
-                    }
-                }
-                else
-                {
-                    int halfHeight = normalRegion.height / 2;
-                    NormalRegion upNormalRegion{ Point(), normalRegion.x, normalRegion.y, normalRegion.width,
-                                halfHeight };
-
-                    if(! _split(inputNormalDeviceCloud, upNormalRegion, outputNormalRegions, context))
-                    {
-                        PCPS_LOG_ERROR << "Up normal region split failed" << std::endl;
-                        return false;
-                    }
-
-                    NormalRegion downNormalRegion{ Point(), normalRegion.x, normalRegion.y + halfHeight,
-                                normalRegion.width, normalRegion.height - halfHeight };
-
-                    if(! _split(inputNormalDeviceCloud, downNormalRegion, outputNormalRegions, context))
-                    {
-                        PCPS_LOG_ERROR << "Down normal region split failed" << std::endl;
-                        return false;
-                    }
-                }
+                int halfWidth = normalRegion.width / 2;
+                firstNormalRegion = NormalRegion{ Point(), normalRegion.x, normalRegion.y, halfWidth,
+                        normalRegion.height };
+                secondNormalRegion = NormalRegion{ Point(), normalRegion.x + halfWidth, normalRegion.y,
+                        normalRegion.width - halfWidth, normalRegion.height };
             }
             else
             {
-                NormalRegion newNormalRegion = normalRegion;
-                newNormalRegion.normal = mean;
-                outputNormalRegions.push_back(newNormalRegion);
+                int halfHeight = normalRegion.height / 2;
+                firstNormalRegion = NormalRegion{ Point(), normalRegion.x, normalRegion.y, normalRegion.width,
+                        halfHeight };
+                secondNormalRegion = NormalRegion{ Point(), normalRegion.x, normalRegion.y + halfHeight,
+                        normalRegion.width, normalRegion.height - halfHeight };
             }
         }
+        else
+        {
+            NormalRegion newNormalRegion = normalRegion;
+            newNormalRegion.normal = mean;
+            outputNormalRegions.push_back(newNormalRegion);
+        }
     }
 
     return true;
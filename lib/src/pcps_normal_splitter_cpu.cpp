@@ -6,7 +6,14 @@
 
 #include "pcps_normal_splitter.h"
 
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include "pcps_cloud.h"
+#include "pcps_context.h"
 #include "pcps_device_cloud.h"
+#include "pcps_normal_region.h"
+#include "pcps_normal_statistics.h"
 
 namespace pcps
 {
@@ -25,4 +32,82 @@ bool NormalSplitter::_getStdDev(const DeviceCloud& normalDeviceCloud, const Norm
     return true;
 }
 
+bool NormalSplitter::_getRegionStatistics(const DeviceCloud& normalDeviceCloud,
+                                          const NormalStatistics* normalStatistics,
+                                          RegionStatistics& regionStatistics, bool& threadSafe,
+                                          Context& context) const
+{
+    // Summed-area tables are only built if they have not been built during the normal extraction:
+
+    const Cloud& normalCloud = normalDeviceCloud.getHostCloud();
+    std::shared_ptr<NormalStatistics> builtNormalStatistics;
+    threadSafe = true;
+
+    if(! normalStatistics)
+    {
+        builtNormalStatistics = std::make_shared<NormalStatistics>();
+        builtNormalStatistics->build(normalCloud, *context.getThreadPool());
+        normalStatistics = builtNormalStatistics.get();
+    }
+
+    regionStatistics = [this, normalStatistics, builtNormalStatistics, &normalCloud](
+            const NormalRegion& normalRegion, Point& mean, int& numValidNormals, bool& split)
+    {
+        NormalStatistics::Sums sums = normalStatistics->getSums(normalRegion, normalCloud.points.data());
+        numValidNormals = int(std::round(sums[3]));
+        split = false;
+
+        if(! numValidNormals)
+        {
+            mean = Point{ 0, 0, 0, 0 };
+            return true;
+        }
+
+        double numValidNormalsInv = 1 / double(numValidNormals);
+        double meanX = sums[0] * numValidNormalsInv;
+        double meanY = sums[1] * numValidNormalsInv;
+        double meanZ = sums[2] * numValidNormalsInv;
+        mean = Point{ float(meanX), float(meanY), float(meanZ), 1 };
+
+        if(normalStatistics->hasZeroInvalidNormals())
+        {
+            // The average dot product between each valid normal and the mean is the squared mean length,
+            // so the mean angle is bounded by 1 - |mean|^2 <= stdDev <= (pi / sqrt(2)) * sqrt(1 - |mean|^2)
+            // (acos(c) = 2 * asin(sqrt((1 - c) / 2)) and t <= asin(t) <= (pi / 2) * t).
+            // Only regions whose bounds are near the threshold are scanned, with the same mean as the scalar code:
+
+            double spread = std::max(1 - ((meanX * meanX) + (meanY * meanY) + (meanZ * meanZ)), 0.0);
+            double threshold = double(_stdDsvThreshold);
+            double thresholdMargin = threshold * 1e-3;
+
+            if(2.2214414690791831 * std::sqrt(spread) < threshold - thresholdMargin)
+            {
+                return true;
+            }
+
+            if(spread > threshold + thresholdMargin)
+            {
+                split = true;
+                return true;
+            }
+        }
+
+        float stdDev = 0;
+        _getCpuMean(normalCloud, normalRegion, mean, numValidNormals);
+        _getCpuStdDev(normalCloud, normalRegion, mean, numValidNormals, stdDev);
+        split = stdDev >= _stdDsvThreshold;
+        return true;
+    };
+
+    return true;
+}
+
+bool NormalSplitter::_splitLevels(const DeviceCloud&, const NormalRegion&, std::vector<NormalRegion>&,
+                                  bool& levelSplit, Context&) const
+{
+    // Regions are split one by one:
+    levelSplit = false;
+    return true;
+}
+
 }
@@ -10,7 +10,6 @@
 #include "pcps_logger.h"
 #include "pcps_context.h"
 #include "pcps_epsilon.h"
-#include "pcps_tweak_me.h"
 #include "pcps_device_cloud.h"
 #include "pcps_normal_region.h"
 #include "pcps_thrust_normal_splitter.h"
@@ -25,7 +24,7 @@ bool NormalSplitter::_getMean(const DeviceCloud& normalDeviceCloud, const Normal
 {
     const Cloud& normalCloud = normalDeviceCloud.getHostCloud();
 
-    if(normalRegion.width * normalRegion.height < PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA)
+    if(normalRegion.width * normalRegion.height < context.getSplitterMaxCpuRegionArea())
     {
         _getCpuMean(normalCloud, normalRegion, mean, numValidNormals);
     }
@@ -44,7 +43,7 @@ bool NormalSplitter::_getStdDev(const DeviceCloud& normalDeviceCloud, const Norm
 {
     const Cloud& normalCloud = normalDeviceCloud.getHostCloud();
 
-    if(normalRegion.width * normalRegion.height < PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA)
+    if(normalRegion.width * normalRegion.height < context.getSplitterMaxCpuRegionArea())
     {
         _getCpuStdDev(normalCloud, normalRegion, mean, numValidNormals, stdDev);
     }
@@ -58,4 +57,28 @@ bool NormalSplitter::_getStdDev(const DeviceCloud& normalDeviceCloud, const Norm
     return true;
 }
 
+bool NormalSplitter::_getRegionStatistics(const DeviceCloud& normalDeviceCloud, const NormalStatistics*,
+                                          RegionStatistics& regionStatistics, bool& threadSafe,
+                                          Context& context) const
+{
+    // Device reductions share the context queue:
+    threadSafe = false;
+
+    regionStatistics = [this, &normalDeviceCloud, &context](const NormalRegion& normalRegion, Point& mean,
+            int& numValidNormals, bool& split)
+    {
+        return _getStatistics(normalDeviceCloud, normalRegion, mean, numValidNormals, split, context);
+    };
+
+    return true;
+}
+
+bool NormalSplitter::_splitLevels(const DeviceCloud&, const NormalRegion&, std::vector<NormalRegion>&,
+                                  bool& levelSplit, Context&) const
+{
+    // Regions are split one by one:
+    levelSplit = false;
+    return true;
+}
+
 }
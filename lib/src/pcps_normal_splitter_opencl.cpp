@@ -6,157 +6,331 @@
 
 #include "pcps_normal_splitter.h"
 
+#include <numeric>
+#include <algorithm>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_context.h"
-#include "pcps_epsilon.h"
 #include "pcps_tweak_me.h"
 #include "pcps_device_cloud.h"
 #include "pcps_normal_region.h"
-#include "pcps_boost_compute.h"
+#include "pcps_program_cache.h"
+#include "pcps_device_buffer_pool.h"
 
 namespace bpc = boost::compute;
-using DeviceView = bpc::mapped_view<bpc::float4_>;
+using DeviceView = pcps::DeviceBuffer<bpc::float4_>;
 
 namespace pcps
 {
 
-bool NormalSplitter::_getMean(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion, Point& mean,
-                              int& numValidNormals, Context& context) const
+namespace
 {
-    const Cloud& normalCloud = normalDeviceCloud.getHostCloud();
+    // Each region is identified by its path in the split tree, stored from the most significant bit
+    // (0 for the first half, 1 for the second one), so sorting the keys gives the depth-first order:
+    constexpr int maxLevels = 64;
 
-    if(normalRegion.width * normalRegion.height < PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA)
-    {
-        _getCpuMean(normalCloud, normalRegion, mean, numValidNormals);
-    }
-    else
-    {
-        auto deviceNormalsPtr = static_cast<const DeviceView*>(normalDeviceCloud.getDeviceData());
-        const DeviceView& deviceNormals = *deviceNormalsPtr;
-        int x = normalRegion.x;
-        int y = normalRegion.y;
-        int roiWidth = normalRegion.width;
-        int globalWidth = normalCloud.width;
-        std::array<int, 4> args = { x, y, roiWidth, globalWidth };
-        bpc::mapped_view<int> deviceArgs(args.data(), args.size(), *context.context);
-
-        BOOST_COMPUTE_CLOSURE(bpc::float4_, transform, (int index), (deviceNormals, deviceArgs),
-        {
-            int x = deviceArgs[0];
-            int y = deviceArgs[1];
-            int roiWidth = deviceArgs[2];
-            int globalWidth = deviceArgs[3];
-
-            // C = A % B is equivalent to C = A – B * (A / B)
-            int aDivB = index / roiWidth;
-            // int aModB = index % roiWidth;
-            int aModB = index - (aDivB * roiWidth);
-            int indexX = x + aModB;
-            int indexY = y + aDivB;
-            int globalIndex = (indexY * globalWidth) + indexX;
-            return deviceNormals[globalIndex];
-        });
-
-        bpc::counting_iterator<int> first(0);
-        bpc::counting_iterator<int> last = first + (normalRegion.width * normalRegion.height);
-        bpc::float4_ sum = { 0, 0, 0, 0 };
-
-        try
-        {
-            bpc::transform_reduce(first, last, &sum, transform, bpc::plus<bpc::float4_>(), *context.queue);
-        }
-        catch(const bpc::program_build_failure& programBuildFailure)
+    // One work-group per region of the current level:
+    // the first pass reduces the normals sum, the second one the angle between each valid normal and the mean.
+    // Split regions append their halves to the next level, and the others are appended to the leaf list.
+    // Minimum region size is defined at build time (PCPS_MINIMUM_WIDTH and PCPS_MINIMUM_HEIGHT).
+    // Cloud width (PCPS_CLOUD_WIDTH) is defined with the numeric value only if the context specializes
+    // cloud geometry, since each cloud width builds a new program; otherwise it is defined as the kernel argument:
+    const char* splitLevelSource = BOOST_COMPUTE_STRINGIZE_SOURCE(
+        __kernel void splitLevel(__global const float4* normals, int cloudWidth, __global const int4* regions,
+                                 __global const ulong* keys, int level, float stdDsvThreshold,
+                                 __global int4* nextRegions, __global ulong* nextKeys, __global int4* leafRegions,
+                                 __global float4* leafNormals, __global ulong* leafKeys, __global int* counters,
+                                 __local float4* sums)
         {
-            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
-            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
-            return false;
-        }
+            int localIndex = get_local_id(0);
+            int localSize = get_local_size(0);
+            int regionIndex = get_group_id(0);
+            int4 region = regions[regionIndex];
+            int regionWidth = region.z;
+            int regionHeight = region.w;
 
-        numValidNormals = int(std::round(sum[3]));
+            if(regionWidth < PCPS_MINIMUM_WIDTH || regionHeight < PCPS_MINIMUM_HEIGHT)
+            {
+                return;
+            }
 
-        if(numValidNormals)
-        {
-            mean = { sum[0] / numValidNormals, sum[1] / numValidNormals, sum[2] / numValidNormals, 1 };
-        }
-        else
-        {
-            mean = { 0, 0, 0, 0 };
+            int area = regionWidth * regionHeight;
+            float4 sum = (float4)(0, 0, 0, 0);
+
+            for(int index = localIndex; index < area; index += localSize)
+            {
+                int row = index / regionWidth;
+                int col = index - (row * regionWidth);
+                sum += normals[((region.y + row) * PCPS_CLOUD_WIDTH) + region.x + col];
+            }
+
+            sums[localIndex] = sum;
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            for(int offset = localSize / 2; offset > 0; offset /= 2)
+            {
+                if(localIndex < offset)
+                {
+                    sums[localIndex] += sums[localIndex + offset];
+                }
+
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+
+            sum = sums[0];
+
+            int numValidNormals = (int)(round(sum.w));
+
+            if(! numValidNormals)
+            {
+                return;
+            }
+
+            float4 mean = (float4)(sum.x / numValidNormals, sum.y / numValidNormals, sum.z / numValidNormals, 1);
+            float stdDevSum = 0;
+
+            for(int index = localIndex; index < area; index += localSize)
+            {
+                int row = index / regionWidth;
+                int col = index - (row * regionWidth);
+                float4 normal = normals[((region.y + row) * PCPS_CLOUD_WIDTH) + region.x + col];
+
+                if(normal.w > 0)
+                {
+                    float dotProduct = normal.x * mean.x + normal.y * mean.y + normal.z * mean.z;
+                    stdDevSum += acos(dotProduct);
+                }
+            }
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+            sums[localIndex].x = stdDevSum;
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            for(int offset = localSize / 2; offset > 0; offset /= 2)
+            {
+                if(localIndex < offset)
+                {
+                    sums[localIndex].x += sums[localIndex + offset].x;
+                }
+
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+
+            if(localIndex)
+            {
+                return;
+            }
+
+            float stdDev = sums[0].x / numValidNormals;
+            ulong key = keys[regionIndex];
+
+            if(stdDev >= stdDsvThreshold)
+            {
+                int4 firstRegion;
+                int4 secondRegion;
+
+                if(regionWidth > regionHeight)
+                {
+                    int halfWidth = regionWidth / 2;
+                    firstRegion = (int4)(region.x, region.y, halfWidth, regionHeight);
+                    secondRegion = (int4)(region.x + halfWidth, region.y, regionWidth - halfWidth, regionHeight);
+                }
+                else
+                {
+                    int halfHeight = regionHeight / 2;
+                    firstRegion = (int4)(region.x, region.y, regionWidth, halfHeight);
+                    secondRegion = (int4)(region.x, region.y + halfHeight, regionWidth, regionHeight - halfHeight);
+                }
+
+                int nextIndex = atomic_add(counters + level + 1, 2);
+                nextRegions[nextIndex] = firstRegion;
+                nextKeys[nextIndex] = key;
+                nextRegions[nextIndex + 1] = secondRegion;
+                nextKeys[nextIndex + 1] = key | (1UL << (63 - level));
+            }
+            else
+            {
+                int leafIndex = atomic_inc(counters);
+                leafRegions[leafIndex] = region;
+                leafNormals[leafIndex] = mean;
+                leafKeys[leafIndex] = key;
+            }
         }
-    }
+    );
+}
 
+bool NormalSplitter::_getMean(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion, Point& mean,
+                              int& numValidNormals, Context&) const
+{
+    _getCpuMean(normalDeviceCloud.getHostCloud(), normalRegion, mean, numValidNormals);
     return true;
 }
 
 bool NormalSplitter::_getStdDev(const DeviceCloud& normalDeviceCloud, const NormalRegion& normalRegion,
-                                const Point& mean, int numValidNormals, float& stdDev, Context& context) const
+                                const Point& mean, int numValidNormals, float& stdDev, Context&) const
 {
-    const Cloud& normalCloud = normalDeviceCloud.getHostCloud();
+    _getCpuStdDev(normalDeviceCloud.getHostCloud(), normalRegion, mean, numValidNormals, stdDev);
+    return true;
+}
+
+bool NormalSplitter::_getRegionStatistics(const DeviceCloud& normalDeviceCloud, const NormalStatistics*,
+                                          RegionStatistics& regionStatistics, bool& threadSafe,
+                                          Context& context) const
+{
+    // Only clouds smaller than the context splitter max CPU region area are split region by region:
+    threadSafe = true;
+
+    regionStatistics = [this, &normalDeviceCloud, &context](const NormalRegion& normalRegion, Point& mean,
+            int& numValidNormals, bool& split)
+    {
+        return _getStatistics(normalDeviceCloud, normalRegion, mean, numValidNormals, split, context);
+    };
+
+    return true;
+}
+
+bool NormalSplitter::_splitLevels(const DeviceCloud& normalDeviceCloud, const NormalRegion& initialNormalRegion,
+                                  std::vector<NormalRegion>& outputNormalRegions, bool& levelSplit,
+                                  Context& context) const
+{
+    int initialArea = initialNormalRegion.width * initialNormalRegion.height;
+    levelSplit = initialArea >= context.getSplitterMaxCpuRegionArea();
+
+    if(! levelSplit)
+    {
+        return true;
+    }
+
+    bpc::command_queue& queue = *context.queue;
+    int cloudWidth = normalDeviceCloud.getHostCloud().width;
+    bpc::kernel kernel;
 
-    if(normalRegion.width * normalRegion.height < PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA)
+    try
     {
-        _getCpuStdDev(normalCloud, normalRegion, mean, numValidNormals, stdDev);
+        ProgramCache& programCache = context.getProgramCache();
+        std::string options = ProgramCache::getDefine("PCPS_MINIMUM_WIDTH", _minimumRegionWidth) + ' ' +
+                ProgramCache::getDefine("PCPS_MINIMUM_HEIGHT", _minimumRegionHeight) + ' ' +
+                programCache.getGeometryDefine("PCPS_CLOUD_WIDTH", "cloudWidth", cloudWidth);
+        bpc::program program = programCache.getOrBuild(splitLevelSource, options);
+        kernel = program.create_kernel("splitLevel");
     }
-    else
+    catch(const bpc::program_build_failure& programBuildFailure)
     {
-        auto deviceNormalsPtr = static_cast<const DeviceView*>(normalDeviceCloud.getDeviceData());
-        const DeviceView& deviceNormals = *deviceNormalsPtr;
-        auto bpcMean = reinterpret_cast<const bpc::float4_&>(mean);
-        int x = normalRegion.x;
-        int y = normalRegion.y;
-        int roiWidth = normalRegion.width;
-        int globalWidth = normalCloud.width;
-        std::array<int, 4> intArgs = { x, y, roiWidth, globalWidth };
-        bpc::mapped_view<int> deviceIntArgs(intArgs.data(), intArgs.size(), *context.context);
-        bpc::mapped_view<bpc::float4_> deviceMean(&bpcMean, 1, *context.context);
-
-        BOOST_COMPUTE_CLOSURE(float, transform, (int index), (deviceNormals, deviceIntArgs, deviceMean),
-        {
-            int x = deviceIntArgs[0];
-            int y = deviceIntArgs[1];
-            int roiWidth = deviceIntArgs[2];
-            int globalWidth = deviceIntArgs[3];
-            float4 mean = deviceMean[0];
-
-            // C = A % B is equivalent to C = A – B * (A / B)
-            int aDivB = index / roiWidth;
-            // int aModB = index % roiWidth;
-            int aModB = index - (aDivB * roiWidth);
-            int indexX = x + aModB;
-            int indexY = y + aDivB;
-            int globalIndex = (indexY * globalWidth) + indexX;
-            float4 normal = deviceNormals[globalIndex];
-            float stdDev;
-
-            if(normal.w > 0)
-            {
-                float dotProduct = normal.x * mean.x + normal.y * mean.y + normal.z * mean.z;
-                stdDev = acos(dotProduct);
-            }
-            else
-            {
-                stdDev = 0;
-            }
+        PCPS_LOG_ERROR << "Program build failure: " << std::endl;
+        PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+        return false;
+    }
+
+    // The reduction needs a power of two work-group size:
+
+    auto maxWorkGroupSize = std::min(std::size_t(PCPS_OPENCL_SPLITTER_WORK_GROUP_SIZE),
+                                     kernel.get_work_group_info<std::size_t>(queue.get_device(),
+                                                                              CL_KERNEL_WORK_GROUP_SIZE));
+    std::size_t workGroupSize = 1;
+
+    while(workGroupSize * 2 <= maxWorkGroupSize)
+    {
+        workGroupSize *= 2;
+    }
+
+    // Output regions are disjoint and not smaller than the minimum region size, so their count is bounded:
+
+    int maxLeaves = std::max(initialArea / (_minimumRegionWidth * _minimumRegionHeight), 1);
+    DeviceBufferScope deviceBuffers(context.getDeviceBufferPool(), queue);
+    DeviceBuffer<bpc::int4_> leafRegions = deviceBuffers.acquire<bpc::int4_>(std::size_t(maxLeaves));
+    DeviceBuffer<bpc::float4_> leafNormals = deviceBuffers.acquire<bpc::float4_>(std::size_t(maxLeaves));
+    DeviceBuffer<bpc::ulong_> leafKeys = deviceBuffers.acquire<bpc::ulong_>(std::size_t(maxLeaves));
+    DeviceBuffer<bpc::int4_> regions = deviceBuffers.acquire<bpc::int4_>(1);
+    DeviceBuffer<bpc::ulong_> keys = deviceBuffers.acquire<bpc::ulong_>(1);
+    DeviceBuffer<bpc::int4_> nextRegions = deviceBuffers.acquire<bpc::int4_>(2);
+    DeviceBuffer<bpc::ulong_> nextKeys = deviceBuffers.acquire<bpc::ulong_>(2);
+
+    // counters[0] is the leaves count, and counters[level + 1] is the regions count of the next level:
 
-            return stdDev;
-        });
+    std::vector<int> hostCounters(maxLevels + 1, 0);
+    DeviceBuffer<int> counters = deviceBuffers.upload(hostCounters.data(), hostCounters.size());
 
-        bpc::counting_iterator<int> first(0);
-        bpc::counting_iterator<int> last = first + (normalRegion.width * normalRegion.height);
-        float sum = 0;
+    bpc::int4_ initialRegion;
+    initialRegion[0] = initialNormalRegion.x;
+    initialRegion[1] = initialNormalRegion.y;
+    initialRegion[2] = initialNormalRegion.width;
+    initialRegion[3] = initialNormalRegion.height;
 
-        try
+    bpc::ulong_ initialKey = 0;
+    queue.enqueue_write_buffer(regions.get_buffer(), 0, sizeof(initialRegion), &initialRegion);
+    queue.enqueue_write_buffer(keys.get_buffer(), 0, sizeof(initialKey), &initialKey);
+
+    const DeviceView& deviceNormals = *static_cast<const DeviceView*>(normalDeviceCloud.getDeviceData());
+    int numRegions = 1;
+
+    for(int level = 0; numRegions; ++level)
+    {
+        if(level == maxLevels)
         {
-            bpc::transform_reduce(first, last, &sum, transform, bpc::plus<float>(), *context.queue);
+            PCPS_LOG_ERROR << "Too many split levels" << std::endl;
+            return false;
         }
-        catch(const bpc::program_build_failure& programBuildFailure)
+
+        auto maxNextRegions = std::size_t(numRegions) * 2;
+
+        // Next level buffers are fully written by the kernel, so they are replaced instead of resized:
+
+        if(nextRegions.size() < maxNextRegions)
         {
-            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
-            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
-            return false;
+            nextRegions = deviceBuffers.acquire<bpc::int4_>(maxNextRegions);
+            nextKeys = deviceBuffers.acquire<bpc::ulong_>(maxNextRegions);
         }
 
-        stdDev = sum / numValidNormals;
+        kernel.set_args(deviceNormals.get_buffer(), cloudWidth, regions.get_buffer(), keys.get_buffer(), level,
+                        _stdDsvThreshold,
+                        nextRegions.get_buffer(), nextKeys.get_buffer(), leafRegions.get_buffer(),
+                        leafNormals.get_buffer(), leafKeys.get_buffer(), counters.get_buffer(),
+                        bpc::local_buffer<bpc::float4_>(workGroupSize));
+        queue.enqueue_1d_range_kernel(kernel, 0, std::size_t(numRegions) * workGroupSize, workGroupSize);
+
+        // Only the next level size is read back between launches:
+
+        queue.enqueue_read_buffer(counters.get_buffer(), std::size_t(level + 1) * sizeof(int), sizeof(int),
+                                  &numRegions);
+        std::swap(regions, nextRegions);
+        std::swap(keys, nextKeys);
+    }
+
+    int numLeaves;
+    queue.enqueue_read_buffer(counters.get_buffer(), 0, sizeof(int), &numLeaves);
+
+    std::vector<bpc::int4_> hostLeafRegions(std::size_t(numLeaves));
+    std::vector<bpc::float4_> hostLeafNormals(std::size_t(numLeaves));
+    std::vector<bpc::ulong_> hostLeafKeys(std::size_t(numLeaves));
+
+    if(numLeaves)
+    {
+        queue.enqueue_read_buffer(leafRegions.get_buffer(), 0, hostLeafRegions.size() * sizeof(bpc::int4_),
+                                  hostLeafRegions.data());
+        queue.enqueue_read_buffer(leafNormals.get_buffer(), 0, hostLeafNormals.size() * sizeof(bpc::float4_),
+                                  hostLeafNormals.data());
+        queue.enqueue_read_buffer(leafKeys.get_buffer(), 0, hostLeafKeys.size() * sizeof(bpc::ulong_),
+                                  hostLeafKeys.data());
+    }
+
+    // Leaves are appended in any order, so they are sorted to match the host depth-first order:
+
+    std::vector<int> leafIndices(std::size_t(numLeaves));
+    std::iota(leafIndices.begin(), leafIndices.end(), 0);
+    std::sort(leafIndices.begin(), leafIndices.end(), [&hostLeafKeys](int a, int b)
+    {
+        return hostLeafKeys[std::size_t(a)] < hostLeafKeys[std::size_t(b)];
+    });
+
+    outputNormalRegions.reserve(outputNormalRegions.size() + leafIndices.size());
+
+    for(int leafIndex : leafIndices)
+    {
+        const bpc::int4_& leafRegion = hostLeafRegions[std::size_t(leafIndex)];
+        const bpc::float4_& leafNormal = hostLeafNormals[std::size_t(leafIndex)];
+        Point normal{ leafNormal[0], leafNormal[1], leafNormal[2], leafNormal[3] };
+        outputNormalRegions.push_back(NormalRegion{ normal, leafRegion[0], leafRegion[1], leafRegion[2],
+                                                    leafRegion[3] });
     }
 
     return true;
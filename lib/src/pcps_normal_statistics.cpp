@@ -0,0 +1,224 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_normal_statistics.h"
+
+#include <cmath>
+#include <algorithm>
+#include "pcps_cloud.h"
+#include "pcps_tweak_me.h"
+#include "pcps_normal_region.h"
+#include "pcps_cpu_parallel.h"
+
+namespace pcps
+{
+
+namespace
+{
+    bool addNormal(const Point& normal, NormalStatistics::Sums& sums) noexcept
+    {
+        if(! normal.isFinite() || ! std::isfinite(normal.aux))
+        {
+            return false;
+        }
+
+        sums[0] += double(normal.x);
+        sums[1] += double(normal.y);
+        sums[2] += double(normal.z);
+        sums[3] += double(normal.aux);
+        return true;
+    }
+}
+
+void NormalStatistics::build(const Cloud& normalCloud, ThreadPool& threadPool)
+{
+    int cols = normalCloud.width;
+    int rows = normalCloud.height;
+    reset(cols, rows);
+
+    int chunks = getParallelChunks(std::size_t(rows * cols), PCPS_CPU_SPLITTER_MIN_POINTS_PER_THREAD,
+                                   threadPool.getThreads());
+
+    parallelChunks(threadPool, std::size_t(rows), chunks, [&](int, std::size_t firstRow, std::size_t lastRow)
+    {
+        for(auto row = int(firstRow); row < int(lastRow); ++row)
+        {
+            accumulateRow(normalCloud.points.data(), row);
+        }
+    });
+
+    finish(threadPool);
+}
+
+void NormalStatistics::reset(int cols, int rows)
+{
+    int tileSize = PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE;
+    _cols = cols;
+    _rows = rows;
+    _tileCols = (cols + tileSize - 1) / tileSize;
+    _tileRows = (rows + tileSize - 1) / tileSize;
+    _rowSums.assign(std::size_t(rows * _tileCols), Sums{ { 0 } });
+    _sums.assign(std::size_t((_tileCols + 1) * (_tileRows + 1)), Sums{ { 0 } });
+    _rowZeroInvalidNormals.assign(std::size_t(rows), 1);
+}
+
+void NormalStatistics::accumulateRow(const Point* normals, int row) noexcept
+{
+    int tileSize = PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE;
+    bool zeroInvalidNormals = true;
+    const Point* rowNormals = normals + (row * _cols);
+    Sums* outputSums = _rowSums.data() + (row * _tileCols);
+
+    for(int tileCol = 0; tileCol < _tileCols; ++tileCol)
+    {
+        int firstCol = tileCol * tileSize;
+        int lastCol = std::min(firstCol + tileSize, _cols);
+        Sums tileSums = { { 0 } };
+
+        for(int col = firstCol; col < lastCol; ++col)
+        {
+            const Point& normal = rowNormals[col];
+
+            if(addNormal(normal, tileSums))
+            {
+                if(normal.aux <= 0 && (normal.x < 0 || normal.x > 0 || normal.y < 0 || normal.y > 0 ||
+                                       normal.z < 0 || normal.z > 0))
+                {
+                    zeroInvalidNormals = false;
+                }
+            }
+            else
+            {
+                zeroInvalidNormals = false;
+            }
+        }
+
+        outputSums[tileCol] = tileSums;
+    }
+
+    _rowZeroInvalidNormals[std::size_t(row)] = zeroInvalidNormals;
+}
+
+void NormalStatistics::finish(ThreadPool& threadPool)
+{
+    int tileSize = PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE;
+    int sumsCols = _tileCols + 1;
+    _zeroInvalidNormals = std::all_of(_rowZeroInvalidNormals.begin(), _rowZeroInvalidNormals.end(),
+                                      [](unsigned char zeroInvalidNormals) { return zeroInvalidNormals != 0; });
+
+    // Accumulate the rows of each tile and then each row of tiles horizontally:
+
+    int chunks = getParallelChunks(std::size_t(_rows * _tileCols), PCPS_CPU_SPLITTER_MIN_POINTS_PER_THREAD,
+                                   threadPool.getThreads());
+
+    parallelChunks(threadPool, std::size_t(_tileRows), chunks, [&](int, std::size_t firstTileRow,
+                   std::size_t lastTileRow)
+    {
+        for(auto tileRow = int(firstTileRow); tileRow < int(lastTileRow); ++tileRow)
+        {
+            int firstRow = tileRow * tileSize;
+            int lastRow = std::min(firstRow + tileSize, _rows);
+            Sums* outputSums = _sums.data() + ((tileRow + 1) * sumsCols) + 1;
+            Sums rowSums = { { 0 } };
+
+            for(int tileCol = 0; tileCol < _tileCols; ++tileCol)
+            {
+                for(int row = firstRow; row < lastRow; ++row)
+                {
+                    const Sums& tileSums = _rowSums[std::size_t((row * _tileCols) + tileCol)];
+
+                    for(std::size_t channel = 0; channel < channels; ++channel)
+                    {
+                        rowSums[channel] += tileSums[channel];
+                    }
+                }
+
+                outputSums[tileCol] = rowSums;
+            }
+        }
+    });
+
+    // Accumulate each column of tiles vertically (there are few tiles, so it is not worth to parallelize it):
+
+    for(int tileRow = 1; tileRow < _tileRows; ++tileRow)
+    {
+        const Sums* upSums = _sums.data() + (tileRow * sumsCols) + 1;
+        Sums* outputSums = _sums.data() + ((tileRow + 1) * sumsCols) + 1;
+
+        for(int tileCol = 0; tileCol < _tileCols; ++tileCol)
+        {
+            const Sums& up = upSums[tileCol];
+            Sums& output = outputSums[tileCol];
+
+            for(std::size_t channel = 0; channel < channels; ++channel)
+            {
+                output[channel] += up[channel];
+            }
+        }
+    }
+}
+
+NormalStatistics::Sums NormalStatistics::getSums(const NormalRegion& normalRegion, const Point* normals) const noexcept
+{
+    int tileSize = PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE;
+    int firstCol = normalRegion.x;
+    int firstRow = normalRegion.y;
+    int lastCol = normalRegion.x + normalRegion.width;
+    int lastRow = normalRegion.y + normalRegion.height;
+
+    // Tiles fully covered by the region (the last tile of each axis can be smaller than the others):
+
+    int firstTileCol = (firstCol + tileSize - 1) / tileSize;
+    int firstTileRow = (firstRow + tileSize - 1) / tileSize;
+    int lastTileCol = lastCol == _cols ? _tileCols : lastCol / tileSize;
+    int lastTileRow = lastRow == _rows ? _tileRows : lastRow / tileSize;
+    Sums result = { { 0 } };
+
+    if(firstTileCol >= lastTileCol || firstTileRow >= lastTileRow)
+    {
+        _addSums(normals, firstCol, firstRow, lastCol, lastRow, result);
+        return result;
+    }
+
+    int sumsCols = _tileCols + 1;
+    const Sums& a = _sums[std::size_t((firstTileRow * sumsCols) + firstTileCol)];
+    const Sums& b = _sums[std::size_t((firstTileRow * sumsCols) + lastTileCol)];
+    const Sums& c = _sums[std::size_t((lastTileRow * sumsCols) + firstTileCol)];
+    const Sums& d = _sums[std::size_t((lastTileRow * sumsCols) + lastTileCol)];
+
+    for(std::size_t channel = 0; channel < channels; ++channel)
+    {
+        result[channel] = d[channel] - b[channel] - c[channel] + a[channel];
+    }
+
+    // Normals of the partially covered tiles:
+
+    int innerFirstCol = firstTileCol * tileSize;
+    int innerFirstRow = firstTileRow * tileSize;
+    int innerLastCol = std::min(lastTileCol * tileSize, _cols);
+    int innerLastRow = std::min(lastTileRow * tileSize, _rows);
+    _addSums(normals, firstCol, firstRow, lastCol, innerFirstRow, result);
+    _addSums(normals, firstCol, innerLastRow, lastCol, lastRow, result);
+    _addSums(normals, firstCol, innerFirstRow, innerFirstCol, innerLastRow, result);
+    _addSums(normals, innerLastCol, innerFirstRow, lastCol, innerLastRow, result);
+    return result;
+}
+
+void NormalStatistics::_addSums(const Point* normals, int firstCol, int firstRow, int lastCol, int lastRow,
+                                Sums& sums) const noexcept
+{
+    for(int row = firstRow; row < lastRow; ++row)
+    {
+        const Point* rowNormals = normals + (row * _cols);
+
+        for(int col = firstCol; col < lastCol; ++col)
+        {
+            addNormal(rowNormals[col], sums);
+        }
+    }
+}
+
+}
@@ -0,0 +1,102 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_NORMAL_STATISTICS_H
+#define PCPS_NORMAL_STATISTICS_H
+
+#include <array>
+#include <vector>
+
+namespace pcps
+{
+
+class Point;
+class Cloud;
+class NormalRegion;
+
+///@cond INTERNAL
+class ThreadPool;
+
+/**
+ * @brief Summed-area tables of the normal components and the valid normals count,
+ * which provide the sums of any normal region.
+ *
+ * Tables are tile-granular (PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE points per side), so they are much smaller
+ * than the normal cloud. The sums of the tiles fully covered by a region are retrieved in constant time,
+ * and only the normals of the partially covered tiles at the region borders are read.
+ *
+ * They can be built from a normal cloud, or row by row while the normals are being extracted.
+ */
+class NormalStatistics
+{
+
+public:
+    static constexpr std::size_t channels = 4;
+
+    using Sums = std::array<double, channels>;
+
+    /**
+     * @brief Builds the tables from the given normal cloud.
+     */
+    void build(const Cloud& normalCloud, ThreadPool& threadPool);
+
+    /**
+     * @brief Prepares the tables to be built row by row.
+     * @param cols Normal cloud width.
+     * @param rows Normal cloud height.
+     */
+    void reset(int cols, int rows);
+
+    /**
+     * @brief Accumulates the given row of normals horizontally.
+     *
+     * Different rows can be accumulated by different threads at the same time.
+     *
+     * @param normals Normal cloud points.
+     * @param row Row index.
+     */
+    void accumulateRow(const Point* normals, int row) noexcept;
+
+    /**
+     * @brief Accumulates all rows vertically once all of them have been accumulated horizontally.
+     */
+    void finish(ThreadPool& threadPool);
+
+    /**
+     * @brief Indicates if all invalid normals are zero and all normals are finite,
+     * as in the output of NormalExtractor.
+     */
+    bool hasZeroInvalidNormals() const noexcept
+    {
+        return _zeroInvalidNormals;
+    }
+
+    /**
+     * @brief Retrieves the sums of the normal components and the valid normals count of the given region.
+     * @param normalRegion Normal region.
+     * @param normals Points of the normal cloud from which the tables have been built.
+     */
+    Sums getSums(const NormalRegion& normalRegion, const Point* normals) const noexcept;
+
+private:
+    std::vector<Sums> _rowSums;
+    std::vector<Sums> _sums;
+    std::vector<unsigned char> _rowZeroInvalidNormals;
+    int _cols = 0;
+    int _rows = 0;
+    int _tileCols = 0;
+    int _tileRows = 0;
+    bool _zeroInvalidNormals = true;
+
+    void _addSums(const Point* normals, int firstCol, int firstRow, int lastCol, int lastRow,
+                  Sums& sums) const noexcept;
+};
+
+///@endcond
+
+}
+
+#endif
@@ -6,12 +6,95 @@
 
 #include "pcps_organizer.h"
 
+#include <cmath>
+#include <array>
+#include <algorithm>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
+#include "pcps_epsilon.h"
 
 namespace pcps
 {
 
+namespace
+{
+    /**
+     * @brief Diagonalizes a 3x3 symmetric matrix with the Jacobi eigenvalue algorithm.
+     * @param matrix Row-major symmetric matrix. Its diagonal stores the eigenvalues on return.
+     * @param eigenVectors Stores the eigenvectors as columns.
+     */
+    void diagonalize(std::array<double, 9>& matrix, std::array<double, 9>& eigenVectors) noexcept
+    {
+        eigenVectors = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+        for(int sweep = 0; sweep < 32; ++sweep)
+        {
+            double offDiagonal = (matrix[1] * matrix[1]) + (matrix[2] * matrix[2]) + (matrix[5] * matrix[5]);
+            double diagonal = (matrix[0] * matrix[0]) + (matrix[4] * matrix[4]) + (matrix[8] * matrix[8]);
+
+            if(offDiagonal <= 1e-24 * diagonal)
+            {
+                break;
+            }
+
+            for(int p = 0; p < 2; ++p)
+            {
+                for(int q = p + 1; q < 3; ++q)
+                {
+                    double apq = matrix[std::size_t((p * 3) + q)];
+
+                    if(std::abs(apq) <= 0)
+                    {
+                        continue;
+                    }
+
+                    double app = matrix[std::size_t((p * 3) + p)];
+                    double aqq = matrix[std::size_t((q * 3) + q)];
+                    double theta = (aqq - app) / (2 * apq);
+                    double t = 1 / (std::abs(theta) + std::sqrt((theta * theta) + 1));
+                    t = theta < 0 ? -t : t;
+
+                    double c = 1 / std::sqrt((t * t) + 1);
+                    double s = t * c;
+
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        double& akp = matrix[std::size_t((k * 3) + p)];
+                        double& akq = matrix[std::size_t((k * 3) + q)];
+                        double oldAkp = akp;
+                        akp = (c * oldAkp) - (s * akq);
+                        akq = (s * oldAkp) + (c * akq);
+                    }
+
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        double& apk = matrix[std::size_t((p * 3) + k)];
+                        double& aqk = matrix[std::size_t((q * 3) + k)];
+                        double oldApk = apk;
+                        apk = (c * oldApk) - (s * aqk);
+                        aqk = (s * oldApk) + (c * aqk);
+                    }
+
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        double& vkp = eigenVectors[std::size_t((k * 3) + p)];
+                        double& vkq = eigenVectors[std::size_t((k * 3) + q)];
+                        double oldVkp = vkp;
+                        vkp = (c * oldVkp) - (s * vkq);
+                        vkq = (s * oldVkp) + (c * vkq);
+                    }
+                }
+            }
+        }
+    }
+
+    Point getEigenVector(const std::array<double, 9>& eigenVectors, std::size_t column) noexcept
+    {
+        return Point{ float(eigenVectors[column]), float(eigenVectors[3 + column]), float(eigenVectors[6 + column]),
+                      0 };
+    }
+}
+
 void Organizer::disorganize(const Cloud& inputPointCloud, Cloud& outputPointCloud)
 {
     if(! inputPointCloud.isOrganized())
@@ -72,4 +155,205 @@ bool Organizer::setMaximumHeight(int maximumHeight) noexcept
     return true;
 }
 
+float Organizer::getSpacingPercentile() const noexcept
+{
+    return _spacingPercentile;
+}
+
+bool Organizer::setSpacingPercentile(float spacingPercentile) noexcept
+{
+    if(! (spacingPercentile >= 0 && spacingPercentile <= 1))
+    {
+        PCPS_LOG_ERROR << "Invalid spacingPercentile: " << spacingPercentile << std::endl;
+        return false;
+    }
+
+    _spacingPercentile = spacingPercentile;
+    return true;
+}
+
+const Sensor& Organizer::getSensor() const noexcept
+{
+    return _sensor;
+}
+
+bool Organizer::setSensor(const Sensor& sensor) noexcept
+{
+    if(! sensor.isValid())
+    {
+        PCPS_LOG_ERROR << "Invalid sensor" << std::endl;
+        return false;
+    }
+
+    _sensor = sensor;
+    return true;
+}
+
+bool Organizer::_getSpacingBins(float distanceX, float distanceY, std::size_t numPoints, int& binCols, int& binRows,
+                                float& binSizeInv) noexcept
+{
+    if(numPoints < 2 || (distanceX <= 0 && distanceY <= 0))
+    {
+        return false;
+    }
+
+    // Retrieve a bin size which gives less bins than points, so at least two points share a bin
+    // and the closest pair of points is never more than two bins away:
+
+    auto binDistanceX = double(distanceX);
+    auto binDistanceY = double(distanceY);
+    double binSize;
+
+    if(distanceX > 0 && distanceY > 0)
+    {
+        binSize = std::sqrt((binDistanceX * binDistanceY) / numPoints);
+    }
+    else
+    {
+        binSize = std::max(binDistanceX, binDistanceY) / numPoints;
+    }
+
+    double maxBins = double(numPoints) - 1;
+    double numBinsX = std::floor(binDistanceX / binSize) + 1;
+    double numBinsY = std::floor(binDistanceY / binSize) + 1;
+
+    while(numBinsX * numBinsY > maxBins)
+    {
+        binSize *= 1.25;
+        numBinsX = std::floor(binDistanceX / binSize) + 1;
+        numBinsY = std::floor(binDistanceY / binSize) + 1;
+    }
+
+    binCols = int(numBinsX);
+    binRows = int(numBinsY);
+    binSizeInv = float(1 / binSize);
+    return true;
+}
+
+bool Organizer::_getPlaneAxes(const std::vector<Point>& points, Point& xAxis, Point& yAxis, Point& zAxis) const
+{
+    if(_sensor.projection == Sensor::Projection::PLANE)
+    {
+        xAxis = _sensor.xAxis;
+        yAxis = _sensor.yAxis;
+        zAxis = xAxis.cross(yAxis);
+        return ! xAxis.isEqualTo(Point{ 1, 0, 0, 0 }, epsilon) || ! yAxis.isEqualTo(Point{ 0, 1, 0, 0 }, epsilon);
+    }
+
+    xAxis = Point{ 1, 0, 0, 0 };
+    yAxis = Point{ 0, 1, 0, 0 };
+    zAxis = Point{ 0, 0, 1, 0 };
+
+    // Retrieve the covariance matrix of the finite points, relative to the first one for numerical stability:
+
+    const Point* firstPoint = nullptr;
+    std::array<double, 9> accum = { 0 };
+    std::size_t numFinitePoints = 0;
+
+    for(const Point& point : points)
+    {
+        if(point.isFinite())
+        {
+            if(! firstPoint)
+            {
+                firstPoint = &point;
+            }
+
+            double x = double(point.x) - double(firstPoint->x);
+            double y = double(point.y) - double(firstPoint->y);
+            double z = double(point.z) - double(firstPoint->z);
+            accum[0] += x * x;
+            accum[1] += x * y;
+            accum[2] += x * z;
+            accum[3] += y * y;
+            accum[4] += y * z;
+            accum[5] += z * z;
+            accum[6] += x;
+            accum[7] += y;
+            accum[8] += z;
+            ++numFinitePoints;
+        }
+    }
+
+    if(numFinitePoints < 3)
+    {
+        return false;
+    }
+
+    for(double& accumValue : accum)
+    {
+        accumValue /= numFinitePoints;
+    }
+
+    std::array<double, 9> covarianceMatrix;
+    covarianceMatrix[0] = accum[0] - (accum[6] * accum[6]);
+    covarianceMatrix[1] = accum[1] - (accum[6] * accum[7]);
+    covarianceMatrix[2] = accum[2] - (accum[6] * accum[8]);
+    covarianceMatrix[4] = accum[3] - (accum[7] * accum[7]);
+    covarianceMatrix[5] = accum[4] - (accum[7] * accum[8]);
+    covarianceMatrix[8] = accum[5] - (accum[8] * accum[8]);
+    covarianceMatrix[3] = covarianceMatrix[1];
+    covarianceMatrix[6] = covarianceMatrix[2];
+    covarianceMatrix[7] = covarianceMatrix[5];
+
+    // The plane normal is the eigenvector of the smallest eigenvalue,
+    // and the x axis is the eigenvector of the largest one:
+
+    std::array<double, 9> eigenVectors;
+    diagonalize(covarianceMatrix, eigenVectors);
+
+    std::array<std::size_t, 3> order = { 0, 1, 2 };
+    std::sort(order.begin(), order.end(), [&covarianceMatrix](std::size_t a, std::size_t b)
+    {
+        return covarianceMatrix[a * 4] < covarianceMatrix[b * 4];
+    });
+
+    if(covarianceMatrix[order[2] * 4] <= 0)
+    {
+        return false;
+    }
+
+    zAxis = getEigenVector(eigenVectors, order[0]);
+    xAxis = getEigenVector(eigenVectors, order[2]);
+
+    // Make the axes orientation deterministic, with the normal pointing up:
+
+    if(zAxis.z < 0)
+    {
+        zAxis *= -1;
+    }
+
+    float maxXValue = std::abs(xAxis.x) >= std::abs(xAxis.y) ?
+                (std::abs(xAxis.x) >= std::abs(xAxis.z) ? xAxis.x : xAxis.z) :
+                (std::abs(xAxis.y) >= std::abs(xAxis.z) ? xAxis.y : xAxis.z);
+
+    if(maxXValue < 0)
+    {
+        xAxis *= -1;
+    }
+
+    yAxis = zAxis.cross(xAxis);
+    return true;
+}
+
+void Organizer::_getOutputSize(float distanceX, float distanceY, float minDistance, int& width, int& height,
+                               float& cellSizeInv) const noexcept
+{
+    if(minDistance > epsilon)
+    {
+        width = std::min(int(distanceX / minDistance) + 1, _maximumWidth);
+        height = std::min(int(distanceY / minDistance) + 1, _maximumHeight);
+    }
+    else
+    {
+        width = _maximumWidth;
+        height = _maximumHeight;
+    }
+
+    float cellSize = std::max(distanceX / width, distanceY / height);
+    cellSizeInv = 1 / cellSize;
+    width = int(distanceX * cellSizeInv) + 1;
+    height = int(distanceY * cellSizeInv) + 1;
+}
+
 }
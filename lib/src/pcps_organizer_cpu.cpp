@@ -7,15 +7,385 @@
 #include "pcps_organizer.h"
 
 #include <cmath>
+#include <array>
 #include <limits>
+#include <algorithm>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
-#include "pcps_epsilon.h"
+#include "pcps_context.h"
+#include "pcps_tweak_me.h"
+#include "pcps_device_cloud.h"
+#include "pcps_cpu_parallel.h"
 
 namespace pcps
 {
 
-bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud, Context&) const
+namespace
+{
+    using BoundingBox = std::array<float, 4>;
+
+    BoundingBox getBoundingBox(const std::vector<Point>& points, ThreadPool& threadPool)
+    {
+        float maxValue = std::numeric_limits<float>::max();
+        int chunks = getParallelChunks(points.size(), PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD,
+                                       threadPool.getThreads());
+        std::vector<BoundingBox> boundingBoxes(std::size_t(chunks), { maxValue, maxValue, -maxValue, -maxValue });
+
+        parallelChunks(threadPool, points.size(), chunks, [&](int chunk, std::size_t begin, std::size_t end)
+        {
+            BoundingBox& boundingBox = boundingBoxes[std::size_t(chunk)];
+
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                const Point& point = points[index];
+                boundingBox[0] = std::min(boundingBox[0], point.x);
+                boundingBox[1] = std::min(boundingBox[1], point.y);
+                boundingBox[2] = std::max(boundingBox[2], point.x);
+                boundingBox[3] = std::max(boundingBox[3], point.y);
+            }
+        });
+
+        BoundingBox result = boundingBoxes[0];
+
+        for(std::size_t chunk = 1; chunk < boundingBoxes.size(); ++chunk)
+        {
+            const BoundingBox& boundingBox = boundingBoxes[chunk];
+            result[0] = std::min(result[0], boundingBox[0]);
+            result[1] = std::min(result[1], boundingBox[1]);
+            result[2] = std::max(result[2], boundingBox[2]);
+            result[3] = std::max(result[3], boundingBox[3]);
+        }
+
+        return result;
+    }
+
+    float getSpacing(const std::vector<Point>& points, float minX, float minY, int binCols, int binRows,
+                     float binSizeInv, float spacingPercentile, ThreadPool& threadPool)
+    {
+        std::size_t numPoints = points.size();
+        int chunks = getParallelChunks(numPoints, PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD, threadPool.getThreads());
+
+        // Sort point indices by bin (counting sort):
+
+        std::vector<int> pointBins(numPoints, -1);
+        std::vector<int> binStarts(std::size_t(binCols * binRows) + 1, 0);
+
+        parallelChunks(threadPool, numPoints, chunks, [&](int, std::size_t begin, std::size_t end)
+        {
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                const Point& point = points[index];
+
+                if(std::isfinite(point.x) && std::isfinite(point.y))
+                {
+                    int col = std::min(int((point.x - minX) * binSizeInv), binCols - 1);
+                    int row = std::min(int((point.y - minY) * binSizeInv), binRows - 1);
+                    pointBins[index] = (row * binCols) + col;
+                }
+            }
+        });
+
+        for(int bin : pointBins)
+        {
+            if(bin >= 0)
+            {
+                ++binStarts[std::size_t(bin) + 1];
+            }
+        }
+
+        for(std::size_t bin = 1; bin < binStarts.size(); ++bin)
+        {
+            binStarts[bin] += binStarts[bin - 1];
+        }
+
+        auto numBinnedPoints = std::size_t(binStarts.back());
+
+        if(! numBinnedPoints)
+        {
+            return 0;
+        }
+
+        std::vector<int> binPoints(numBinnedPoints);
+        std::vector<int> binEnds(binStarts.begin(), binStarts.end() - 1);
+
+        for(std::size_t index = 0; index < numPoints; ++index)
+        {
+            int bin = pointBins[index];
+
+            if(bin >= 0)
+            {
+                int& binEnd = binEnds[std::size_t(bin)];
+                binPoints[std::size_t(binEnd)] = int(index);
+                ++binEnd;
+            }
+        }
+
+        // Retrieve the squared distance from each point to its nearest neighbor in the surrounding 5x5 bins
+        // (points without bin or without neighbor keep the maximum distance):
+
+        float maxValue = std::numeric_limits<float>::max();
+        std::vector<float> distances(numPoints, maxValue);
+
+        parallelChunks(threadPool, numPoints, chunks, [&](int, std::size_t begin, std::size_t end)
+        {
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                int bin = pointBins[index];
+
+                if(bin < 0)
+                {
+                    continue;
+                }
+
+                const Point& point = points[index];
+                int col = bin % binCols;
+                int row = bin / binCols;
+                float minDistance = maxValue;
+
+                for(int otherRow = std::max(row - 2, 0), lastRow = std::min(row + 2, binRows - 1);
+                    otherRow <= lastRow; ++otherRow)
+                {
+                    int firstBin = (otherRow * binCols) + std::max(col - 2, 0);
+                    int lastBin = (otherRow * binCols) + std::min(col + 2, binCols - 1);
+
+                    for(int otherIndex = binStarts[std::size_t(firstBin)],
+                        lastIndex = binStarts[std::size_t(lastBin) + 1]; otherIndex < lastIndex; ++otherIndex)
+                    {
+                        auto otherPointIndex = std::size_t(binPoints[std::size_t(otherIndex)]);
+
+                        if(otherPointIndex != index)
+                        {
+                            const Point& otherPoint = points[otherPointIndex];
+                            float distanceX = point.x - otherPoint.x;
+                            float distanceY = point.y - otherPoint.y;
+                            float distance = (distanceX * distanceX) + (distanceY * distanceY);
+                            minDistance = std::min(distance, minDistance);
+                        }
+                    }
+                }
+
+                distances[index] = minDistance;
+            }
+        });
+
+        // Retrieve the requested percentile of the points with neighbor, so isolated points don't collapse the grid:
+
+        auto distancesEnd = std::remove_if(distances.begin(), distances.end(), [maxValue](float distance)
+        {
+            return distance >= maxValue;
+        });
+        auto numNeighborDistances = std::size_t(distancesEnd - distances.begin());
+
+        if(! numNeighborDistances)
+        {
+            return 0;
+        }
+
+        auto nth = distances.begin() + std::ptrdiff_t(spacingPercentile * (numNeighborDistances - 1));
+        std::nth_element(distances.begin(), nth, distancesEnd);
+        return std::sqrt(*nth);
+    }
+
+    class PlaneProjector
+    {
+
+    public:
+        float minX;
+        float minY;
+        float cellSizeInv;
+        int width;
+
+        int getCell(const Point& point) const noexcept
+        {
+            if(! std::isfinite(point.x) || ! std::isfinite(point.y))
+            {
+                return -1;
+            }
+
+            auto col = int((point.x - minX) * cellSizeInv);
+            auto row = int((point.y - minY) * cellSizeInv);
+            return (row * width) + col;
+        }
+
+        float getDepth(const Point& point) const noexcept
+        {
+            return -point.z;
+        }
+    };
+
+    class RotatedPlaneProjector
+    {
+
+    public:
+        Point xAxis;
+        Point yAxis;
+        Point zAxis;
+        float minX;
+        float minY;
+        float cellSizeInv;
+        int width;
+
+        int getCell(const Point& point) const noexcept
+        {
+            float x = point.dot(xAxis);
+            float y = point.dot(yAxis);
+
+            if(! std::isfinite(x) || ! std::isfinite(y))
+            {
+                return -1;
+            }
+
+            auto col = int((x - minX) * cellSizeInv);
+            auto row = int((y - minY) * cellSizeInv);
+            return (row * width) + col;
+        }
+
+        float getDepth(const Point& point) const noexcept
+        {
+            return -point.dot(zAxis);
+        }
+    };
+
+    class SensorProjector
+    {
+
+    public:
+        const Sensor& sensor;
+        const Point& origin;
+
+        int getCell(const Point& point) const noexcept
+        {
+            return sensor.getCellIndex(point, origin);
+        }
+
+        float getDepth(const Point& point) const noexcept
+        {
+            return sensor.getDepth(point, origin);
+        }
+    };
+
+    template<class Projector>
+    inline void fillPoint(const Point& inputPoint, const Projector& projector, Point& outputPoint) noexcept
+    {
+        float outputDepth = projector.getDepth(outputPoint);
+
+        if(! std::isfinite(outputDepth) || projector.getDepth(inputPoint) < outputDepth)
+        {
+            outputPoint = inputPoint;
+        }
+    }
+
+    template<class Projector>
+    void fillPoints(const std::vector<Point>& inputPoints, const Projector& projector, int width, int height,
+                    ThreadPool& threadPool, std::vector<Point>& outputPoints)
+    {
+        std::size_t numPoints = inputPoints.size();
+        auto numCells = std::size_t(width * height);
+        int chunks = getParallelChunks(numPoints, PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD, threadPool.getThreads());
+        int bands = std::min(chunks, height);
+
+        if(bands <= 1)
+        {
+            outputPoints.assign(numCells, Point::invalid());
+
+            for(const Point& inputPoint : inputPoints)
+            {
+                int cell = projector.getCell(inputPoint);
+
+                if(cell >= 0)
+                {
+                    fillPoint(inputPoint, projector, outputPoints[std::size_t(cell)]);
+                }
+            }
+
+            return;
+        }
+
+        // Each thread writes the cells of its own band of rows, so points are binned by band first.
+        // The binning is stable to keep the input order inside each band, which makes the output
+        // bit-identical to the serial path:
+
+        std::vector<int> pointCells(numPoints);
+        std::vector<int> bandCounts(std::size_t(chunks * bands), 0);
+
+        parallelChunks(threadPool, numPoints, chunks, [&](int chunk, std::size_t begin, std::size_t end)
+        {
+            int* chunkBandCounts = bandCounts.data() + (chunk * bands);
+
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                int cell = projector.getCell(inputPoints[index]);
+                pointCells[index] = cell;
+
+                if(cell >= 0)
+                {
+                    int row = cell / width;
+                    ++chunkBandCounts[(row * bands) / height];
+                }
+            }
+        });
+
+        std::vector<int> bandStarts(std::size_t(bands) + 1);
+        int bandOffset = 0;
+
+        for(int band = 0; band < bands; ++band)
+        {
+            bandStarts[std::size_t(band)] = bandOffset;
+
+            for(int chunk = 0; chunk < chunks; ++chunk)
+            {
+                int& bandCount = bandCounts[std::size_t((chunk * bands) + band)];
+                int count = bandCount;
+                bandCount = bandOffset;
+                bandOffset += count;
+            }
+        }
+
+        bandStarts.back() = bandOffset;
+
+        std::vector<int> bandPoints(std::size_t(bandStarts.back()));
+
+        parallelChunks(threadPool, numPoints, chunks, [&](int chunk, std::size_t begin, std::size_t end)
+        {
+            int* chunkBandOffsets = bandCounts.data() + (chunk * bands);
+
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                int cell = pointCells[index];
+
+                if(cell >= 0)
+                {
+                    int row = cell / width;
+                    int& pointOffset = chunkBandOffsets[(row * bands) / height];
+                    bandPoints[std::size_t(pointOffset)] = int(index);
+                    ++pointOffset;
+                }
+            }
+        });
+
+        // Resolve the lowest depth of each cell without locks, since each band is owned by only one thread:
+
+        outputPoints.resize(numCells);
+
+        parallelChunks(threadPool, std::size_t(bands), bands, [&](int band, std::size_t, std::size_t)
+        {
+            int firstRow = ((band * height) + bands - 1) / bands;
+            int lastRow = (((band + 1) * height) + bands - 1) / bands;
+            auto firstCell = outputPoints.begin() + (firstRow * width);
+            auto lastCell = outputPoints.begin() + (lastRow * width);
+            std::fill(firstCell, lastCell, Point::invalid());
+
+            for(int index = bandStarts[std::size_t(band)], last = bandStarts[std::size_t(band) + 1]; index < last;
+                ++index)
+            {
+                auto pointIndex = std::size_t(bandPoints[std::size_t(index)]);
+                fillPoint(inputPoints[pointIndex], projector, outputPoints[std::size_t(pointCells[pointIndex])]);
+            }
+        });
+    }
+}
+
+bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud, Context& context) const
 {
     if(inputPointCloud.isOrganized())
     {
@@ -32,6 +402,22 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
         return false;
     }
 
+    std::shared_ptr<ThreadPool> sharedThreadPool = context.getThreadPool();
+    ThreadPool& threadPool = *sharedThreadPool;
+    outputPointCloud.sensorOrigin = inputPointCloud.sensorOrigin;
+
+    if(_sensor.hasFixedSize())
+    {
+        // Output size is fixed by the sensor:
+
+        outputPointCloud.width = _sensor.width;
+        outputPointCloud.height = _sensor.height;
+
+        SensorProjector projector = { _sensor, inputPointCloud.sensorOrigin };
+        fillPoints(inputPoints, projector, _sensor.width, _sensor.height, threadPool, outputPointCloud.points);
+        return true;
+    }
+
     if(numPoints == 1)
     {
         inputPointCloud.copyTo(outputPointCloud);
@@ -40,79 +426,83 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
         return true;
     }
 
-    // Retrieve bounding box and minimum distance between points:
+    // Project points onto the plane frame if it is not the XY one:
 
-    float maxValue = std::numeric_limits<float>::max();
-    float minX = maxValue;
-    float minY = maxValue;
-    float maxX = -maxValue;
-    float maxY = -maxValue;
-    float minDistance = maxValue;
+    Point xAxis, yAxis, zAxis;
+    bool rotated = _getPlaneAxes(inputPoints, xAxis, yAxis, zAxis);
+    std::vector<Point> rotatedPoints;
 
-    for(std::size_t index = 0; index < numPoints; ++index)
+    if(rotated)
     {
-        const Point& point = inputPoints[index];
-        minX = std::min(minX, point.x);
-        maxX = std::max(maxX, point.x);
-        minY = std::min(minY, point.y);
-        maxY = std::max(maxY, point.y);
+        rotatedPoints.resize(numPoints);
 
-        for(std::size_t otherIndex = index + 1; otherIndex < numPoints; ++otherIndex)
+        int chunks = getParallelChunks(numPoints, PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD, threadPool.getThreads());
+        parallelChunks(threadPool, numPoints, chunks, [&](int, std::size_t begin, std::size_t end)
         {
-            const Point& otherPoint = inputPoints[otherIndex];
-            float distanceX = point.x - otherPoint.x;
-            float distanceY = point.y - otherPoint.y;
-            float distance = (distanceX * distanceX) + (distanceY * distanceY);
-            minDistance = std::min(distance, minDistance);
-        }
+            for(std::size_t index = begin; index < end; ++index)
+            {
+                const Point& inputPoint = inputPoints[index];
+                rotatedPoints[index] = Point{ inputPoint.dot(xAxis), inputPoint.dot(yAxis), inputPoint.dot(zAxis), 0 };
+            }
+        });
     }
 
-    // Retrieve output cloud size and cell size:
+    const std::vector<Point>& planePoints = rotated ? rotatedPoints : inputPoints;
 
-    float distanceX = maxX - minX;
-    float distanceY = maxY - minY;
-    int width, height;
-    minDistance = std::sqrt(minDistance);
+    // Retrieve bounding box:
 
-    if(minDistance > epsilon)
-    {
-        width = std::min(int(distanceX / minDistance) + 1, _maximumWidth);
-        height = std::min(int(distanceY / minDistance) + 1, _maximumHeight);
-    }
-    else
+    BoundingBox boundingBox = getBoundingBox(planePoints, threadPool);
+    float minX = boundingBox[0];
+    float minY = boundingBox[1];
+    float distanceX = boundingBox[2] - minX;
+    float distanceY = boundingBox[3] - minY;
+
+    // Retrieve distance between points:
+
+    float minDistance = 0;
+    int binCols, binRows;
+    float binSizeInv;
+
+    if(_getSpacingBins(distanceX, distanceY, numPoints, binCols, binRows, binSizeInv))
     {
-        width = _maximumWidth;
-        height = _maximumHeight;
+        minDistance = getSpacing(planePoints, minX, minY, binCols, binRows, binSizeInv, _spacingPercentile,
+                                 threadPool);
     }
 
-    float cellSize = std::max(distanceX / width, distanceY / height);
-    float cellSizeInv = 1 / cellSize;
-    width = int(distanceX * cellSizeInv) + 1;
-    height = int(distanceY * cellSizeInv) + 1;
+    // Retrieve output cloud size and cell size:
+
+    int width, height;
+    float cellSizeInv;
+    _getOutputSize(distanceX, distanceY, minDistance, width, height, cellSizeInv);
+
     outputPointCloud.width = width;
     outputPointCloud.height = height;
-    outputPointCloud.sensorOrigin = inputPointCloud.sensorOrigin;
 
     // Fill output cloud points vector:
 
-    std::vector<Point>& outputPoints = outputPointCloud.points;
-    outputPoints.resize(std::size_t(width * height), Point::invalid());
-
-    for(const Point& inputPoint : inputPoints)
+    if(rotated)
     {
-        float relativeX = inputPoint.x - minX;
-        float relativeY = inputPoint.y - minY;
-        auto col = int(relativeX * cellSizeInv);
-        auto row = int(relativeY * cellSizeInv);
-        int index = (row * width) + col;
-        Point& outputPoint = outputPoints[std::size_t(index)];
+        RotatedPlaneProjector projector = { xAxis, yAxis, zAxis, minX, minY, cellSizeInv, width };
+        fillPoints(inputPoints, projector, width, height, threadPool, outputPointCloud.points);
+    }
+    else
+    {
+        PlaneProjector projector = { minX, minY, cellSizeInv, width };
+        fillPoints(inputPoints, projector, width, height, threadPool, outputPointCloud.points);
+    }
 
-        if(! std::isfinite(outputPoint.z) || inputPoint.z > outputPoint.z)
-        {
-            outputPoint = inputPoint;
-        }
+    return true;
+}
+
+bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
+                         std::unique_ptr<DeviceCloud>& outputPointDeviceCloud, Context& context) const
+{
+    if(! organize(inputPointCloud, outputPointCloud, context))
+    {
+        return false;
     }
 
+    outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
     return true;
 }
 
@@ -11,6 +11,7 @@
 #include "pcps_logger.h"
 #include "pcps_context.h"
 #include "pcps_epsilon.h"
+#include "pcps_device_cloud.h"
 #include "pcps_thrust_organizer.h"
 
 namespace pcps
@@ -33,6 +34,36 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
         return false;
     }
 
+    if(_sensor.hasFixedSize())
+    {
+        // Output size is fixed by the sensor, so points are projected in a single pass:
+
+        const Point& sensorOrigin = inputPointCloud.sensorOrigin;
+        std::vector<Point>& outputPoints = outputPointCloud.points;
+        outputPointCloud.width = _sensor.width;
+        outputPointCloud.height = _sensor.height;
+        outputPointCloud.sensorOrigin = sensorOrigin;
+        outputPoints.assign(std::size_t(_sensor.width * _sensor.height), Point::invalid());
+
+        for(const Point& inputPoint : inputPoints)
+        {
+            int outputPointIndex = _sensor.getCellIndex(inputPoint, sensorOrigin);
+
+            if(outputPointIndex >= 0)
+            {
+                Point& outputPoint = outputPoints[std::size_t(outputPointIndex)];
+                float outputDepth = _sensor.getDepth(outputPoint, sensorOrigin);
+
+                if(! std::isfinite(outputDepth) || _sensor.getDepth(inputPoint, sensorOrigin) < outputDepth)
+                {
+                    outputPoint = inputPoint;
+                }
+            }
+        }
+
+        return true;
+    }
+
     if(numPoints == 1)
     {
         inputPointCloud.copyTo(outputPointCloud);
@@ -41,25 +72,39 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
         return true;
     }
 
+    // Project points onto the plane frame if it is not the XY one:
+
+    Point xAxis, yAxis, zAxis;
+    bool rotated = _getPlaneAxes(inputPoints, xAxis, yAxis, zAxis);
     thrust::host_vector<float2> points2D(numPoints);
 
     for(std::size_t index = 0; index < numPoints; ++index)
     {
         const Point& inputPoint = inputPoints[index];
         float2& outputPoint = points2D[index];
-        outputPoint.x = inputPoint.x;
-        outputPoint.y = inputPoint.y;
+
+        if(rotated)
+        {
+            outputPoint.x = inputPoint.dot(xAxis);
+            outputPoint.y = inputPoint.dot(yAxis);
+        }
+        else
+        {
+            outputPoint.x = inputPoint.x;
+            outputPoint.y = inputPoint.y;
+        }
     }
 
     thrust::host_vector<int> indices;
     int width, height;
-    pcps_thrust::organize(points2D, _maximumWidth, _maximumHeight, epsilon, width, height, indices, *context.allocator);
+    pcps_thrust::organize(points2D, _maximumWidth, _maximumHeight, _spacingPercentile, epsilon, width, height, indices,
+                          *context.allocator);
 
     std::vector<Point>& outputPoints = outputPointCloud.points;
     outputPointCloud.width = width;
     outputPointCloud.height = height;
     outputPointCloud.sensorOrigin = inputPointCloud.sensorOrigin;
-    outputPoints.resize(std::size_t(width * height), Point::invalid());
+    outputPoints.assign(std::size_t(width * height), Point::invalid());
 
     for(std::size_t index = 0; index < numPoints; ++index)
     {
@@ -67,7 +112,16 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
         int outputPointIndex = indices[index];
         Point& outputPoint = outputPoints[std::size_t(outputPointIndex)];
 
-        if(! std::isfinite(outputPoint.z) || inputPoint.z > outputPoint.z)
+        if(rotated)
+        {
+            float outputHeight = outputPoint.dot(zAxis);
+
+            if(! std::isfinite(outputHeight) || inputPoint.dot(zAxis) > outputHeight)
+            {
+                outputPoint = inputPoint;
+            }
+        }
+        else if(! std::isfinite(outputPoint.z) || inputPoint.z > outputPoint.z)
         {
             outputPoint = inputPoint;
         }
@@ -76,4 +130,16 @@ bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
     return true;
 }
 
+bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
+                         std::unique_ptr<DeviceCloud>& outputPointDeviceCloud, Context& context) const
+{
+    if(! organize(inputPointCloud, outputPointCloud, context))
+    {
+        return false;
+    }
+
+    outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
+    return true;
+}
+
 }
@@ -6,222 +6,538 @@
 
 #include "pcps_organizer.h"
 
+#include <cmath>
+#include <array>
+#include <limits>
 #include <algorithm>
 #include "pcps_cloud.h"
 #include "pcps_logger.h"
 #include "pcps_context.h"
-#include "pcps_epsilon.h"
-#include "pcps_boost_compute.h"
+#include "pcps_device_cloud.h"
+#include "pcps_device_buffer_pool.h"
 
 namespace bpc = boost::compute;
+using DeviceView = pcps::DeviceBuffer<bpc::float4_>;
 
 namespace pcps
 {
 
-bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud, Context& context) const
+namespace
 {
-    if(inputPointCloud.isOrganized())
+    static_assert(sizeof(Point) == sizeof(bpc::float4_), "");
+
+    bool getBoundingBox(const DeviceView& devicePoints, bpc::float4_& boundingBox, Context& context)
     {
-        inputPointCloud.copyTo(outputPointCloud);
-        return true;
-    }
+        BOOST_COMPUTE_FUNCTION(bpc::float4_, minMaxTransform, (bpc::float4_ point),
+        {
+            return (float4)(point.x, point.y, point.x, point.y);
+        });
 
-    const std::vector<Point>& inputPoints = inputPointCloud.points;
-    std::size_t numPoints = inputPoints.size();
+        // fmin and fmax ignore NaN coordinates:
 
-    if(! numPoints)
-    {
-        PCPS_LOG_ERROR << "Input cloud has no points" << std::endl;
-        return false;
-    }
+        BOOST_COMPUTE_FUNCTION(bpc::float4_, minMaxReduce, (bpc::float4_ a, bpc::float4_ b),
+        {
+            return (float4)(fmin(a.x, b.x), fmin(a.y, b.y), fmax(a.z, b.z), fmax(a.w, b.w));
+        });
+
+        try
+        {
+            bpc::transform_reduce(devicePoints.begin(), devicePoints.end(), &boundingBox, minMaxTransform,
+                                  minMaxReduce, *context.queue);
+        }
+        catch(const bpc::program_build_failure& programBuildFailure)
+        {
+            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
+            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+            return false;
+        }
 
-    if(numPoints == 1)
-    {
-        inputPointCloud.copyTo(outputPointCloud);
-        outputPointCloud.width = 1;
-        outputPointCloud.height = 1;
         return true;
     }
 
-    // Retrieve bounding box:
+    bool getSpacing(const DeviceView& devicePoints, float minX, float minY, int binCols, int binRows,
+                    float binSizeInv, float spacingPercentile, float& spacing, Context& context)
+    {
+        bpc::command_queue& queue = *context.queue;
+        std::size_t numPoints = devicePoints.size();
+        std::size_t numBins = std::size_t(binCols * binRows);
+        DeviceBufferScope deviceBuffers(context.getDeviceBufferPool(), queue);
+
+        std::array<int, 2> intArgs = { binCols, binRows };
+        DeviceBuffer<int> deviceIntArgs = deviceBuffers.upload(intArgs.data(), intArgs.size());
+        std::array<float, 3> floatArgs = { minX, minY, binSizeInv };
+        DeviceBuffer<float> deviceFloatArgs = deviceBuffers.upload(floatArgs.data(), floatArgs.size());
+
+        DeviceBuffer<int> pointBins = deviceBuffers.acquire<int>(numPoints);
+        DeviceBuffer<int> binCounts = deviceBuffers.acquire<int>(numBins + 1);
+        DeviceBuffer<int> binStarts = deviceBuffers.acquire<int>(numBins + 1);
+        DeviceBuffer<int> binEnds = deviceBuffers.acquire<int>(numBins + 1);
+        DeviceBuffer<int> binPoints = deviceBuffers.acquire<int>(numPoints);
+        DeviceBuffer<float> distances = deviceBuffers.acquire<float>(numPoints);
+
+        // Count the points of each bin:
+
+        BOOST_COMPUTE_CLOSURE(void, countBins, (int index),
+                              (devicePoints, deviceIntArgs, deviceFloatArgs, pointBins, binCounts),
+        {
+            int binCols = deviceIntArgs[0];
+            int binRows = deviceIntArgs[1];
+            float minX = deviceFloatArgs[0];
+            float minY = deviceFloatArgs[1];
+            float binSizeInv = deviceFloatArgs[2];
+            float4 point = devicePoints[index];
+            int bin = -1;
+
+            if(isfinite(point.x) && isfinite(point.y))
+            {
+                int col = min((int)((point.x - minX) * binSizeInv), binCols - 1);
+                int row = min((int)((point.y - minY) * binSizeInv), binRows - 1);
+                bin = (row * binCols) + col;
+                atomic_inc(&binCounts[bin]);
+            }
 
-    std::vector<bpc::float2_> points2D(numPoints);
+            pointBins[index] = bin;
+        });
 
-    for(std::size_t index = 0; index < numPoints; ++index)
-    {
-        const Point& inputPoint = inputPoints[index];
-        bpc::float2_& outputPoint = points2D[index];
-        outputPoint[0] = inputPoint.x;
-        outputPoint[1] = inputPoint.y;
-    }
+        // Sort point indices by bin:
 
-    bpc::mapped_view<bpc::float2_> devicePoints2D(points2D.data(), points2D.size(), *context.context);
+        BOOST_COMPUTE_CLOSURE(void, fillBins, (int index), (pointBins, binEnds, binPoints),
+        {
+            int bin = pointBins[index];
 
-    BOOST_COMPUTE_FUNCTION(bpc::float4_, minMaxTransform, (bpc::float2_ point),
-    {
-        return (float4)(point.x, point.y, point.x, point.y);
-    });
+            if(bin >= 0)
+            {
+                binPoints[atomic_inc(&binEnds[bin])] = index;
+            }
+        });
 
-    BOOST_COMPUTE_FUNCTION(bpc::float4_, minMaxReduce, (bpc::float4_ a, bpc::float4_ b),
-    {
-        float minX = a.x < b.x ? a.x : b.x;
-        float minY = a.y < b.y ? a.y : b.y;
-        float maxX = a.z > b.z ? a.z : b.z;
-        float maxY = a.w > b.w ? a.w : b.w;
-        return (float4)(minX, minY, maxX, maxY);
-    });
+        // Retrieve the squared distance from each point to its nearest neighbor in the surrounding 5x5 bins:
 
-    auto maxValue = std::numeric_limits<float>::max();
-    bpc::float4_ boundingBox = { maxValue, maxValue, -maxValue, -maxValue };
+        BOOST_COMPUTE_CLOSURE(float, distanceTransform, (int index),
+                              (devicePoints, deviceIntArgs, pointBins, binStarts, binPoints),
+        {
+            int binCols = deviceIntArgs[0];
+            int binRows = deviceIntArgs[1];
+            int bin = pointBins[index];
+            float minDistance = FLT_MAX;
 
-    try
-    {
-        bpc::transform_reduce(devicePoints2D.begin(), devicePoints2D.end(), &boundingBox, minMaxTransform,
-                              minMaxReduce, *context.queue);
+            if(bin >= 0)
+            {
+                float4 point = devicePoints[index];
+                int col = bin % binCols;
+                int row = bin / binCols;
+                int lastRow = min(row + 2, binRows - 1);
+
+                for(int otherRow = max(row - 2, 0); otherRow <= lastRow; ++otherRow)
+                {
+                    int firstBin = (otherRow * binCols) + max(col - 2, 0);
+                    int lastBin = (otherRow * binCols) + min(col + 2, binCols - 1);
+                    int lastIndex = binStarts[lastBin + 1];
+
+                    for(int otherIndex = binStarts[firstBin]; otherIndex < lastIndex; ++otherIndex)
+                    {
+                        int otherPointIndex = binPoints[otherIndex];
+
+                        if(otherPointIndex != index)
+                        {
+                            float4 otherPoint = devicePoints[otherPointIndex];
+                            float distanceX = point.x - otherPoint.x;
+                            float distanceY = point.y - otherPoint.y;
+                            float distance = (distanceX * distanceX) + (distanceY * distanceY);
+
+                            if(distance < minDistance)
+                            {
+                                minDistance = distance;
+                            }
+                        }
+                    }
+                }
+            }
+
+            return minDistance;
+        });
+
+        BOOST_COMPUTE_FUNCTION(float, distanceReduce, (float a, float b),
+        {
+            return a < b ? a : b;
+        });
+
+        BOOST_COMPUTE_FUNCTION(bool, hasNeighbor, (float distance),
+        {
+            return distance < FLT_MAX;
+        });
+
+        bpc::counting_iterator<int> first(0);
+        bpc::counting_iterator<int> last = first + long(numPoints);
+        float distance = std::numeric_limits<float>::max();
+
+        try
+        {
+            bpc::fill(binCounts.begin(), binCounts.end(), 0, queue);
+            bpc::for_each(first, last, countBins, queue);
+            bpc::exclusive_scan(binCounts.begin(), binCounts.end(), binStarts.begin(), queue);
+            bpc::copy(binStarts.begin(), binStarts.end(), binEnds.begin(), queue);
+            bpc::for_each(first, last, fillBins, queue);
+
+            if(spacingPercentile > 0)
+            {
+                // Retrieve the requested percentile of the points with neighbor, so isolated points don't collapse
+                // the grid. Points without bin or without neighbor have the maximum distance,
+                // so they are placed at the end:
+
+                bpc::transform(first, last, distances.begin(), distanceTransform, queue);
+
+                auto numNeighborDistances = long(bpc::count_if(distances.begin(), distances.end(), hasNeighbor,
+                                                               queue));
+                distance = 0;
+
+                if(numNeighborDistances)
+                {
+                    auto nth = distances.begin() + long(spacingPercentile * (numNeighborDistances - 1));
+                    bpc::nth_element(distances.begin(), nth, distances.end(), queue);
+                    bpc::copy_n(nth, 1, &distance, queue);
+                }
+            }
+            else
+            {
+                bpc::transform_reduce(first, last, &distance, distanceTransform, distanceReduce, queue);
+            }
+        }
+        catch(const bpc::program_build_failure& programBuildFailure)
+        {
+            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
+            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+            return false;
+        }
+
+        spacing = std::sqrt(distance);
+        return true;
     }
-    catch(const bpc::program_build_failure& programBuildFailure)
+
+    bool fillPoints(const DeviceView& devicePoints, const DeviceView& devicePlanePoints, const Sensor& sensor,
+                    const Point& origin, float minX, float minY, float cellSizeInv, int width, int height,
+                    DeviceView& deviceOutputPoints, Context& context)
     {
-        PCPS_LOG_ERROR << "Program build failure: " << std::endl;
-        PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
-        return false;
-    }
+        bpc::command_queue& queue = *context.queue;
+        std::size_t numPoints = devicePoints.size();
+        std::size_t numCells = std::size_t(width * height);
+        DeviceBufferScope deviceBuffers(context.getDeviceBufferPool(), queue);
+
+        std::array<int, 4> intArgs = { int(numPoints), width, height, int(sensor.projection) };
+        DeviceBuffer<int> deviceIntArgs = deviceBuffers.upload(intArgs.data(), intArgs.size());
+        std::array<float, 13> floatArgs = { minX, minY, cellSizeInv, origin.x, origin.y, origin.z,
+                                            sensor.horizontalResolution, sensor.verticalResolution,
+                                            sensor.maxElevation, sensor.fx, sensor.fy, sensor.cx, sensor.cy };
+        DeviceBuffer<float> deviceFloatArgs = deviceBuffers.upload(floatArgs.data(), floatArgs.size());
+
+        DeviceBuffer<int> pointCells = deviceBuffers.acquire<int>(numPoints);
+        DeviceBuffer<int> pointKeys = deviceBuffers.acquire<int>(numPoints);
+        DeviceBuffer<int> cellKeys = deviceBuffers.acquire<int>(numCells);
+        DeviceBuffer<int> cellRanks = deviceBuffers.acquire<int>(numCells);
+
+        // Keep the lowest depth of each cell with an atomic max on an integer key with the same order as -depth
+        // (NaN is lower than any other value and INT_MIN means empty cell).
+        // With the plane projections the depth is -z in the plane frame, so the highest z is kept:
+
+        BOOST_COMPUTE_CLOSURE(void, keyTransform, (int index),
+                              (devicePoints, devicePlanePoints, deviceIntArgs, deviceFloatArgs, pointCells, pointKeys,
+                               cellKeys),
+        {
+            int width = deviceIntArgs[1];
+            int height = deviceIntArgs[2];
+            int projection = deviceIntArgs[3];
+            float4 point = devicePoints[index];
+            float value = point.z;
+            int cell = -1;
+
+            if(projection == 0 || projection == 3)
+            {
+                point = devicePlanePoints[index];
+                value = point.z;
+
+                if(isfinite(point.x) && isfinite(point.y))
+                {
+                    float minX = deviceFloatArgs[0];
+                    float minY = deviceFloatArgs[1];
+                    float cellSizeInv = deviceFloatArgs[2];
+                    int col = (point.x - minX) * cellSizeInv;
+                    int row = (point.y - minY) * cellSizeInv;
+                    cell = (row * width) + col;
+                }
+            }
+            else if(isfinite(point.x) && isfinite(point.y) && isfinite(point.z))
+            {
+                float x = point.x - deviceFloatArgs[3];
+                float y = point.y - deviceFloatArgs[4];
+                float z = point.z - deviceFloatArgs[5];
+                float col = -1;
+                float row = -1;
+
+                if(projection == 1)
+                {
+                    float azimuth = atan2(y, x);
+                    float elevation = atan2(z, sqrt((x * x) + (y * y)));
+                    col = floor(((azimuth + M_PI_F) / deviceFloatArgs[6]) + 0.5f);
+                    row = floor(((deviceFloatArgs[8] - elevation) / deviceFloatArgs[7]) + 0.5f);
+                    value = -sqrt((x * x) + (y * y) + (z * z));
+
+                    if(col >= width)
+                    {
+                        col -= width;
+                    }
+                }
+                else if(z > 0)
+                {
+                    col = floor(((deviceFloatArgs[9] * x) / z) + deviceFloatArgs[11] + 0.5f);
+                    row = floor(((deviceFloatArgs[10] * y) / z) + deviceFloatArgs[12] + 0.5f);
+                    value = -z;
+                }
+
+                if(col >= 0 && col < width && row >= 0 && row < height)
+                {
+                    cell = ((int)row * width) + (int)col;
+                }
+            }
 
-    // Retrieve minimum distance between points:
+            if(cell >= 0)
+            {
+                int key;
+
+                if(isnan(value))
+                {
+                    key = INT_MIN + 1;
+                }
+                else if(value == 0)
+                {
+                    key = 0;
+                }
+                else
+                {
+                    key = as_int(value);
+
+                    if(key < 0)
+                    {
+                        key ^= 0x7FFFFFFF;
+                    }
+                }
+
+                pointKeys[index] = key;
+                atomic_max(&cellKeys[cell], key);
+            }
 
-    float minX = boundingBox[0];
-    float minY = boundingBox[1];
-    float distanceX = boundingBox[2] - minX;
-    float distanceY = boundingBox[3] - minY;
-    float maxDistance = maxValue;
+            pointCells[index] = cell;
+        });
 
-    std::array<int, 1> distanceIntArgs = { int(numPoints) };
-    bpc::mapped_view<int> deviceDistanceIntArgs(distanceIntArgs.data(), distanceIntArgs.size(), *context.context);
-    std::array<float, 1> distanceFloatArgs = { maxDistance };
-    bpc::mapped_view<float> deviceDistanceFloatArgs(distanceFloatArgs.data(), distanceFloatArgs.size(), *context.context);
+        // Resolve ties like the serial organizer, which keeps the first point with the lowest depth,
+        // or the last one if all of them have NaN depth:
 
-    BOOST_COMPUTE_CLOSURE(float, distanceTransform, (int index),
-                          (devicePoints2D, deviceDistanceIntArgs, deviceDistanceFloatArgs),
-    {
-        int numPoints = deviceDistanceIntArgs[0];
-        float maxDistance = deviceDistanceFloatArgs[0];
+        BOOST_COMPUTE_CLOSURE(void, rankTransform, (int index),
+                              (deviceIntArgs, pointCells, pointKeys, cellKeys, cellRanks),
+        {
+            int cell = pointCells[index];
 
-        float2 point = devicePoints2D[index];
-        float minDistance = maxDistance;
-        ++index;
+            if(cell >= 0)
+            {
+                int key = pointKeys[index];
+
+                if(key == cellKeys[cell])
+                {
+                    int numPoints = deviceIntArgs[0];
+                    int rank = key == INT_MIN + 1 ? index : numPoints - index - 1;
+                    atomic_max(&cellRanks[cell], rank);
+                }
+            }
+        });
 
-        while(index < numPoints)
+        BOOST_COMPUTE_CLOSURE(bpc::float4_, gatherTransform, (int cell),
+                              (devicePoints, deviceIntArgs, cellKeys, cellRanks),
         {
-            float2 otherPoint = devicePoints2D[index];
-            float distanceX = point.x - otherPoint.x;
-            float distanceY = point.y - otherPoint.y;
-            float distance = (distanceX * distanceX) + (distanceY * distanceY);
+            int rank = cellRanks[cell];
 
-            if(distance < minDistance)
+            if(rank < 0)
             {
-                minDistance = distance;
+                return (float4)(NAN, NAN, NAN, 0);
             }
 
-            ++index;
-        }
+            int numPoints = deviceIntArgs[0];
+            int index = cellKeys[cell] == INT_MIN + 1 ? rank : numPoints - rank - 1;
+            return devicePoints[index];
+        });
 
-        return minDistance;
-    });
+        bpc::counting_iterator<int> first(0);
+        bpc::counting_iterator<int> lastPoint = first + long(numPoints);
+        bpc::counting_iterator<int> lastCell = first + long(numCells);
 
-    BOOST_COMPUTE_FUNCTION(float, distanceReduce, (float a, float b),
-    {
-        return a < b ? a : b;
-    });
+        try
+        {
+            bpc::fill(cellKeys.begin(), cellKeys.end(), std::numeric_limits<int>::min(), queue);
+            bpc::fill(cellRanks.begin(), cellRanks.end(), -1, queue);
+            bpc::for_each(first, lastPoint, keyTransform, queue);
+            bpc::for_each(first, lastPoint, rankTransform, queue);
+            bpc::transform(first, lastCell, deviceOutputPoints.begin(), gatherTransform, queue);
+        }
+        catch(const bpc::program_build_failure& programBuildFailure)
+        {
+            PCPS_LOG_ERROR << "Program build failure: " << std::endl;
+            PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+}
 
-    bpc::counting_iterator<int> first(0);
-    bpc::counting_iterator<int> last = first + long(numPoints);
-    float minDistance = maxValue;
+bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud, Context& context) const
+{
+    std::unique_ptr<DeviceCloud> outputPointDeviceCloud;
 
-    try
+    if(! organize(inputPointCloud, outputPointCloud, outputPointDeviceCloud, context))
     {
-        bpc::transform_reduce(first, last, &minDistance, distanceTransform, distanceReduce, *context.queue);
+        return false;
     }
-    catch(const bpc::program_build_failure& programBuildFailure)
+
+    if(! outputPointDeviceCloud->updateHostCloud(context))
     {
-        PCPS_LOG_ERROR << "Program build failure: " << std::endl;
-        PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+        PCPS_LOG_ERROR << "Output point cloud update failed" << std::endl;
         return false;
     }
 
-    minDistance = std::sqrt(minDistance);
+    return true;
+}
 
-    // Retrieve output cloud size and cell size:
+bool Organizer::organize(const Cloud& inputPointCloud, Cloud& outputPointCloud,
+                         std::unique_ptr<DeviceCloud>& outputPointDeviceCloud, Context& context) const
+{
+    if(inputPointCloud.isOrganized())
+    {
+        inputPointCloud.copyTo(outputPointCloud);
+        outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
+        return true;
+    }
 
-    int width, height;
+    const std::vector<Point>& inputPoints = inputPointCloud.points;
+    std::size_t numPoints = inputPoints.size();
 
-    if(minDistance > epsilon)
+    if(! numPoints)
     {
-        width = std::min(int(distanceX / minDistance) + 1, _maximumWidth);
-        height = std::min(int(distanceY / minDistance) + 1, _maximumHeight);
+        PCPS_LOG_ERROR << "Input cloud has no points" << std::endl;
+        return false;
     }
-    else
+
+    if(_sensor.hasFixedSize())
     {
-        width = _maximumWidth;
-        height = _maximumHeight;
-    }
+        // Output size is fixed by the sensor:
 
-    float cellSize = std::max(distanceX / width, distanceY / height);
-    float cellSizeInv = 1 / cellSize;
-    width = int(distanceX * cellSizeInv) + 1;
-    height = int(distanceY * cellSizeInv) + 1;
+        DeviceCloud inputPointDeviceCloud(inputPointCloud, context);
+        const DeviceView& devicePoints = *static_cast<const DeviceView*>(inputPointDeviceCloud.getDeviceData());
+        int width = _sensor.width;
+        int height = _sensor.height;
 
-    // Fill output cloud points vector:
+        outputPointCloud.width = width;
+        outputPointCloud.height = height;
+        outputPointCloud.sensorOrigin = inputPointCloud.sensorOrigin;
+        outputPointCloud.points.resize(std::size_t(width * height));
+        outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
 
-    std::vector<int> indices(numPoints, -1);
-    bpc::mapped_view<int> deviceIndices(indices.data(), indices.size(), *context.context);
+        auto deviceOutputPoints = static_cast<DeviceView*>(outputPointDeviceCloud->getDeviceData());
 
-    std::array<int, 1> indexIntArgs = { width };
-    bpc::mapped_view<int> deviceIndexIntArgs(indexIntArgs.data(), indexIntArgs.size(), *context.context);
-    std::array<float, 3> indexFloatArgs = { minX, minY, cellSizeInv };
-    bpc::mapped_view<float> deviceIndexFloatArgs(indexFloatArgs.data(), indexFloatArgs.size(), *context.context);
+        if(! fillPoints(devicePoints, devicePoints, _sensor, inputPointCloud.sensorOrigin, 0, 0, 0, width, height,
+                        *deviceOutputPoints, context))
+        {
+            PCPS_LOG_ERROR << "Output points fill failed" << std::endl;
+            return false;
+        }
 
-    BOOST_COMPUTE_CLOSURE(int, indexTransform, (bpc::float2_ point), (deviceIndexIntArgs, deviceIndexFloatArgs),
+        return true;
+    }
+
+    if(numPoints == 1)
     {
-        int width = deviceIndexIntArgs[0];
-        float minX = deviceIndexFloatArgs[0];
-        float minY = deviceIndexFloatArgs[1];
-        float cellSizeInv = deviceIndexFloatArgs[2];
-
-        float relativeX = point.x - minX;
-        float relativeY = point.y - minY;
-        int col = relativeX * cellSizeInv;
-        int row = relativeY * cellSizeInv;
-        return (row * width) + col;
-    });
-
-    try
+        inputPointCloud.copyTo(outputPointCloud);
+        outputPointCloud.width = 1;
+        outputPointCloud.height = 1;
+        outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
+        return true;
+    }
+
+    DeviceCloud inputPointDeviceCloud(inputPointCloud, context);
+    const DeviceView& devicePoints = *static_cast<const DeviceView*>(inputPointDeviceCloud.getDeviceData());
+
+    // Project points onto the plane frame in the host if it is not the XY one:
+
+    Point xAxis, yAxis, zAxis;
+    bool rotated = _getPlaneAxes(inputPoints, xAxis, yAxis, zAxis);
+    Cloud rotatedPointCloud;
+
+    if(rotated)
     {
-        bpc::transform(devicePoints2D.begin(), devicePoints2D.end(), deviceIndices.begin(), indexTransform,
-                       *context.queue);
+        rotatedPointCloud.points.reserve(numPoints);
+
+        for(const Point& inputPoint : inputPoints)
+        {
+            rotatedPointCloud.points.push_back(Point{ inputPoint.dot(xAxis), inputPoint.dot(yAxis),
+                                                      inputPoint.dot(zAxis), 0 });
+        }
     }
-    catch(const bpc::program_build_failure& programBuildFailure)
+
+    std::unique_ptr<DeviceCloud> rotatedPointDeviceCloud(rotated ? new DeviceCloud(rotatedPointCloud, context) :
+                                                                   nullptr);
+    const DeviceView& devicePlanePoints = rotated ?
+                *static_cast<const DeviceView*>(rotatedPointDeviceCloud->getDeviceData()) : devicePoints;
+
+    // Retrieve bounding box:
+
+    auto maxValue = std::numeric_limits<float>::max();
+    bpc::float4_ boundingBox = { maxValue, maxValue, -maxValue, -maxValue };
+
+    if(! getBoundingBox(devicePlanePoints, boundingBox, context))
     {
-        PCPS_LOG_ERROR << "Program build failure: " << std::endl;
-        PCPS_LOG_ERROR << programBuildFailure.build_log() << std::endl;
+        PCPS_LOG_ERROR << "Bounding box calculation failed" << std::endl;
         return false;
     }
 
-    std::vector<Point>& outputPoints = outputPointCloud.points;
+    float minX = boundingBox[0];
+    float minY = boundingBox[1];
+    float distanceX = boundingBox[2] - minX;
+    float distanceY = boundingBox[3] - minY;
+
+    // Retrieve distance between points:
+
+    float minDistance = 0;
+    int binCols, binRows;
+    float binSizeInv;
+
+    if(_getSpacingBins(distanceX, distanceY, numPoints, binCols, binRows, binSizeInv))
+    {
+        if(! getSpacing(devicePlanePoints, minX, minY, binCols, binRows, binSizeInv, _spacingPercentile, minDistance,
+                        context))
+        {
+            PCPS_LOG_ERROR << "Spacing calculation failed" << std::endl;
+            return false;
+        }
+    }
+
+    // Retrieve output cloud size and cell size:
+
+    int width, height;
+    float cellSizeInv;
+    _getOutputSize(distanceX, distanceY, minDistance, width, height, cellSizeInv);
+
     outputPointCloud.width = width;
     outputPointCloud.height = height;
     outputPointCloud.sensorOrigin = inputPointCloud.sensorOrigin;
-    outputPoints.resize(std::size_t(width * height), Point::invalid());
-    deviceIndices.map(*context.queue);
+    outputPointCloud.points.resize(std::size_t(width * height));
+    outputPointDeviceCloud.reset(new DeviceCloud(outputPointCloud, context));
 
-    for(std::size_t index = 0; index < numPoints; ++index)
-    {
-        const Point& inputPoint = inputPoints[index];
-        int outputPointIndex = indices[index];
-        Point& outputPoint = outputPoints[std::size_t(outputPointIndex)];
+    // Fill output cloud points in the compute device:
 
-        if(! std::isfinite(outputPoint.z) || inputPoint.z > outputPoint.z)
-        {
-            outputPoint = inputPoint;
-        }
+    auto deviceOutputPoints = static_cast<DeviceView*>(outputPointDeviceCloud->getDeviceData());
+
+    if(! fillPoints(devicePoints, devicePlanePoints, _sensor, inputPointCloud.sensorOrigin, minX, minY, cellSizeInv,
+                    width, height, *deviceOutputPoints, context))
+    {
+        PCPS_LOG_ERROR << "Output points fill failed" << std::endl;
+        return false;
     }
 
     return true;
@@ -0,0 +1,419 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_plane_segmentation_pipeline.h"
+
+#include <deque>
+#include <chrono>
+#include "pcps_logger.h"
+#include "pcps_context.h"
+#include "pcps_device_cloud.h"
+#include "pcps_normal_statistics.h"
+
+namespace pcps
+{
+
+class PlaneSegmentationPipeline::Frame
+{
+
+public:
+    Cloud pointCloud;
+    Cloud normalCloud;
+    NormalStatistics normalStatistics;
+    std::vector<NormalRegion> normalRegions;
+    PlaneSegmentationResult result;
+    std::promise<PlaneSegmentationResult> promise;
+    Callback callback;
+    std::chrono::steady_clock::time_point submitTime;
+    bool normalStatisticsBuilt = false;
+};
+
+class PlaneSegmentationPipeline::FrameQueue
+{
+
+public:
+    /**
+     * @brief Pushes the given frame, applying the given backpressure policy if the queue is full.
+     * @return The frame dropped to make room for the given one, the given one if it was dropped, or null.
+     */
+    std::unique_ptr<Frame> push(std::unique_ptr<Frame> frame, int capacity, Backpressure backpressure)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::unique_ptr<Frame> droppedFrame;
+
+        if(backpressure == Backpressure::BLOCK)
+        {
+            _notFullCondition.wait(lock, [this, capacity]{ return int(_frames.size()) < capacity; });
+        }
+        else if(int(_frames.size()) >= capacity)
+        {
+            if(backpressure == Backpressure::DROP_NEWEST)
+            {
+                return frame;
+            }
+
+            droppedFrame = std::move(_frames.front());
+            _frames.pop_front();
+        }
+
+        _frames.push_back(std::move(frame));
+        _notEmptyCondition.notify_one();
+        return droppedFrame;
+    }
+
+    /**
+     * @brief Pops the oldest frame, waiting until there's one.
+     * @return false if the queue is closed and empty; true otherwise.
+     */
+    bool pop(std::unique_ptr<Frame>& frame)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmptyCondition.wait(lock, [this]{ return _closed || ! _frames.empty(); });
+
+        if(_frames.empty())
+        {
+            return false;
+        }
+
+        frame = std::move(_frames.front());
+        _frames.pop_front();
+        _notFullCondition.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmptyCondition.notify_all();
+    }
+
+    int size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return int(_frames.size());
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmptyCondition;
+    std::condition_variable _notFullCondition;
+    std::deque<std::unique_ptr<Frame>> _frames;
+    bool _closed = false;
+};
+
+PlaneSegmentationPipeline::PlaneSegmentationPipeline(const PlaneSegmentator& planeSegmentator, Context& context) :
+    _planeSegmentator(planeSegmentator),
+    _context(context),
+    _droppedFrames(0),
+    _lastLatencyMcs(0),
+    _queueCapacity(2),
+    _backpressure(int(Backpressure::BLOCK))
+{
+    // Intermediate results are not stored, and the thread pool is created before the stages can share it:
+
+    _planeSegmentator.setStoreIntermediateResults(false);
+    context.getThreadPool();
+
+    Process processes[_stages] = {
+        &PlaneSegmentationPipeline::_organize,
+        &PlaneSegmentationPipeline::_extractNormals,
+        &PlaneSegmentationPipeline::_splitNormals,
+        &PlaneSegmentationPipeline::_mergeNormals
+    };
+
+    for(int stage = 0; stage < _stages; ++stage)
+    {
+        _queues[stage].reset(new FrameQueue());
+    }
+
+    for(int stage = 0; stage < _stages; ++stage)
+    {
+        Process process = processes[stage];
+        _workers[stage] = std::thread([this, stage, process]{ _work(stage, process); });
+    }
+}
+
+int PlaneSegmentationPipeline::getQueueCapacity() const noexcept
+{
+    return _queueCapacity;
+}
+
+bool PlaneSegmentationPipeline::setQueueCapacity(int queueCapacity) noexcept
+{
+    if(queueCapacity < 1)
+    {
+        PCPS_LOG_ERROR << "Invalid queueCapacity: " << queueCapacity << std::endl;
+        return false;
+    }
+
+    _queueCapacity = queueCapacity;
+    return true;
+}
+
+PlaneSegmentationPipeline::Backpressure PlaneSegmentationPipeline::getBackpressure() const noexcept
+{
+    return Backpressure(int(_backpressure));
+}
+
+bool PlaneSegmentationPipeline::setBackpressure(Backpressure backpressure) noexcept
+{
+    if(int(backpressure) < int(Backpressure::BLOCK) || int(backpressure) > int(Backpressure::DROP_NEWEST))
+    {
+        PCPS_LOG_ERROR << "Invalid backpressure: " << int(backpressure) << std::endl;
+        return false;
+    }
+
+    _backpressure = int(backpressure);
+    return true;
+}
+
+std::future<PlaneSegmentationResult> PlaneSegmentationPipeline::submit(const Cloud& inputPointCloud)
+{
+    std::unique_ptr<Frame> frame(new Frame());
+    std::future<PlaneSegmentationResult> future = frame->promise.get_future();
+    inputPointCloud.copyTo(frame->pointCloud);
+    _submit(std::move(frame));
+    return future;
+}
+
+void PlaneSegmentationPipeline::submit(const Cloud& inputPointCloud, const Callback& callback)
+{
+    std::unique_ptr<Frame> frame(new Frame());
+    frame->callback = callback;
+    inputPointCloud.copyTo(frame->pointCloud);
+    _submit(std::move(frame));
+}
+
+void PlaneSegmentationPipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _doneCondition.wait(lock, [this]{ return _pendingFrames == 0; });
+}
+
+int PlaneSegmentationPipeline::getQueueDepth(Stage stage) const
+{
+    if(int(stage) < int(Stage::ORGANIZATION) || int(stage) > int(Stage::NORMAL_MERGE))
+    {
+        PCPS_LOG_ERROR << "Invalid stage: " << int(stage) << std::endl;
+        return 0;
+    }
+
+    return _queues[int(stage)]->size();
+}
+
+std::uint64_t PlaneSegmentationPipeline::getDroppedFrames() const noexcept
+{
+    return _droppedFrames;
+}
+
+std::int64_t PlaneSegmentationPipeline::getLastLatencyMcs() const noexcept
+{
+    return _lastLatencyMcs;
+}
+
+PlaneSegmentationPipeline::~PlaneSegmentationPipeline()
+{
+    // Each stage processes its pending frames before closing the queue of the next one:
+
+    _queues[0]->close();
+
+    for(std::thread& worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+void PlaneSegmentationPipeline::_submit(std::unique_ptr<Frame> frame)
+{
+    frame->submitTime = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        frame->result.frameIndex = _nextFrameIndex;
+        ++_nextFrameIndex;
+        ++_pendingFrames;
+    }
+
+    const Cloud& pointCloud = frame->pointCloud;
+
+    if(pointCloud.points.empty())
+    {
+        PCPS_LOG_ERROR << "Input point cloud is empty" << std::endl;
+        _complete(std::move(frame), false, false);
+        return;
+    }
+
+    if(! pointCloud.hasValidSize())
+    {
+        PCPS_LOG_ERROR << "Input point cloud size is invalid" << std::endl;
+        _complete(std::move(frame), false, false);
+        return;
+    }
+
+    _push(0, std::move(frame));
+}
+
+void PlaneSegmentationPipeline::_work(int stage, Process process)
+{
+    FrameQueue& queue = *_queues[stage];
+    std::unique_ptr<Frame> frame;
+    bool contextThreadSafe = _context.isThreadSafe();
+
+    while(queue.pop(frame))
+    {
+        bool success;
+
+        if(contextThreadSafe)
+        {
+            success = (this->*process)(*frame);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(_contextMutex);
+            success = (this->*process)(*frame);
+        }
+
+        if(! success)
+        {
+            _complete(std::move(frame), false, false);
+        }
+        else if(stage + 1 < _stages)
+        {
+            _push(stage + 1, std::move(frame));
+        }
+        else
+        {
+            _complete(std::move(frame), true, false);
+        }
+    }
+
+    if(stage + 1 < _stages)
+    {
+        _queues[stage + 1]->close();
+    }
+}
+
+void PlaneSegmentationPipeline::_push(int stage, std::unique_ptr<Frame> frame)
+{
+    std::unique_ptr<Frame> droppedFrame = _queues[stage]->push(std::move(frame), _queueCapacity,
+                                                               Backpressure(int(_backpressure)));
+
+    if(droppedFrame)
+    {
+        ++_droppedFrames;
+        _complete(std::move(droppedFrame), false, true);
+    }
+}
+
+void PlaneSegmentationPipeline::_complete(std::unique_ptr<Frame> frame, bool success, bool dropped)
+{
+    auto elapsedTime = std::chrono::steady_clock::now() - frame->submitTime;
+    PlaneSegmentationResult& result = frame->result;
+    result.latencyMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    result.success = success;
+    result.dropped = dropped;
+
+    if(success)
+    {
+        _lastLatencyMcs = result.latencyMcs;
+    }
+
+    if(frame->callback)
+    {
+        frame->callback(result);
+    }
+    else
+    {
+        frame->promise.set_value(std::move(result));
+    }
+
+    frame.reset();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_pendingFrames;
+
+    if(! _pendingFrames)
+    {
+        _doneCondition.notify_all();
+    }
+}
+
+bool PlaneSegmentationPipeline::_organize(Frame& frame)
+{
+    if(frame.pointCloud.isOrganized())
+    {
+        return true;
+    }
+
+    Cloud organizedPointCloud;
+
+    if(! _planeSegmentator.organizer.organize(frame.pointCloud, organizedPointCloud, _context))
+    {
+        PCPS_LOG_ERROR << "Point cloud organization failed" << std::endl;
+        return false;
+    }
+
+    frame.pointCloud = std::move(organizedPointCloud);
+    return true;
+}
+
+bool PlaneSegmentationPipeline::_extractNormals(Frame& frame)
+{
+    const Cloud& pointCloud = frame.pointCloud;
+    Cloud& normalCloud = frame.normalCloud;
+    normalCloud.width = pointCloud.width;
+    normalCloud.height = pointCloud.height;
+    normalCloud.sensorOrigin = pointCloud.sensorOrigin;
+    normalCloud.points.resize(pointCloud.points.size());
+
+    DeviceCloud pointDeviceCloud(pointCloud, _context);
+    DeviceCloud normalDeviceCloud(normalCloud, _context);
+    NormalStatistics* normalStatistics = nullptr;
+
+    if(_planeSegmentator.fuseNormalStatistics())
+    {
+        normalStatistics = &frame.normalStatistics;
+    }
+
+    if(! _planeSegmentator.normalExtractor._extract(pointDeviceCloud, normalDeviceCloud, normalStatistics,
+                                                    frame.normalStatisticsBuilt, _context))
+    {
+        PCPS_LOG_ERROR << "Point cloud normal extraction failed" << std::endl;
+        return false;
+    }
+
+    if(! normalDeviceCloud.updateHostCloud(_context))
+    {
+        PCPS_LOG_ERROR << "Host normal cloud update failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool PlaneSegmentationPipeline::_splitNormals(Frame& frame)
+{
+    DeviceCloud normalDeviceCloud(frame.normalCloud, _context);
+    const NormalStatistics* normalStatistics = frame.normalStatisticsBuilt ? &frame.normalStatistics : nullptr;
+
+    if(! _planeSegmentator.normalSplitter._split(normalDeviceCloud, normalStatistics, frame.normalRegions,
+                                                 _normalSplitterWorkspace, _context))
+    {
+        PCPS_LOG_ERROR << "Normal cloud split failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool PlaneSegmentationPipeline::_mergeNormals(Frame& frame)
+{
+    _planeSegmentator.normalMerger.merge(frame.normalRegions, frame.result.planes, _context);
+    return true;
+}
+
+}
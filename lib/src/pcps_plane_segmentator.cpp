@@ -6,13 +6,101 @@
 
 #include "pcps_plane_segmentator.h"
 
+#include <atomic>
 #include <chrono>
+#include <algorithm>
 #include "pcps_logger.h"
+#include "pcps_context.h"
+#include "pcps_thread_pool.h"
 #include "pcps_device_cloud.h"
+#include "pcps_normal_statistics.h"
 
 namespace pcps
 {
 
+PlaneSegmentationWorkspace::PlaneSegmentationWorkspace() :
+    _normalStatistics(new NormalStatistics())
+{
+}
+
+PlaneSegmentationWorkspace::PlaneSegmentationWorkspace(const PlaneSegmentationWorkspace& other) :
+    _organizationResult(other._organizationResult),
+    _normalExtractionResult(other._normalExtractionResult),
+    _normalSplitResult(other._normalSplitResult),
+    _normalStatistics(new NormalStatistics(*other._normalStatistics)),
+    _normalSplitterWorkspace(other._normalSplitterWorkspace),
+    _normalMergerWorkspace(other._normalMergerWorkspace),
+    _organizationElapsedMcs(other._organizationElapsedMcs),
+    _normalExtractionElapsedMcs(other._normalExtractionElapsedMcs),
+    _normalSplitElapsedMcs(other._normalSplitElapsedMcs),
+    _normalMergeElapsedMcs(other._normalMergeElapsedMcs)
+{
+}
+
+PlaneSegmentationWorkspace::PlaneSegmentationWorkspace(PlaneSegmentationWorkspace&& other) noexcept = default;
+
+PlaneSegmentationWorkspace& PlaneSegmentationWorkspace::operator=(const PlaneSegmentationWorkspace& other)
+{
+    if(this != &other)
+    {
+        PlaneSegmentationWorkspace copy(other);
+        *this = std::move(copy);
+    }
+
+    return *this;
+}
+
+PlaneSegmentationWorkspace& PlaneSegmentationWorkspace::operator=(PlaneSegmentationWorkspace&& other) noexcept =
+        default;
+
+PlaneSegmentationWorkspace::~PlaneSegmentationWorkspace() = default;
+
+const Cloud& PlaneSegmentationWorkspace::getLastOrganizationResult() const noexcept
+{
+    return _organizationResult;
+}
+
+std::int64_t PlaneSegmentationWorkspace::getLastOrganizationElapsedMcs() const noexcept
+{
+    return _organizationElapsedMcs;
+}
+
+const Cloud& PlaneSegmentationWorkspace::getLastNormalExtractionResult() const noexcept
+{
+    return _normalExtractionResult;
+}
+
+std::int64_t PlaneSegmentationWorkspace::getLastNormalExtractionElapsedMcs() const noexcept
+{
+    return _normalExtractionElapsedMcs;
+}
+
+const std::vector<NormalRegion>& PlaneSegmentationWorkspace::getLastNormalSplitResult() const noexcept
+{
+    return _normalSplitResult;
+}
+
+std::int64_t PlaneSegmentationWorkspace::getLastNormalSplitElapsedMcs() const noexcept
+{
+    return _normalSplitElapsedMcs;
+}
+
+std::int64_t PlaneSegmentationWorkspace::getLastNormalMergeElapsedMcs() const noexcept
+{
+    return _normalMergeElapsedMcs;
+}
+
+const std::vector<std::int64_t>& PlaneSegmentationWorkspace::getLastNormalMergeRoundsElapsedMcs() const noexcept
+{
+    return _normalMergerWorkspace.getLastRoundsElapsedMcs();
+}
+
+PlaneSegmentator::PlaneSegmentator() noexcept
+{
+    // Splitter output regions never overlap:
+    normalMerger.setDisjointRegions(true);
+}
+
 bool PlaneSegmentator::storeIntermediateResults() const noexcept
 {
     return _storeIntermediateResults;
@@ -23,57 +111,68 @@ void PlaneSegmentator::setStoreIntermediateResults(bool store) noexcept
     _storeIntermediateResults = store;
 }
 
+bool PlaneSegmentator::fuseNormalStatistics() const noexcept
+{
+    return _fuseNormalStatistics;
+}
+
+void PlaneSegmentator::setFuseNormalStatistics(bool fuse) noexcept
+{
+    _fuseNormalStatistics = fuse;
+}
+
 bool PlaneSegmentator::segmentate(const Cloud& inputPointCloud, std::vector<Plane>& outputPlanes, Context& context)
 {
-    if(! _start(inputPointCloud))
+    return segmentate(inputPointCloud, outputPlanes, _workspace, context);
+}
+
+bool PlaneSegmentator::segmentate(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes,
+                                  Context& context)
+{
+    return segmentate(inputPointDeviceCloud, outputPlanes, _workspace, context);
+}
+
+bool PlaneSegmentator::segmentate(const Cloud& inputPointCloud, std::vector<Plane>& outputPlanes,
+                                  PlaneSegmentationWorkspace& workspace, Context& context) const
+{
+    if(! _start(inputPointCloud, workspace))
     {
         PCPS_LOG_ERROR << "Segmentation start failed" << std::endl;
         return false;
     }
 
-    const Cloud* pointCloudPtr;
-
     if(inputPointCloud.isOrganized())
     {
-        pointCloudPtr = &inputPointCloud;
-
         if(_storeIntermediateResults)
         {
-            inputPointCloud.copyTo(_organizationResult);
+            inputPointCloud.copyTo(workspace._organizationResult);
         }
-    }
-    else
-    {
-        auto startTime = std::chrono::high_resolution_clock::now();
 
-        if(! organizer.organize(inputPointCloud, _organizationResult, context))
+        DeviceCloud inputPointDeviceCloud(inputPointCloud, context);
+
+        if(! _segmentateImpl(inputPointDeviceCloud, outputPlanes, workspace, context))
         {
-            PCPS_LOG_ERROR << "Point cloud organization failed" << std::endl;
+            PCPS_LOG_ERROR << "Organized point cloud segmentation failed" << std::endl;
             return false;
         }
-
-        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-        _organizationElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
-        pointCloudPtr = &_organizationResult;
     }
-
-    DeviceCloud inputPointDeviceCloud(*pointCloudPtr, context);
-
-    if(! _segmentateImpl(inputPointDeviceCloud, outputPlanes, context))
+    else
     {
-        PCPS_LOG_ERROR << "Organized point cloud segmentation failed" << std::endl;
-        return false;
+        if(! _organizeAndSegmentate(inputPointCloud, outputPlanes, workspace, context))
+        {
+            return false;
+        }
     }
 
     return true;
 }
 
 bool PlaneSegmentator::segmentate(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes,
-                                  Context& context)
+                                  PlaneSegmentationWorkspace& workspace, Context& context) const
 {
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
 
-    if(! _start(inputPointCloud))
+    if(! _start(inputPointCloud, workspace))
     {
         PCPS_LOG_ERROR << "Segmentation start failed" << std::endl;
         return false;
@@ -83,10 +182,10 @@ bool PlaneSegmentator::segmentate(const DeviceCloud& inputPointDeviceCloud, std:
     {
         if(_storeIntermediateResults)
         {
-            inputPointCloud.copyTo(_organizationResult);
+            inputPointCloud.copyTo(workspace._organizationResult);
         }
 
-        if(! _segmentateImpl(inputPointDeviceCloud, outputPlanes, context))
+        if(! _segmentateImpl(inputPointDeviceCloud, outputPlanes, workspace, context))
         {
             PCPS_LOG_ERROR << "Organized point cloud segmentation failed" << std::endl;
             return false;
@@ -94,76 +193,106 @@ bool PlaneSegmentator::segmentate(const DeviceCloud& inputPointDeviceCloud, std:
     }
     else
     {
-        auto startTime = std::chrono::high_resolution_clock::now();
-
-        if(! organizer.organize(inputPointCloud, _organizationResult, context))
+        if(! _organizeAndSegmentate(inputPointCloud, outputPlanes, workspace, context))
         {
-            PCPS_LOG_ERROR << "Point cloud organization failed" << std::endl;
             return false;
         }
+    }
+
+    return true;
+}
+
+bool PlaneSegmentator::segmentate(const std::vector<Cloud>& inputPointClouds,
+                                  std::vector<std::vector<Plane>>& outputPlanes, Context& context) const
+{
+    std::size_t numPointClouds = inputPointClouds.size();
+    outputPlanes.resize(numPointClouds);
+
+    // Each worker takes the next pending point cloud, so small and big ones are balanced:
+
+    int workers = context.isThreadSafe() ? context.getThreads() : 1;
+    workers = int(std::min(std::size_t(workers), numPointClouds));
 
-        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-        _organizationElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::vector<PlaneSegmentationWorkspace> workspaces(std::size_t(std::max(workers, 1)));
+    std::atomic<std::size_t> nextPointCloud(0);
+    std::atomic<bool> success(true);
 
-        DeviceCloud organizedPointDeviceCloud(_organizationResult, context);
+    auto work = [&](int worker)
+    {
+        PlaneSegmentationWorkspace& workspace = workspaces[std::size_t(worker)];
 
-        if(! _segmentateImpl(organizedPointDeviceCloud, outputPlanes, context))
+        for(std::size_t index = nextPointCloud++; index < numPointClouds; index = nextPointCloud++)
         {
-            PCPS_LOG_ERROR << "Organized point cloud segmentation failed" << std::endl;
-            return false;
+            std::vector<Plane>& pointCloudPlanes = outputPlanes[index];
+
+            if(! segmentate(inputPointClouds[index], pointCloudPlanes, workspace, context))
+            {
+                PCPS_LOG_ERROR << "Point cloud segmentation failed: " << index << std::endl;
+                pointCloudPlanes.clear();
+                success = false;
+            }
         }
+    };
+
+    if(workers > 1)
+    {
+        context.getThreadPool()->run(workers, work);
+    }
+    else
+    {
+        work(0);
     }
 
-    return true;
+    return success;
 }
 
 const Cloud& PlaneSegmentator::getLastOrganizationResult() const noexcept
 {
-    return _organizationResult;
+    return _workspace.getLastOrganizationResult();
 }
 
 std::int64_t PlaneSegmentator::getLastOrganizationElapsedMcs() const noexcept
 {
-    return _organizationElapsedMcs;
+    return _workspace.getLastOrganizationElapsedMcs();
 }
 
 const Cloud& PlaneSegmentator::getLastNormalExtractionResult() const noexcept
 {
-    return _normalExtractionResult;
+    return _workspace.getLastNormalExtractionResult();
 }
 
 std::int64_t PlaneSegmentator::getLastNormalExtractionElapsedMcs() const noexcept
 {
-    return _normalExtractionElapsedMcs;
+    return _workspace.getLastNormalExtractionElapsedMcs();
 }
 
 const std::vector<NormalRegion>& PlaneSegmentator::getLastNormalSplitResult() const noexcept
 {
-    return _normalSplitResult;
+    return _workspace.getLastNormalSplitResult();
 }
 
 std::int64_t PlaneSegmentator::getLastNormalSplitElapsedMcs() const noexcept
 {
-    return _normalSplitElapsedMcs;
+    return _workspace.getLastNormalSplitElapsedMcs();
 }
 
 std::int64_t PlaneSegmentator::getLastNormalMergeElapsedMcs() const noexcept
 {
-    return _normalMergeElapsedMcs;
+    return _workspace.getLastNormalMergeElapsedMcs();
 }
 
-bool PlaneSegmentator::_start(const Cloud& inputPointCloud)
+bool PlaneSegmentator::_start(const Cloud& inputPointCloud, PlaneSegmentationWorkspace& workspace) const
 {
-    _organizationResult.reset();
-    _organizationElapsedMcs = 0;
+    workspace._organizationResult.reset();
+    workspace._organizationElapsedMcs = 0;
 
-    _normalExtractionResult.reset();
-    _normalExtractionElapsedMcs = 0;
+    workspace._normalExtractionResult.reset();
+    workspace._normalExtractionElapsedMcs = 0;
 
-    _normalSplitResult.clear();
-    _normalSplitElapsedMcs = 0;
+    workspace._normalSplitResult.clear();
+    workspace._normalSplitElapsedMcs = 0;
 
-    _normalMergeElapsedMcs = 0;
+    workspace._normalMergeElapsedMcs = 0;
 
     if(inputPointCloud.points.empty())
     {
@@ -180,27 +309,67 @@ bool PlaneSegmentator::_start(const Cloud& inputPointCloud)
     return true;
 }
 
+bool PlaneSegmentator::_organizeAndSegmentate(const Cloud& inputPointCloud, std::vector<Plane>& outputPlanes,
+                                              PlaneSegmentationWorkspace& workspace, Context& context) const
+{
+    // The organized cloud stays in the compute device; the host copy is only updated if it is requested:
+
+    std::unique_ptr<DeviceCloud> organizedPointDeviceCloud;
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    if(! organizer.organize(inputPointCloud, workspace._organizationResult, organizedPointDeviceCloud, context))
+    {
+        PCPS_LOG_ERROR << "Point cloud organization failed" << std::endl;
+        return false;
+    }
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    workspace._organizationElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+
+    if(_storeIntermediateResults)
+    {
+        if(! organizedPointDeviceCloud->updateHostCloud(context))
+        {
+            PCPS_LOG_ERROR << "Host organized point cloud update failed" << std::endl;
+            return false;
+        }
+    }
+
+    if(! _segmentateImpl(*organizedPointDeviceCloud, outputPlanes, workspace, context))
+    {
+        PCPS_LOG_ERROR << "Organized point cloud segmentation failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 bool PlaneSegmentator::_segmentateImpl(const DeviceCloud& inputPointDeviceCloud, std::vector<Plane>& outputPlanes,
-                                       Context& context)
+                                       PlaneSegmentationWorkspace& workspace, Context& context) const
 {
     const Cloud& inputPointCloud = inputPointDeviceCloud.getHostCloud();
-    _normalExtractionResult.width = inputPointCloud.width;
-    _normalExtractionResult.height = inputPointCloud.height;
-    _normalExtractionResult.sensorOrigin = inputPointCloud.sensorOrigin;
-    _normalExtractionResult.points.resize(inputPointCloud.points.size());
+    Cloud& normalExtractionResult = workspace._normalExtractionResult;
+    normalExtractionResult.width = inputPointCloud.width;
+    normalExtractionResult.height = inputPointCloud.height;
+    normalExtractionResult.sensorOrigin = inputPointCloud.sensorOrigin;
+    normalExtractionResult.points.resize(inputPointCloud.points.size());
 
-    DeviceCloud outputNormalDeviceCloud(_normalExtractionResult, context);
+    DeviceCloud outputNormalDeviceCloud(normalExtractionResult, context);
+    NormalStatistics& normalStatistics = *workspace._normalStatistics;
+    bool normalStatisticsBuilt = false;
 
     auto startTime = std::chrono::high_resolution_clock::now();
 
-    if(! normalExtractor.extract(inputPointDeviceCloud, outputNormalDeviceCloud, context))
+    if(! normalExtractor._extract(inputPointDeviceCloud, outputNormalDeviceCloud,
+                                  _fuseNormalStatistics ? &normalStatistics : nullptr, normalStatisticsBuilt,
+                                  context))
     {
         PCPS_LOG_ERROR << "Point cloud normal extraction failed" << std::endl;
         return false;
     }
 
     auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-    _normalExtractionElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    workspace._normalExtractionElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
 
     if(! outputNormalDeviceCloud.updateHostCloud(context))
     {
@@ -210,19 +379,20 @@ bool PlaneSegmentator::_segmentateImpl(const DeviceCloud& inputPointDeviceCloud,
 
     startTime = std::chrono::high_resolution_clock::now();
 
-    if(! normalSplitter.split(outputNormalDeviceCloud, _normalSplitResult, context))
+    if(! normalSplitter._split(outputNormalDeviceCloud, normalStatisticsBuilt ? &normalStatistics : nullptr,
+                               workspace._normalSplitResult, workspace._normalSplitterWorkspace, context))
     {
         PCPS_LOG_ERROR << "Normal cloud split failed" << std::endl;
         return false;
     }
 
     elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-    _normalSplitElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    workspace._normalSplitElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
 
     startTime = std::chrono::high_resolution_clock::now();
-    normalMerger.merge(_normalSplitResult, outputPlanes);
+    normalMerger.merge(workspace._normalSplitResult, outputPlanes, workspace._normalMergerWorkspace, context);
     elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-    _normalMergeElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    workspace._normalMergeElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
     return true;
 }
 
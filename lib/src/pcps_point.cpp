@@ -45,6 +45,11 @@ bool Point::isEqualTo(const Point& other, float precision) const noexcept
     }
 }
 
+float Point::dot(const Point& other) const noexcept
+{
+    return (x * other.x) + (y * other.y) + (z * other.z);
+}
+
 Point Point::cross(const Point& other) const noexcept
 {
     return Point{ y * other.z - other.y * z, other.x * z - x * other.z, x * other.y - other.x * y, 0 };
@@ -0,0 +1,154 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_program_cache.h"
+
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include "boost/compute/detail/sha1.hpp"
+#include "pcps_logger.h"
+#include "pcps_tweak_me.h"
+
+namespace bpc = boost::compute;
+
+namespace pcps
+{
+
+ProgramCache::ProgramCache(const bpc::context& context) :
+    _context(&context)
+{
+    bpc::device device = context.get_device();
+    bpc::platform platform = device.platform();
+    _deviceId = platform.name() + '\n' + platform.version() + '\n' + device.name() + '\n' +
+            device.driver_version() + '\n';
+}
+
+std::string ProgramCache::getDefine(const char* name, int value)
+{
+    return std::string("-D") + name + '=' + std::to_string(value);
+}
+
+std::string ProgramCache::getGeometryDefine(const char* name, const char* argumentName, int value) const
+{
+    if(_specializeCloudGeometry)
+    {
+        return getDefine(name, value);
+    }
+
+    return std::string("-D") + name + '=' + argumentName;
+}
+
+bpc::program ProgramCache::getOrBuild(const char* source, const std::string& options)
+{
+    // Hashing the source is skipped for the programs already retrieved:
+
+    std::pair<const char*, std::string> programKey(source, options);
+    auto programsIt = _programs.find(programKey);
+
+    if(programsIt != _programs.end())
+    {
+        return programsIt->second;
+    }
+
+    bpc::program program = _getOrBuild(source, options);
+
+    // Build options only hold bounded values, but the map is capped anyway.
+    // Programs dropped from it are still found in the boost::compute in-memory cache:
+
+    if(_programs.size() >= PCPS_OPENCL_PROGRAM_CACHE_MAX_PROGRAMS)
+    {
+        _programs.clear();
+    }
+
+    _programs.emplace(std::move(programKey), program);
+    return program;
+}
+
+bpc::program ProgramCache::_getOrBuild(const std::string& source, const std::string& options)
+{
+    std::string hash = bpc::detail::sha1(_deviceId + options + '\n' + source);
+    std::string key = "pcps_" + hash;
+    boost::shared_ptr<bpc::program_cache> memoryCache = bpc::program_cache::get_global_cache(*_context);
+    boost::optional<bpc::program> cachedProgram = memoryCache->get(key, options);
+
+    if(cachedProgram)
+    {
+        return *cachedProgram;
+    }
+
+    bpc::program program;
+    std::string path;
+
+    if(! _directory.empty())
+    {
+        path = _directory + '/' + key + ".bin";
+
+        if(_load(path, options, program))
+        {
+            ++_diskHits;
+            memoryCache->insert(key, options, program);
+            return program;
+        }
+    }
+
+    program = bpc::program::create_with_source(source, *_context);
+    program.build(options);
+    ++_builds;
+    memoryCache->insert(key, options, program);
+
+    if(! path.empty())
+    {
+        _save(path, program);
+    }
+
+    return program;
+}
+
+bool ProgramCache::_load(const std::string& path, const std::string& options, bpc::program& program) const
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if(! file)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if(binary.empty())
+    {
+        return false;
+    }
+
+    // Stale or corrupted binaries are rejected by the driver, so they are built again from source:
+
+    try
+    {
+        program = bpc::program::create_with_binary(binary, *_context);
+        program.build(options);
+    }
+    catch(const bpc::opencl_error& openclError)
+    {
+        PCPS_LOG_ERROR << "Program binary load failure (" << path << "): " << openclError.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void ProgramCache::_save(const std::string& path, const bpc::program& program) const
+{
+    std::vector<unsigned char> binary = program.binary();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if(! file || ! file.write(reinterpret_cast<const char*>(binary.data()), std::streamsize(binary.size())))
+    {
+        PCPS_LOG_ERROR << "Program binary save failure: " << path << std::endl;
+    }
+}
+
+}
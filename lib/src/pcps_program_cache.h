@@ -0,0 +1,135 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_PROGRAM_CACHE_H
+#define PCPS_PROGRAM_CACHE_H
+
+#include <map>
+#include <string>
+#include <cstdint>
+#include "pcps_boost_compute.h"
+
+namespace pcps
+{
+
+///@cond INTERNAL
+
+/**
+ * @brief Cache of the OpenCL programs built from pcps sources.
+ *
+ * Programs are looked up in the boost::compute in-memory cache first.
+ * If a directory is set, their binaries are also loaded from and saved to it,
+ * so later processes don't need to build them again.
+ *
+ * Binaries are keyed by platform, device, driver, build options and source,
+ * so a driver update or a source change invalidates them.
+ *
+ * Sources can be specialized with -D build options, and each configuration is cached as a different program.
+ * Bounded values (like neighbor levels or minimum region size) are always specialized this way.
+ * Cloud geometry is specialized only if it is enabled, since each cloud size builds a new program;
+ * otherwise its macros expand to kernel arguments.
+ *
+ * At most PCPS_OPENCL_PROGRAM_CACHE_MAX_PROGRAMS programs are kept in memory.
+ */
+class ProgramCache
+{
+
+public:
+    explicit ProgramCache(const boost::compute::context& context);
+
+    /**
+     * @brief Retrieves the directory in which program binaries are stored (empty if disabled).
+     */
+    const std::string& getDirectory() const noexcept
+    {
+        return _directory;
+    }
+
+    /**
+     * @brief Sets the directory in which program binaries are stored (empty to disable it).
+     */
+    void setDirectory(const std::string& directory)
+    {
+        _directory = directory;
+    }
+
+    /**
+     * @brief Indicates if cloud geometry (like cloud size) is specialized with build options.
+     */
+    bool specializeCloudGeometry() const noexcept
+    {
+        return _specializeCloudGeometry;
+    }
+
+    /**
+     * @brief Sets if cloud geometry (like cloud size) is specialized with build options.
+     */
+    void setSpecializeCloudGeometry(bool specialize) noexcept
+    {
+        _specializeCloudGeometry = specialize;
+    }
+
+    /**
+     * @brief Retrieves a -D build option which defines the given macro with the given value.
+     */
+    static std::string getDefine(const char* name, int value);
+
+    /**
+     * @brief Retrieves a -D build option which defines the given cloud geometry macro.
+     *
+     * If cloud geometry is specialized, the macro is defined with the given value;
+     * otherwise it is defined as the given kernel argument.
+     */
+    std::string getGeometryDefine(const char* name, const char* argumentName, int value) const;
+
+    /**
+     * @brief Retrieves the program with the given source and build options, building it if needed.
+     *
+     * Programs already retrieved are looked up by source address, so the source must have static storage duration.
+     *
+     * It throws boost::compute::program_build_failure if the program can't be built.
+     */
+    boost::compute::program getOrBuild(const char* source, const std::string& options);
+
+    /**
+     * @brief Retrieves the number of programs loaded from the directory since the cache was created.
+     */
+    std::uint64_t getDiskHits() const noexcept
+    {
+        return _diskHits;
+    }
+
+    /**
+     * @brief Retrieves the number of programs built from source since the cache was created.
+     */
+    std::uint64_t getBuilds() const noexcept
+    {
+        return _builds;
+    }
+
+private:
+    using Programs = std::map<std::pair<const char*, std::string>, boost::compute::program>;
+
+    const boost::compute::context* _context;
+    Programs _programs;
+    std::string _directory;
+    std::string _deviceId;
+    std::uint64_t _diskHits = 0;
+    std::uint64_t _builds = 0;
+    bool _specializeCloudGeometry = false;
+
+    boost::compute::program _getOrBuild(const std::string& source, const std::string& options);
+
+    bool _load(const std::string& path, const std::string& options, boost::compute::program& program) const;
+
+    void _save(const std::string& path, const boost::compute::program& program) const;
+};
+
+///@endcond
+
+}
+
+#endif
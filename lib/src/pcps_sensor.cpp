@@ -0,0 +1,197 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_sensor.h"
+
+#include <cmath>
+#include <algorithm>
+#include "pcps_epsilon.h"
+
+namespace pcps
+{
+
+namespace
+{
+    constexpr float pi = 3.14159265358979323846f;
+}
+
+Sensor Sensor::plane() noexcept
+{
+    return Sensor();
+}
+
+Sensor Sensor::plane(const Point& xAxis, const Point& yAxis) noexcept
+{
+    Sensor result;
+    result.xAxis = Point{ 0, 0, 0, 0 };
+    result.yAxis = Point{ 0, 0, 0, 0 };
+
+    if(xAxis.isFinite() && yAxis.isFinite())
+    {
+        // Gram-Schmidt orthonormalization:
+
+        Point resultXAxis = Point{ xAxis.x, xAxis.y, xAxis.z, 0 };
+        float xLength = std::sqrt(resultXAxis.dot(resultXAxis));
+
+        if(xLength > epsilon)
+        {
+            resultXAxis /= xLength;
+
+            Point resultYAxis = Point{ yAxis.x, yAxis.y, yAxis.z, 0 };
+            float yDot = resultYAxis.dot(resultXAxis);
+            resultYAxis.x -= yDot * resultXAxis.x;
+            resultYAxis.y -= yDot * resultXAxis.y;
+            resultYAxis.z -= yDot * resultXAxis.z;
+
+            float yLength = std::sqrt(resultYAxis.dot(resultYAxis));
+
+            if(yLength > epsilon)
+            {
+                resultYAxis /= yLength;
+                result.xAxis = resultXAxis;
+                result.yAxis = resultYAxis;
+            }
+        }
+    }
+
+    return result;
+}
+
+Sensor Sensor::fittedPlane() noexcept
+{
+    Sensor result;
+    result.projection = Projection::FITTED_PLANE;
+    return result;
+}
+
+Sensor Sensor::spherical(float horizontalResolution, float verticalResolution, float minElevation,
+                         float maxElevation) noexcept
+{
+    Sensor result;
+    result.projection = Projection::SPHERICAL;
+
+    if(horizontalResolution > 0 && horizontalResolution <= 2 * pi && verticalResolution > 0 &&
+            std::isfinite(verticalResolution) && std::isfinite(minElevation) && maxElevation >= minElevation &&
+            std::isfinite(maxElevation))
+    {
+        result.width = std::max(int(std::round((2 * pi) / horizontalResolution)), 1);
+        result.height = int(std::round((maxElevation - minElevation) / verticalResolution)) + 1;
+        result.horizontalResolution = horizontalResolution;
+        result.verticalResolution = verticalResolution;
+        result.maxElevation = maxElevation;
+    }
+
+    return result;
+}
+
+Sensor Sensor::pinhole(float fx, float fy, float cx, float cy, int width, int height) noexcept
+{
+    Sensor result;
+    result.projection = Projection::PINHOLE;
+
+    if(fx > 0 && std::isfinite(fx) && fy > 0 && std::isfinite(fy) && std::isfinite(cx) && std::isfinite(cy) &&
+            width > 0 && height > 0)
+    {
+        result.width = width;
+        result.height = height;
+        result.fx = fx;
+        result.fy = fy;
+        result.cx = cx;
+        result.cy = cy;
+    }
+
+    return result;
+}
+
+bool Sensor::isValid() const noexcept
+{
+    if(projection == Projection::SPHERICAL)
+    {
+        return width > 0 && height > 0 && horizontalResolution > 0 && verticalResolution > 0 &&
+                std::isfinite(maxElevation);
+    }
+
+    if(projection == Projection::PINHOLE)
+    {
+        return width > 0 && height > 0 && fx > 0 && fy > 0 && std::isfinite(cx) && std::isfinite(cy);
+    }
+
+    if(projection == Projection::PLANE)
+    {
+        return xAxis.isFinite() && yAxis.isFinite() && std::abs(xAxis.dot(xAxis) - 1) < 1e-3f &&
+                std::abs(yAxis.dot(yAxis) - 1) < 1e-3f && std::abs(xAxis.dot(yAxis)) < 1e-3f;
+    }
+
+    return projection == Projection::FITTED_PLANE;
+}
+
+bool Sensor::hasFixedSize() const noexcept
+{
+    return projection == Projection::SPHERICAL || projection == Projection::PINHOLE;
+}
+
+int Sensor::getCellIndex(const Point& point, const Point& origin) const noexcept
+{
+    if(! point.isFinite())
+    {
+        return -1;
+    }
+
+    float x = point.x - origin.x;
+    float y = point.y - origin.y;
+    float z = point.z - origin.z;
+    float col, row;
+
+    if(projection == Projection::SPHERICAL)
+    {
+        float azimuth = std::atan2(y, x);
+        float elevation = std::atan2(z, std::sqrt((x * x) + (y * y)));
+        col = std::floor(((azimuth + pi) / horizontalResolution) + 0.5f);
+        row = std::floor(((maxElevation - elevation) / verticalResolution) + 0.5f);
+
+        if(col >= width)
+        {
+            col -= width;
+        }
+    }
+    else if(projection == Projection::PINHOLE && z > 0)
+    {
+        col = std::floor(((fx * x) / z) + cx + 0.5f);
+        row = std::floor(((fy * y) / z) + cy + 0.5f);
+    }
+    else
+    {
+        return -1;
+    }
+
+    if(col >= 0 && col < width && row >= 0 && row < height)
+    {
+        return (int(row) * width) + int(col);
+    }
+
+    return -1;
+}
+
+float Sensor::getDepth(const Point& point, const Point& origin) const noexcept
+{
+    if(projection == Projection::SPHERICAL)
+    {
+        float x = point.x - origin.x;
+        float y = point.y - origin.y;
+        float z = point.z - origin.z;
+        return std::sqrt((x * x) + (y * y) + (z * z));
+    }
+
+    if(projection == Projection::PINHOLE)
+    {
+        return point.z - origin.z;
+    }
+
+    Point zAxis = xAxis.cross(yAxis);
+    return -point.dot(zAxis);
+}
+
+}
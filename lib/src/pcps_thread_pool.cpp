@@ -0,0 +1,124 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#include "pcps_thread_pool.h"
+
+#include "pcps_assert.h"
+
+namespace pcps
+{
+
+ThreadPool::ThreadPool(int threads) :
+    _busy(false),
+    _nextTask(0)
+{
+    PCPS_ASSERT(threads >= 1);
+
+    _workers.reserve(std::size_t(threads - 1));
+
+    for(int index = 1; index < threads; ++index)
+    {
+        _workers.emplace_back([this]{ _work(); });
+    }
+}
+
+void ThreadPool::run(int tasks, const std::function<void(int)>& function)
+{
+    // The busy flag is taken without blocking, so nested calls from a task of the calling thread are safe:
+
+    bool idle = false;
+
+    if(tasks <= 1 || _workers.empty() || ! _busy.compare_exchange_strong(idle, true))
+    {
+        for(int task = 0; task < tasks; ++task)
+        {
+            function(task);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _function = &function;
+        _tasks = tasks;
+        _nextTask = 0;
+        _finishedWorkers = 0;
+        ++_generation;
+    }
+
+    _workCondition.notify_all();
+    _runTasks();
+
+    // Wait until every worker has left the current generation, so none of them can take tasks from the next one:
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _doneCondition.wait(lock, [this]{ return _finishedWorkers == int(_workers.size()); });
+    _function = nullptr;
+    _busy = false;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+
+    _workCondition.notify_all();
+
+    for(std::thread& worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::_work()
+{
+    unsigned generation = 0;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workCondition.wait(lock, [this, generation]{ return _exit || _generation != generation; });
+
+            if(_exit)
+            {
+                return;
+            }
+
+            generation = _generation;
+        }
+
+        _runTasks();
+
+        bool done;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_finishedWorkers;
+            done = _finishedWorkers == int(_workers.size());
+        }
+
+        if(done)
+        {
+            _doneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::_runTasks()
+{
+    const std::function<void(int)>& function = *_function;
+
+    for(int task = _nextTask++; task < _tasks; task = _nextTask++)
+    {
+        function(task);
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * (c) 2019 Gustavo Valiente gustavo.valiente@protonmail.com
+ *
+ * MIT License, see LICENSE file.
+ */
+
+#ifndef PCPS_THREAD_POOL_H
+#define PCPS_THREAD_POOL_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace pcps
+{
+
+///@cond INTERNAL
+
+/**
+ * @brief Set of persistent CPU threads which process indexed tasks in parallel.
+ */
+class ThreadPool
+{
+
+public:
+    /**
+     * @brief Class constructor.
+     * @param threads Maximum number of threads processing tasks, including the calling one [1..inf).
+     */
+    explicit ThreadPool(int threads);
+
+    /**
+     * @brief Retrieves the maximum number of threads processing tasks, including the calling one.
+     */
+    int getThreads() const noexcept
+    {
+        return int(_workers.size()) + 1;
+    }
+
+    /**
+     * @brief Processes the given tasks and waits until all of them are completed.
+     *
+     * The calling thread processes tasks too.
+     * If the pool is already busy (for example, if this method is called from a task),
+     * all tasks are processed by the calling thread.
+     *
+     * @param tasks Number of tasks.
+     * @param function Callable with the signature void(int task).
+     */
+    void run(int tasks, const std::function<void(int)>& function);
+
+    /**
+     * @brief Copy construction is not allowed.
+     */
+    ThreadPool(const ThreadPool& other) = delete;
+
+    /**
+     * @brief Copy assignment is not allowed.
+     */
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    /**
+     * @brief Class destructor.
+     */
+    ~ThreadPool();
+
+private:
+    std::vector<std::thread> _workers;
+    std::atomic<bool> _busy;
+    std::mutex _mutex;
+    std::condition_variable _workCondition;
+    std::condition_variable _doneCondition;
+    const std::function<void(int)>* _function = nullptr;
+    std::atomic<int> _nextTask;
+    int _tasks = 0;
+    int _finishedWorkers = 0;
+    unsigned _generation = 0;
+    bool _exit = false;
+
+    void _work();
+
+    void _runTasks();
+};
+
+///@endcond
+
+}
+
+#endif
@@ -7,12 +7,64 @@
 #ifndef PCPS_TWEAK_ME_H
 #define PCPS_TWEAK_ME_H
 
+#ifndef PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD
+    #define PCPS_CPU_ORGANIZER_MIN_POINTS_PER_THREAD (8 * 1024)
+#endif
+
+#ifndef PCPS_CPU_NORMAL_EXTRACTOR_MIN_POINTS_PER_THREAD
+    #define PCPS_CPU_NORMAL_EXTRACTOR_MIN_POINTS_PER_THREAD (2 * 1024)
+#endif
+
+#ifndef PCPS_CPU_NORMAL_EXTRACTOR_MAX_FIXED_STENCIL_RADIUS
+    #define PCPS_CPU_NORMAL_EXTRACTOR_MAX_FIXED_STENCIL_RADIUS 8
+#endif
+
+#ifndef PCPS_CPU_SPLITTER_MIN_POINTS_PER_THREAD
+    #define PCPS_CPU_SPLITTER_MIN_POINTS_PER_THREAD (16 * 1024)
+#endif
+
+#ifndef PCPS_CPU_SPLITTER_MIN_TASK_AREA
+    #define PCPS_CPU_SPLITTER_MIN_TASK_AREA (32 * 32)
+#endif
+
+#ifndef PCPS_CPU_SPLITTER_TASKS_PER_THREAD
+    #define PCPS_CPU_SPLITTER_TASKS_PER_THREAD 8
+#endif
+
+#ifndef PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE
+    #define PCPS_CPU_NORMAL_STATISTICS_TILE_SIZE 8
+#endif
+
+#ifndef PCPS_CPU_MERGER_MIN_GROUPS_PER_THREAD
+    #define PCPS_CPU_MERGER_MIN_GROUPS_PER_THREAD 1024
+#endif
+
 #ifndef PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA
     #define PCPS_CUDA_SPLITTER_MAX_CPU_REGION_AREA (64 * 64)
 #endif
 
+#ifndef PCPS_OPENCL_NORMAL_EXTRACTOR_TILE_SIZE
+    #define PCPS_OPENCL_NORMAL_EXTRACTOR_TILE_SIZE 16
+#endif
+
 #ifndef PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA
     #define PCPS_OPENCL_SPLITTER_MAX_CPU_REGION_AREA (512 * 512)
 #endif
 
+#ifndef PCPS_OPENCL_SPLITTER_WORK_GROUP_SIZE
+    #define PCPS_OPENCL_SPLITTER_WORK_GROUP_SIZE 64
+#endif
+
+#ifndef PCPS_OPENCL_BUFFER_POOL_MIN_BYTES
+    #define PCPS_OPENCL_BUFFER_POOL_MIN_BYTES 256
+#endif
+
+#ifndef PCPS_OPENCL_BUFFER_POOL_MAX_BUCKET_BUFFERS
+    #define PCPS_OPENCL_BUFFER_POOL_MAX_BUCKET_BUFFERS 8
+#endif
+
+#ifndef PCPS_OPENCL_PROGRAM_CACHE_MAX_PROGRAMS
+    #define PCPS_OPENCL_PROGRAM_CACHE_MAX_PROGRAMS 32
+#endif
+
 #endif
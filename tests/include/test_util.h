@@ -13,6 +13,7 @@
 namespace pcps
 {
     class Cloud;
+    class Plane;
     class NormalRegion;
 }
 
@@ -32,4 +33,13 @@ bool areSimilarClouds(const pcps::Cloud& a, const pcps::Cloud& b, int maxDiffere
 
 bool areSimilarClouds(const pcps::Cloud& a, const pcps::Cloud& b, int maxDifferentPoints, float precision);
 
+// Creates an empty folder inside the system temporary folder and retrieves its path:
+std::string createTemporaryFolder();
+
+// Removes the given folder and the files stored in it:
+void removeFolder(const std::string& folderPath);
+
+// Area-weighted mean angle in radians between each region normal and the area-weighted mean normal of its plane:
+float getPlanesMeanAngle(const std::vector<pcps::Plane>& planes);
+
 #endif
@@ -4,12 +4,16 @@
  * MIT License, see LICENSE file.
  */
 
+#include <cmath>
+#include <algorithm>
 #include <chrono>
+#include <thread>
 #include <iostream>
 #include "catch.hpp"
 #include "pcps_context.h"
 #include "pcps_device_cloud.h"
 #include "pcps_plane_segmentator.h"
+#include "pcps_plane_segmentation_pipeline.h"
 #include "test_util.h"
 
 TEST_CASE("Organizer 1x1")
@@ -49,6 +53,232 @@ TEST_CASE("Organizer")
     std::cout << "Organizer elapsed mcs: " << elapsedMcs << std::endl;
 }
 
+TEST_CASE("Organizer threads")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/input.pcd");
+    pcps::Cloud expectedPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    REQUIRE(! context->setThreads(0));
+
+    for(int threads : { 1, 2, 3, 4, 16 })
+    {
+        REQUIRE(context->setThreads(threads));
+
+        pcps::Cloud outputPointCloud;
+        outputPointCloud.points.resize(expectedPointCloud.points.size(), pcps::Point{ 0, 0, 0, 0 });
+
+        pcps::Organizer organizer;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = organizer.organize(inputPointCloud, outputPointCloud, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success);
+        REQUIRE(outputPointCloud == expectedPointCloud);
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "Organizer " << threads << " threads elapsed mcs: " << elapsedMcs << std::endl;
+    }
+}
+
+TEST_CASE("Organizer spacing percentile")
+{
+    pcps::Cloud inputPointCloud;
+
+    for(int y = 0; y < 10; ++y)
+    {
+        for(int x = 0; x < 10; ++x)
+        {
+            inputPointCloud.points.push_back(pcps::Point{ float(x), float(y), 0, 0 });
+        }
+    }
+
+    inputPointCloud.width = int(inputPointCloud.points.size());
+    inputPointCloud.height = 1;
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::Cloud expectedPointCloud;
+    pcps::Organizer organizer;
+    REQUIRE(organizer.organize(inputPointCloud, expectedPointCloud, *context));
+
+    inputPointCloud.points.push_back(inputPointCloud.points.back());
+    inputPointCloud.width = int(inputPointCloud.points.size());
+
+    pcps::Cloud outputPointCloud;
+    REQUIRE(organizer.organize(inputPointCloud, outputPointCloud, *context));
+    REQUIRE(outputPointCloud.width >= organizer.getMaximumWidth());
+    REQUIRE(outputPointCloud.height >= organizer.getMaximumHeight());
+
+    REQUIRE(organizer.setSpacingPercentile(0.1f));
+    REQUIRE(organizer.organize(inputPointCloud, outputPointCloud, *context));
+    REQUIRE(outputPointCloud == expectedPointCloud);
+
+    // Points without neighbors are not taken into account, so they don't collapse the grid:
+
+    inputPointCloud.points.push_back(pcps::Point{ 100, 100, 0, 0 });
+    inputPointCloud.width = int(inputPointCloud.points.size());
+
+    REQUIRE(organizer.setSpacingPercentile(1));
+    REQUIRE(organizer.organize(inputPointCloud, outputPointCloud, *context));
+    REQUIRE(outputPointCloud.width > 10);
+    REQUIRE(outputPointCloud.height > 10);
+}
+
+TEST_CASE("Organizer fitted plane")
+{
+    // Vertical wall, almost parallel to the XZ plane:
+
+    const float pi = 3.14159265358979323846f;
+    float angle = pi * 80 / 180;
+    pcps::Point xAxis{ 1, 0, 0, 0 };
+    pcps::Point yAxis{ 0, std::cos(angle), std::sin(angle), 0 };
+    pcps::Cloud inputPointCloud;
+
+    for(int row = 0; row < 100; ++row)
+    {
+        for(int col = 0; col < 100; ++col)
+        {
+            float x = col * 0.1f;
+            float y = row * 0.1f;
+            inputPointCloud.points.push_back(pcps::Point{ x * xAxis.x + y * yAxis.x, x * xAxis.y + y * yAxis.y,
+                                                          x * xAxis.z + y * yAxis.z, 0 });
+        }
+    }
+
+    inputPointCloud.width = int(inputPointCloud.points.size());
+    inputPointCloud.height = 1;
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::Organizer organizer;
+    pcps::Cloud planeOutputPointCloud;
+    REQUIRE(organizer.organize(inputPointCloud, planeOutputPointCloud, *context));
+
+    REQUIRE(organizer.setSensor(pcps::Sensor::fittedPlane()));
+
+    pcps::Cloud fittedOutputPointCloud;
+    REQUIRE(organizer.organize(inputPointCloud, fittedOutputPointCloud, *context));
+    REQUIRE(fittedOutputPointCloud.hasValidSize());
+    REQUIRE(fittedOutputPointCloud.points.size() < planeOutputPointCloud.points.size() / 4);
+    REQUIRE(fittedOutputPointCloud.getFillRatio() > 0.9f);
+
+    REQUIRE(! organizer.setSensor(pcps::Sensor::plane(xAxis, xAxis)));
+    REQUIRE(organizer.setSensor(pcps::Sensor::plane(xAxis, yAxis)));
+
+    pcps::Cloud alignedOutputPointCloud;
+    REQUIRE(organizer.organize(inputPointCloud, alignedOutputPointCloud, *context));
+    REQUIRE(alignedOutputPointCloud.hasValidSize());
+    REQUIRE(alignedOutputPointCloud.getFillRatio() > 0.9f);
+
+    std::cout << "Organizer plane fill ratio: " << planeOutputPointCloud.getFillRatio() << " (" <<
+                 planeOutputPointCloud.width << "x" << planeOutputPointCloud.height << ")" << std::endl;
+    std::cout << "Organizer fitted plane fill ratio: " << fittedOutputPointCloud.getFillRatio() << " (" <<
+                 fittedOutputPointCloud.width << "x" << fittedOutputPointCloud.height << ")" << std::endl;
+}
+
+TEST_CASE("Organizer pinhole sensor")
+{
+    pcps::Organizer organizer;
+    REQUIRE(! organizer.setSensor(pcps::Sensor::pinhole(0, 1, 1.5f, 1, 4, 3)));
+    REQUIRE(organizer.setSensor(pcps::Sensor::pinhole(1, 1, 1.5f, 1, 4, 3)));
+
+    pcps::Cloud inputPointCloud;
+    inputPointCloud.sensorOrigin = pcps::Point{ 1, 2, 3, 0 };
+    pcps::Point farPoint{ 1 + 1.5f, 2, 3 + 2, 0 };
+    pcps::Point nearPoint{ 1 + 0.75f, 2, 3 + 1, 0 };
+    pcps::Point behindPoint{ 1, 2, 3 - 1, 0 };
+    inputPointCloud.points = { farPoint, nearPoint, behindPoint, pcps::Point::invalid() };
+    inputPointCloud.width = int(inputPointCloud.points.size());
+    inputPointCloud.height = 1;
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::Cloud outputPointCloud;
+    REQUIRE(organizer.organize(inputPointCloud, outputPointCloud, *context));
+    REQUIRE(outputPointCloud.width == 4);
+    REQUIRE(outputPointCloud.height == 3);
+    REQUIRE(outputPointCloud.hasValidSize());
+    REQUIRE(outputPointCloud.at(2, 1) == nearPoint);
+
+    int numFinitePoints = 0;
+
+    for(const pcps::Point& point : outputPointCloud.points)
+    {
+        numFinitePoints += point.isFinite();
+    }
+
+    REQUIRE(numFinitePoints == 1);
+}
+
+TEST_CASE("Organizer spherical sensor")
+{
+    const float pi = 3.14159265358979323846f;
+    float horizontalResolution = pi / 180;
+    float verticalResolution = pi / 90;
+    pcps::Sensor sensor = pcps::Sensor::spherical(horizontalResolution, verticalResolution, -8 * verticalResolution,
+                                                  7 * verticalResolution);
+    REQUIRE(sensor.width == 360);
+    REQUIRE(sensor.height == 16);
+
+    pcps::Organizer organizer;
+    REQUIRE(! organizer.setSensor(pcps::Sensor::spherical(0, verticalResolution, 0, 1)));
+    REQUIRE(organizer.setSensor(sensor));
+
+    pcps::Cloud inputPointCloud;
+    inputPointCloud.sensorOrigin = pcps::Point{ 1, 2, 3, 0 };
+
+    for(int row = 0; row < sensor.height; ++row)
+    {
+        float elevation = sensor.maxElevation - (row * verticalResolution);
+
+        for(int col = 0; col < sensor.width; col += 3)
+        {
+            float azimuth = (col * horizontalResolution) - pi;
+
+            for(float range : { 10.0f, 5.0f, 20.0f })
+            {
+                pcps::Point point;
+                point.x = inputPointCloud.sensorOrigin.x + (range * std::cos(elevation) * std::cos(azimuth));
+                point.y = inputPointCloud.sensorOrigin.y + (range * std::cos(elevation) * std::sin(azimuth));
+                point.z = inputPointCloud.sensorOrigin.z + (range * std::sin(elevation));
+                point.aux = range;
+                inputPointCloud.points.push_back(point);
+            }
+        }
+    }
+
+    inputPointCloud.width = int(inputPointCloud.points.size());
+    inputPointCloud.height = 1;
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::Cloud outputPointCloud;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    bool success = organizer.organize(inputPointCloud, outputPointCloud, *context);
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    REQUIRE(success);
+    REQUIRE(outputPointCloud.width == sensor.width);
+    REQUIRE(outputPointCloud.height == sensor.height);
+    REQUIRE(outputPointCloud.hasValidSize());
+
+    for(int row = 0; row < sensor.height; ++row)
+    {
+        for(int col = 0; col < sensor.width; ++col)
+        {
+            const pcps::Point& point = outputPointCloud.at(col, row);
+
+            if(col % 3)
+            {
+                REQUIRE(! point.isFinite());
+            }
+            else
+            {
+                REQUIRE(point.isFinite());
+                REQUIRE(int(point.aux) == 5);
+            }
+        }
+    }
+
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "Organizer spherical sensor elapsed mcs: " << elapsedMcs << std::endl;
+}
+
 TEST_CASE("NormalExtractor 1x1")
 {
     pcps::Cloud inputPointCloud;
@@ -97,6 +327,253 @@ TEST_CASE("NormalExtractor")
     std::cout << "NormalExtractor elapsed mcs with DeviceCloud: " << elapsedMcs << std::endl;
 }
 
+TEST_CASE("NormalExtractor integral images")
+{
+    // Tilted plane with a hole:
+
+    pcps::Point planeNormal{ 0, 0.6f, 0.8f, 0 };
+    pcps::Cloud inputPointCloud;
+    inputPointCloud.width = 64;
+    inputPointCloud.height = 48;
+
+    for(int row = 0; row < inputPointCloud.height; ++row)
+    {
+        for(int col = 0; col < inputPointCloud.width; ++col)
+        {
+            float x = col * 0.01f;
+            float y = row * 0.01f * 0.8f;
+            float z = 1 - (row * 0.01f * 0.6f);
+
+            if(col > 20 && col < 30 && row > 20 && row < 30)
+            {
+                inputPointCloud.points.push_back(pcps::Point::invalid());
+            }
+            else
+            {
+                inputPointCloud.points.push_back(pcps::Point{ x, y, z, 0 });
+            }
+        }
+    }
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::NormalExtractor normalExtractor;
+    REQUIRE(! normalExtractor.useIntegralImages());
+    normalExtractor.setUseIntegralImages(true);
+    REQUIRE(normalExtractor.useIntegralImages());
+    REQUIRE(normalExtractor.setSearchRadius(0.05f));
+
+    pcps::Cloud outputNormalCloud;
+    REQUIRE(normalExtractor.extract(inputPointCloud, outputNormalCloud, *context));
+
+    for(const pcps::Point& normal : outputNormalCloud.points)
+    {
+        REQUIRE(normal.isEqualTo(planeNormal, 1e-3f));
+    }
+
+    // Compare against the search circumference at several radii:
+
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_extractor";
+    inputPointCloud = loadPointCloud(testDataPath + "/input.pcd");
+
+    for(float searchRadiusScale : { 0.5f, 1.0f, 2.0f })
+    {
+        pcps::Cloud circleNormalCloud;
+        normalExtractor.setUseIntegralImages(false);
+        REQUIRE(normalExtractor.setSearchRadius(0.5f * searchRadiusScale));
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = normalExtractor.extract(inputPointCloud, circleNormalCloud, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        auto circleElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        REQUIRE(success);
+
+        normalExtractor.setUseIntegralImages(true);
+        startTime = std::chrono::high_resolution_clock::now();
+        success = normalExtractor.extract(inputPointCloud, outputNormalCloud, *context);
+        elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        auto integralElapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        REQUIRE(success);
+
+        int maxDifferentPoints = int(outputNormalCloud.points.size()) / 10;
+        REQUIRE(areSimilarClouds(outputNormalCloud, circleNormalCloud, maxDifferentPoints, 0.1f));
+
+        std::cout << "NormalExtractor search radius " << normalExtractor.getSearchRadius() << " elapsed mcs: " <<
+                     circleElapsedMcs << " (circumference) " << integralElapsedMcs << " (integral images)" <<
+                     std::endl;
+    }
+}
+
+TEST_CASE("NormalExtractor threads")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_extractor";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/input.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::NormalExtractor normalExtractor;
+
+    for(bool useIntegralImages : { false, true })
+    {
+        normalExtractor.setUseIntegralImages(useIntegralImages);
+        REQUIRE(context->setThreads(1));
+
+        pcps::Cloud expectedNormalCloud;
+        REQUIRE(normalExtractor.extract(inputPointCloud, expectedNormalCloud, *context));
+
+        for(int threads : { 1, 2, 3, 4, 16 })
+        {
+            REQUIRE(context->setThreads(threads));
+
+            pcps::Cloud outputNormalCloud;
+            auto startTime = std::chrono::high_resolution_clock::now();
+            bool success = normalExtractor.extract(inputPointCloud, outputNormalCloud, *context);
+            auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+            REQUIRE(success);
+            REQUIRE(outputNormalCloud == expectedNormalCloud);
+
+            auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+            std::cout << "NormalExtractor " << threads << " threads elapsed mcs: " << elapsedMcs <<
+                         (useIntegralImages ? " (integral images)" : " (circumference)") << std::endl;
+        }
+    }
+}
+
+TEST_CASE("NormalExtractor CPU instructions")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_extractor";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/input.pcd");
+    pcps::Cloud expectedNormalCloud = loadNormalCloud(testDataPath + "/expected.txt");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    REQUIRE(context->setThreads(1));
+
+    using CpuInstructions = pcps::NormalExtractor::CpuInstructions;
+    pcps::NormalExtractor normalExtractor;
+    CpuInstructions maxCpuInstructions = pcps::NormalExtractor::getMaxCpuInstructions();
+    REQUIRE(normalExtractor.getCpuInstructions() == maxCpuInstructions);
+    REQUIRE(! normalExtractor.setCpuInstructions(CpuInstructions(int(maxCpuInstructions) + 1)));
+
+    REQUIRE(normalExtractor.setCpuInstructions(CpuInstructions::SCALAR));
+
+    pcps::Cloud scalarNormalCloud;
+    REQUIRE(normalExtractor.extract(inputPointCloud, scalarNormalCloud, *context));
+
+    const char* cpuInstructionsNames[] = { "scalar", "SSE4.2", "AVX2" };
+
+    for(int cpuInstructions = 0; cpuInstructions <= int(maxCpuInstructions); ++cpuInstructions)
+    {
+        REQUIRE(normalExtractor.setCpuInstructions(CpuInstructions(cpuInstructions)));
+
+        pcps::Cloud outputNormalCloud;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = normalExtractor.extract(inputPointCloud, outputNormalCloud, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success);
+        REQUIRE(areSimilarClouds(outputNormalCloud, expectedNormalCloud, 1168, 0.1f));
+        REQUIRE(areSimilarClouds(outputNormalCloud, scalarNormalCloud, 0, 1e-3f));
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        auto pointsPerSecond = (double(outputNormalCloud.points.size()) * 1000000) / double(std::max(elapsedMcs,
+                               decltype(elapsedMcs)(1)));
+        std::cout << "NormalExtractor " << cpuInstructionsNames[cpuInstructions] << " elapsed mcs: " <<
+                     elapsedMcs << " (" << std::size_t(pointsPerSecond) << " points per second)" << std::endl;
+    }
+}
+
+TEST_CASE("NormalExtractor local memory")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_extractor";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/input.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::DeviceCloud inputPointDeviceCloud(inputPointCloud, *context);
+    pcps::NormalExtractor normalExtractor;
+    REQUIRE(normalExtractor.useLocalMemory());
+
+    for(float searchRadius : { 0.25f, 0.5f, 1.0f })
+    {
+        REQUIRE(normalExtractor.setSearchRadius(searchRadius));
+
+        pcps::Cloud normalClouds[2];
+        long long elapsedMcs[2];
+
+        for(int useLocalMemory = 0; useLocalMemory <= 1; ++useLocalMemory)
+        {
+            normalExtractor.setUseLocalMemory(useLocalMemory);
+
+            pcps::Cloud& outputNormalCloud = normalClouds[useLocalMemory];
+            outputNormalCloud = inputPointCloud;
+
+            // The first extraction builds the program of this configuration:
+
+            pcps::DeviceCloud outputDeviceCloud(outputNormalCloud, *context);
+            REQUIRE(normalExtractor.extract(inputPointDeviceCloud, outputDeviceCloud, *context));
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            bool success = normalExtractor.extract(inputPointDeviceCloud, outputDeviceCloud, *context);
+            success &= outputDeviceCloud.updateHostCloud(*context);
+
+            auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+            REQUIRE(success);
+            elapsedMcs[useLocalMemory] = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        }
+
+        REQUIRE(areSimilarClouds(normalClouds[1], normalClouds[0], 0, 1e-3f));
+        std::cout << "NormalExtractor search radius " << searchRadius << " elapsed mcs: " << elapsedMcs[0] <<
+                     " (global memory) " << elapsedMcs[1] << " (local memory)" << std::endl;
+    }
+}
+
+TEST_CASE("NormalExtractor stencils")
+{
+    // 640x480 depth camera like frame, with some invalid points:
+
+    pcps::Cloud inputPointCloud;
+    inputPointCloud.width = 640;
+    inputPointCloud.height = 480;
+
+    for(int row = 0; row < inputPointCloud.height; ++row)
+    {
+        for(int col = 0; col < inputPointCloud.width; ++col)
+        {
+            if((row * 7 + col * 13) % 97 == 0)
+            {
+                inputPointCloud.points.push_back(pcps::Point::invalid());
+            }
+            else
+            {
+                float z = 1 + (0.001f * std::sin(col * 0.05f) * std::cos(row * 0.03f));
+                inputPointCloud.points.push_back(pcps::Point{ col * 0.01f, row * 0.01f, z, 0 });
+            }
+        }
+    }
+
+    using CpuInstructions = pcps::NormalExtractor::CpuInstructions;
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    REQUIRE(context->setThreads(1));
+
+    pcps::NormalExtractor normalExtractor;
+
+    for(int neighborLevels : { 1, 2, 3, 5, 8, 9 })
+    {
+        REQUIRE(normalExtractor.setSearchRadius((neighborLevels + 0.5f) * 0.01f));
+
+        // Vector instructions use the generic circle stencil:
+
+        pcps::Cloud expectedNormalCloud;
+        REQUIRE(normalExtractor.setCpuInstructions(pcps::NormalExtractor::getMaxCpuInstructions()));
+        REQUIRE(normalExtractor.extract(inputPointCloud, expectedNormalCloud, *context));
+
+        pcps::Cloud outputNormalCloud;
+        REQUIRE(normalExtractor.setCpuInstructions(CpuInstructions::SCALAR));
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = normalExtractor.extract(inputPointCloud, outputNormalCloud, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success);
+        REQUIRE(areSimilarClouds(outputNormalCloud, expectedNormalCloud, 0, 1e-4f));
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "NormalExtractor scalar " << neighborLevels << " neighbor levels elapsed mcs: " << elapsedMcs <<
+                     std::endl;
+    }
+}
+
 TEST_CASE("NormalSplitter 1x1")
 {
     pcps::Cloud inputNormalCloud;
@@ -142,6 +619,102 @@ TEST_CASE("NormalSplitter")
     std::cout << "NormalSplitter elapsed mcs with DeviceCloud: " << elapsedMcs << std::endl;
 }
 
+TEST_CASE("NormalSplitter threads")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_splitter";
+    pcps::Cloud inputNormalCloud = loadNormalCloud(testDataPath + "/input.txt");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    REQUIRE(context->setThreads(1));
+
+    pcps::NormalSplitter normalSplitter;
+    std::vector<pcps::NormalRegion> expectedNormalRegions;
+    REQUIRE(normalSplitter.split(inputNormalCloud, expectedNormalRegions, *context));
+
+    for(int threads : { 1, 2, 3, 4, 16 })
+    {
+        REQUIRE(context->setThreads(threads));
+
+        std::vector<pcps::NormalRegion> outputNormalRegions;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = normalSplitter.split(inputNormalCloud, outputNormalRegions, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success);
+        REQUIRE(outputNormalRegions == expectedNormalRegions);
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "NormalSplitter " << threads << " threads elapsed mcs: " << elapsedMcs << std::endl;
+    }
+
+    pcps::DeviceCloud inputNormalDeviceCloud(inputNormalCloud, *context);
+    pcps::NormalSplitterWorkspace workspace;
+
+    for(int threads : { 16, 2, 4, 4 })
+    {
+        REQUIRE(context->setThreads(threads));
+
+        std::vector<pcps::NormalRegion> outputNormalRegions;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool success = normalSplitter.split(inputNormalDeviceCloud, outputNormalRegions, workspace, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success);
+        REQUIRE(outputNormalRegions == expectedNormalRegions);
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "NormalSplitter " << threads << " threads with workspace elapsed mcs: " << elapsedMcs <<
+                     std::endl;
+    }
+}
+
+TEST_CASE("NormalSplitter 2048x2048")
+{
+    // Four quadrants with normals tilted 0, 20, 40 and 60 degrees around the x axis:
+
+    int size = 2048;
+    int halfSize = size / 2;
+    pcps::Cloud inputNormalCloud;
+    inputNormalCloud.width = size;
+    inputNormalCloud.height = size;
+    inputNormalCloud.points.reserve(std::size_t(size * size));
+
+    std::vector<pcps::Point> quadrantNormals;
+
+    for(int quadrant = 0; quadrant < 4; ++quadrant)
+    {
+        float angle = (quadrant * 20 * 3.14159265f) / 180;
+        quadrantNormals.push_back(pcps::Point{ 0, std::sin(angle), std::cos(angle), 1 });
+    }
+
+    for(int y = 0; y < size; ++y)
+    {
+        for(int x = 0; x < size; ++x)
+        {
+            int quadrant = (x / halfSize) + ((y / halfSize) * 2);
+            inputNormalCloud.points.push_back(quadrantNormals[std::size_t(quadrant)]);
+        }
+    }
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    std::vector<pcps::NormalRegion> outputNormalRegions;
+    pcps::NormalSplitter normalSplitter;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    bool success = normalSplitter.split(inputNormalCloud, outputNormalRegions, *context);
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    REQUIRE(success);
+    REQUIRE(outputNormalRegions.size() == 4);
+
+    for(const pcps::NormalRegion& normalRegion : outputNormalRegions)
+    {
+        REQUIRE(normalRegion.width == halfSize);
+        REQUIRE(normalRegion.height == halfSize);
+
+        int quadrant = (normalRegion.x / halfSize) + ((normalRegion.y / halfSize) * 2);
+        REQUIRE(normalRegion.normal.isEqualTo(quadrantNormals[std::size_t(quadrant)], 1e-4f));
+    }
+
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "NormalSplitter 2048x2048 elapsed mcs: " << elapsedMcs << std::endl;
+}
+
 TEST_CASE("NormalMerger 0")
 {
     std::vector<pcps::NormalRegion> inputNormalRegions;
@@ -180,6 +753,270 @@ TEST_CASE("NormalMerger")
     std::cout << "NormalMerger elapsed mcs: " << elapsedMcs << std::endl;
 }
 
+TEST_CASE("NormalMerger overlapping regions")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_merger";
+    std::vector<pcps::NormalRegion> inputNormalRegions = loadNormalRegions(testDataPath + "/input.txt");
+    pcps::NormalMerger normalMerger;
+    REQUIRE(! normalMerger.getDisjointRegions());
+    REQUIRE(pcps::PlaneSegmentator().normalMerger.getDisjointRegions());
+
+    normalMerger.setDisjointRegions(true);
+
+    std::vector<pcps::Plane> expectedPlanes;
+    normalMerger.merge(inputNormalRegions, expectedPlanes);
+
+    normalMerger.setDisjointRegions(false);
+
+    std::vector<pcps::Plane> outputPlanes;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    normalMerger.merge(inputNormalRegions, outputPlanes);
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    REQUIRE(outputPlanes.size() == expectedPlanes.size());
+
+    for(std::size_t index = 0; index < outputPlanes.size(); ++index)
+    {
+        REQUIRE(outputPlanes[index].regions == expectedPlanes[index].regions);
+    }
+
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "NormalMerger overlapping regions elapsed mcs: " << elapsedMcs << std::endl;
+
+    // The second region overwrites the right half of the first one, and the third one only touches the second one:
+
+    inputNormalRegions.clear();
+    inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 0, 0, 4, 4 });
+    inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 1, 0, 1 }, 2, 0, 4, 4 });
+    inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 6, 0, 2, 4 });
+    normalMerger.merge(inputNormalRegions, outputPlanes);
+    REQUIRE(outputPlanes.size() == 3);
+}
+
+TEST_CASE("NormalMerger zero area regions")
+{
+    // Zero-area regions don't touch any other region, so they don't belong to any plane:
+
+    for(bool disjointRegions : { false, true })
+    {
+        for(auto mergeOrder : { pcps::NormalMerger::MergeOrder::GREEDY,
+                                pcps::NormalMerger::MergeOrder::PRIORITY_QUEUE,
+                                pcps::NormalMerger::MergeOrder::PARALLEL })
+        {
+            pcps::NormalMerger normalMerger;
+            normalMerger.setDisjointRegions(disjointRegions);
+            REQUIRE(normalMerger.setMergeOrder(mergeOrder));
+
+            std::vector<pcps::NormalRegion> inputNormalRegions;
+            inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 0, 0, 0, 4 });
+            inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 1, 0, 1 }, 4, 0, 4, 0 });
+
+            std::vector<pcps::Plane> outputPlanes;
+            normalMerger.merge(inputNormalRegions, outputPlanes);
+            REQUIRE(outputPlanes.empty());
+
+            inputNormalRegions.clear();
+            inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 0, 0, 4, 4 });
+            inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 4, 0, 0, 4 });
+            inputNormalRegions.push_back(pcps::NormalRegion{ pcps::Point{ 0, 0, 1, 1 }, 4, 0, 4, 4 });
+            normalMerger.merge(inputNormalRegions, outputPlanes);
+            REQUIRE(outputPlanes.size() == 1);
+            REQUIRE(outputPlanes[0].regions.size() == 2);
+            REQUIRE(outputPlanes[0].regions[0] == inputNormalRegions[0]);
+            REQUIRE(outputPlanes[0].regions[1] == inputNormalRegions[2]);
+        }
+    }
+}
+
+TEST_CASE("NormalMerger priority queue")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_merger";
+    std::vector<pcps::NormalRegion> inputNormalRegions = loadNormalRegions(testDataPath + "/input.txt");
+    pcps::NormalMerger normalMerger;
+    REQUIRE(normalMerger.setMergeOrder(pcps::NormalMerger::MergeOrder::PRIORITY_QUEUE));
+
+    std::vector<pcps::Plane> outputPlanes;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    normalMerger.merge(inputNormalRegions, outputPlanes);
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    REQUIRE(outputPlanes.size() == 135);
+
+    std::size_t numRegions = 0;
+
+    for(const pcps::Plane& plane : outputPlanes)
+    {
+        numRegions += plane.regions.size();
+    }
+
+    REQUIRE(numRegions == inputNormalRegions.size());
+
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "NormalMerger priority queue elapsed mcs: " << elapsedMcs << std::endl;
+
+    // Normals tilted 0, 20 and -10 degrees: the third region can only be merged after the first two are merged:
+
+    inputNormalRegions.clear();
+
+    for(int index = 0; index < 3; ++index)
+    {
+        float angle = (float(index == 0 ? 0 : index == 1 ? 20 : -10) * 3.14159265f) / 180;
+        pcps::Point normal{ 0, std::sin(angle), std::cos(angle), 1 };
+        inputNormalRegions.push_back(pcps::NormalRegion{ normal, index * 4, 0, 4, 4 });
+    }
+
+    for(auto mergeOrder : { pcps::NormalMerger::MergeOrder::GREEDY,
+                            pcps::NormalMerger::MergeOrder::PRIORITY_QUEUE })
+    {
+        REQUIRE(normalMerger.setMergeOrder(mergeOrder));
+        REQUIRE(normalMerger.setStdDsvThresholds((5 * 3.14159265f) / 180, (25 * 3.14159265f) / 180));
+        normalMerger.merge(inputNormalRegions, outputPlanes);
+        REQUIRE(outputPlanes.size() == 1);
+    }
+}
+
+TEST_CASE("NormalMerger parallel")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/normal_merger";
+    std::vector<pcps::NormalRegion> inputNormalRegions = loadNormalRegions(testDataPath + "/input.txt");
+    pcps::NormalMerger normalMerger;
+    std::vector<pcps::Plane> greedyPlanes;
+    normalMerger.merge(inputNormalRegions, greedyPlanes);
+
+    float greedyMeanAngle = getPlanesMeanAngle(greedyPlanes);
+    std::cout << "NormalMerger greedy planes: " << greedyPlanes.size() << ", mean angle: " << greedyMeanAngle <<
+                 std::endl;
+
+    REQUIRE(normalMerger.setMergeOrder(pcps::NormalMerger::MergeOrder::PARALLEL));
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    std::vector<pcps::Plane> expectedPlanes;
+
+    for(int threads : { 1, 2, 4 })
+    {
+        REQUIRE(context->setThreads(threads));
+
+        std::vector<pcps::Plane> outputPlanes;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        normalMerger.merge(inputNormalRegions, outputPlanes, *context);
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        std::size_t numRegions = 0;
+
+        for(const pcps::Plane& plane : outputPlanes)
+        {
+            numRegions += plane.regions.size();
+        }
+
+        REQUIRE(numRegions == inputNormalRegions.size());
+
+        // Merge quality is measured by the area-weighted mean angle between each region normal
+        // and the mean normal of its plane, which must be close to the greedy one with a similar planes count:
+
+        float meanAngle = getPlanesMeanAngle(outputPlanes);
+        REQUIRE(meanAngle < greedyMeanAngle * 1.25f);
+        REQUIRE(outputPlanes.size() * 4 < greedyPlanes.size() * 5);
+        REQUIRE(outputPlanes.size() * 5 > greedyPlanes.size() * 4);
+
+        if(expectedPlanes.empty())
+        {
+            expectedPlanes = outputPlanes;
+        }
+        else
+        {
+            REQUIRE(outputPlanes.size() == expectedPlanes.size());
+
+            for(std::size_t index = 0; index < outputPlanes.size(); ++index)
+            {
+                REQUIRE(outputPlanes[index].regions == expectedPlanes[index].regions);
+            }
+        }
+
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "NormalMerger parallel " << threads << " threads planes: " << outputPlanes.size() <<
+                     ", mean angle: " << meanAngle << ", elapsed mcs: " << elapsedMcs << ", rounds elapsed mcs:";
+
+        for(std::int64_t roundElapsedMcs : normalMerger.getLastRoundsElapsedMcs())
+        {
+            std::cout << ' ' << roundElapsedMcs;
+        }
+
+        std::cout << std::endl;
+    }
+}
+
+TEST_CASE("NormalMerger merge orders")
+{
+    // Grids of square regions in four quadrants with normals tilted 0, 40, 80 and 120 degrees around the x axis,
+    // plus up to one degree of noise. Cluttered grids replace a third of the regions with unrelated normals:
+
+    for(bool clutter : { false, true })
+    {
+        for(int regionsPerSide : { 32, 64, 128 })
+        {
+            std::vector<pcps::NormalRegion> inputNormalRegions;
+            int halfRegionsPerSide = regionsPerSide / 2;
+
+            for(int y = 0; y < regionsPerSide; ++y)
+            {
+                for(int x = 0; x < regionsPerSide; ++x)
+                {
+                    int quadrant = (x / halfRegionsPerSide) + ((y / halfRegionsPerSide) * 2);
+                    auto hash = int(((unsigned(x) * 73856093u) ^ (unsigned(y) * 19349663u)) & 1023u);
+                    float noise = float(((x * 7) + (y * 13)) % 5 - 2) / 2;
+                    float xAngle = ((quadrant * 40 + noise) * 3.14159265f) / 180;
+                    float yAngle = 0;
+
+                    if(clutter && hash % 3 == 0)
+                    {
+                        xAngle = (float(hash % 360) * 3.14159265f) / 180;
+                        yAngle = (float((hash / 3) % 360) * 3.14159265f) / 180;
+                    }
+
+                    pcps::Point normal{ std::sin(yAngle) * std::cos(xAngle), std::sin(xAngle),
+                                        std::cos(yAngle) * std::cos(xAngle), 1 };
+                    inputNormalRegions.push_back(pcps::NormalRegion{ normal, x * 4, y * 4, 4, 4 });
+                }
+            }
+
+            for(auto mergeOrder : { pcps::NormalMerger::MergeOrder::GREEDY,
+                                    pcps::NormalMerger::MergeOrder::PRIORITY_QUEUE,
+                                    pcps::NormalMerger::MergeOrder::PARALLEL })
+            {
+                pcps::NormalMerger normalMerger;
+                REQUIRE(normalMerger.setMergeOrder(mergeOrder));
+
+                std::vector<pcps::Plane> outputPlanes;
+                auto startTime = std::chrono::high_resolution_clock::now();
+                normalMerger.merge(inputNormalRegions, outputPlanes);
+                auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+                std::size_t numRegions = 0;
+
+                for(const pcps::Plane& plane : outputPlanes)
+                {
+                    numRegions += plane.regions.size();
+
+                    if(! clutter)
+                    {
+                        REQUIRE(int(plane.regions.size()) == halfRegionsPerSide * halfRegionsPerSide);
+                    }
+                }
+
+                REQUIRE(numRegions == inputNormalRegions.size());
+
+                if(! clutter)
+                {
+                    REQUIRE(outputPlanes.size() == 4);
+                }
+
+                auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+                const char* mergeOrderName = mergeOrder == pcps::NormalMerger::MergeOrder::GREEDY ?
+                            "greedy" : mergeOrder == pcps::NormalMerger::MergeOrder::PRIORITY_QUEUE ?
+                                "priority queue" : "parallel";
+                std::cout << "NormalMerger " << mergeOrderName << (clutter ? " cluttered " : " ") <<
+                             inputNormalRegions.size() << " regions elapsed mcs: " << elapsedMcs << std::endl;
+            }
+        }
+    }
+}
+
 TEST_CASE("PlaneSegmentator disorganized")
 {
     std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
@@ -229,3 +1066,428 @@ TEST_CASE("PlaneSegmentator organized")
     elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
     std::cout << "PlaneSegmentator organized elapsed mcs with DeviceCloud: " << elapsedMcs << std::endl;
 }
+
+TEST_CASE("PlaneSegmentator fused normal statistics")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::PlaneSegmentator planeSegmentator;
+    planeSegmentator.setStoreIntermediateResults(true);
+    planeSegmentator.setFuseNormalStatistics(false);
+
+    std::vector<pcps::Plane> expectedPlanes;
+    REQUIRE(planeSegmentator.segmentate(inputPointCloud, expectedPlanes, *context));
+
+    std::vector<pcps::NormalRegion> expectedNormalRegions = planeSegmentator.getLastNormalSplitResult();
+    std::int64_t elapsedMcs = planeSegmentator.getLastNormalExtractionElapsedMcs() +
+            planeSegmentator.getLastNormalSplitElapsedMcs();
+    std::cout << "PlaneSegmentator unfused normal statistics extraction and split elapsed mcs: " << elapsedMcs <<
+                 std::endl;
+
+    planeSegmentator.setFuseNormalStatistics(true);
+
+    std::vector<pcps::Plane> outputPlanes;
+    REQUIRE(planeSegmentator.segmentate(inputPointCloud, outputPlanes, *context));
+    REQUIRE(planeSegmentator.getLastNormalSplitResult() == expectedNormalRegions);
+    REQUIRE(outputPlanes.size() == expectedPlanes.size());
+
+    for(std::size_t index = 0; index < outputPlanes.size(); ++index)
+    {
+        REQUIRE(outputPlanes[index].regions == expectedPlanes[index].regions);
+    }
+
+    elapsedMcs = planeSegmentator.getLastNormalExtractionElapsedMcs() +
+            planeSegmentator.getLastNormalSplitElapsedMcs();
+    std::cout << "PlaneSegmentator fused normal statistics extraction and split elapsed mcs: " << elapsedMcs <<
+                 std::endl;
+}
+
+TEST_CASE("PlaneSegmentator batch")
+{
+    // Split a cloud into 64x64 patches:
+
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    int patchSize = 64;
+    std::vector<pcps::Cloud> inputPointClouds;
+
+    for(int patchY = 0; patchY + patchSize <= inputPointCloud.height; patchY += patchSize)
+    {
+        for(int patchX = 0; patchX + patchSize <= inputPointCloud.width; patchX += patchSize)
+        {
+            pcps::Cloud patch;
+            patch.width = patchSize;
+            patch.height = patchSize;
+            patch.sensorOrigin = inputPointCloud.sensorOrigin;
+
+            for(int y = patchY; y < patchY + patchSize; ++y)
+            {
+                for(int x = patchX; x < patchX + patchSize; ++x)
+                {
+                    patch.points.push_back(inputPointCloud.at(x, y));
+                }
+            }
+
+            inputPointClouds.push_back(std::move(patch));
+        }
+    }
+
+    REQUIRE(! inputPointClouds.empty());
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::PlaneSegmentator planeSegmentator;
+    std::vector<std::vector<pcps::Plane>> expectedPlanes(inputPointClouds.size());
+    std::vector<bool> expectedSuccesses;
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for(std::size_t index = 0; index < inputPointClouds.size(); ++index)
+    {
+        expectedSuccesses.push_back(planeSegmentator.segmentate(inputPointClouds[index], expectedPlanes[index],
+                                                                *context));
+    }
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "PlaneSegmentator " << inputPointClouds.size() << " patches one by one elapsed mcs: " <<
+                 elapsedMcs << std::endl;
+
+    bool expectedSuccess = std::all_of(expectedSuccesses.begin(), expectedSuccesses.end(),
+                                       [](bool success) { return success; });
+
+    for(int threads : { 1, 4 })
+    {
+        REQUIRE(context->setThreads(threads));
+
+        std::vector<std::vector<pcps::Plane>> outputPlanes;
+        startTime = std::chrono::high_resolution_clock::now();
+
+        bool success = planeSegmentator.segmentate(inputPointClouds, outputPlanes, *context);
+        elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        REQUIRE(success == expectedSuccess);
+        REQUIRE(outputPlanes.size() == inputPointClouds.size());
+
+        for(std::size_t index = 0; index < inputPointClouds.size(); ++index)
+        {
+            if(expectedSuccesses[index])
+            {
+                REQUIRE(outputPlanes[index].size() == expectedPlanes[index].size());
+
+                for(std::size_t planeIndex = 0; planeIndex < expectedPlanes[index].size(); ++planeIndex)
+                {
+                    REQUIRE(outputPlanes[index][planeIndex].regions == expectedPlanes[index][planeIndex].regions);
+                }
+            }
+        }
+
+        elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "PlaneSegmentator " << inputPointClouds.size() << " patches batch " << threads <<
+                     " threads elapsed mcs: " << elapsedMcs << std::endl;
+    }
+}
+
+TEST_CASE("PlaneSegmentator workspaces")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::PlaneSegmentator planeSegmentator;
+    planeSegmentator.setStoreIntermediateResults(true);
+
+    std::vector<pcps::Plane> expectedPlanes;
+    REQUIRE(planeSegmentator.segmentate(inputPointCloud, expectedPlanes, *context));
+
+    // One const segmentator shared by many threads, each one of them with its own workspace:
+
+    const pcps::PlaneSegmentator& sharedPlaneSegmentator = planeSegmentator;
+    std::size_t numThreads = context->isThreadSafe() ? 4 : 1;
+    std::vector<pcps::PlaneSegmentationWorkspace> workspaces(numThreads);
+    std::vector<std::vector<pcps::Plane>> outputPlanes(workspaces.size());
+    std::vector<int> successes(workspaces.size(), 0);
+    std::vector<std::thread> threads;
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for(std::size_t index = 0; index < workspaces.size(); ++index)
+    {
+        threads.emplace_back([&, index]
+        {
+            successes[index] = sharedPlaneSegmentator.segmentate(inputPointCloud, outputPlanes[index],
+                                                                 workspaces[index], *context);
+        });
+    }
+
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+
+    for(std::size_t index = 0; index < workspaces.size(); ++index)
+    {
+        REQUIRE(successes[index]);
+        REQUIRE(workspaces[index].getLastNormalSplitResult() == planeSegmentator.getLastNormalSplitResult());
+        REQUIRE(outputPlanes[index].size() == expectedPlanes.size());
+
+        for(std::size_t planeIndex = 0; planeIndex < expectedPlanes.size(); ++planeIndex)
+        {
+            REQUIRE(outputPlanes[index][planeIndex].regions == expectedPlanes[planeIndex].regions);
+        }
+    }
+
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "PlaneSegmentator " << numThreads << " threads with workspaces elapsed mcs: " << elapsedMcs <<
+                 std::endl;
+
+    // Threads start from a cold context, which creates its thread pool on demand,
+    // and its threads count changes while they are segmentating:
+
+    std::unique_ptr<pcps::Context> coldContext = pcps::Context::buildDefault();
+
+    if(coldContext->isThreadSafe())
+    {
+        std::vector<pcps::PlaneSegmentationWorkspace> coldWorkspaces(4);
+        std::vector<std::vector<pcps::Plane>> coldOutputPlanes(coldWorkspaces.size());
+        std::vector<int> coldSuccesses(coldWorkspaces.size(), 0);
+        threads.clear();
+
+        for(std::size_t index = 0; index < coldWorkspaces.size(); ++index)
+        {
+            threads.emplace_back([&, index]
+            {
+                coldSuccesses[index] = sharedPlaneSegmentator.segmentate(inputPointCloud, coldOutputPlanes[index],
+                                                                         coldWorkspaces[index], *coldContext);
+            });
+        }
+
+        for(int threadsCount = 1; threadsCount <= 8; ++threadsCount)
+        {
+            REQUIRE(coldContext->setThreads(threadsCount));
+            std::this_thread::yield();
+        }
+
+        for(std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        for(std::size_t index = 0; index < coldWorkspaces.size(); ++index)
+        {
+            REQUIRE(coldSuccesses[index]);
+            REQUIRE(coldOutputPlanes[index].size() == expectedPlanes.size());
+        }
+    }
+}
+
+TEST_CASE("Context warm up")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    pcps::PlaneSegmentator planeSegmentator;
+    std::vector<pcps::Plane> expectedPlanes;
+    std::string programCacheFolderPath = createTemporaryFolder();
+
+    {
+        std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+
+        #ifdef PCPS_OPENCL
+            REQUIRE(! context->setProgramCacheDirectory(testDataPath + "/missing/folder"));
+            REQUIRE(context->setProgramCacheDirectory(programCacheFolderPath));
+            REQUIRE(context->getProgramCacheDirectory() == programCacheFolderPath);
+        #endif
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        REQUIRE(planeSegmentator.segmentate(inputPointCloud, expectedPlanes, *context));
+
+        auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "Context first frame without warm up elapsed mcs: " << elapsedMcs << std::endl;
+    }
+
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+
+    #ifdef PCPS_OPENCL
+        // The input cloud size is fixed, so programs can be specialized for it:
+        REQUIRE(! context->specializeCloudGeometry());
+        context->setSpecializeCloudGeometry(true);
+        REQUIRE(context->setProgramCacheDirectory(programCacheFolderPath));
+    #endif
+
+    // The input cloud retrieves 7 neighbor levels with the default normal extractor search radius:
+    int neighborLevels = 7;
+    REQUIRE(! context->warmUp(0, inputPointCloud.height, neighborLevels));
+    REQUIRE(! context->warmUp(inputPointCloud.width, inputPointCloud.height, 0));
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    REQUIRE(context->warmUp(inputPointCloud.width, inputPointCloud.height, neighborLevels));
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "Context warm up elapsed mcs: " << elapsedMcs << std::endl;
+
+    #ifdef PCPS_OPENCL
+        std::cout << "Context warm up program cache disk hits: " << context->getProgramCacheDiskHits() <<
+                     ", builds: " << context->getProgramBuilds() << std::endl;
+    #endif
+
+    std::vector<pcps::Plane> outputPlanes;
+    startTime = std::chrono::high_resolution_clock::now();
+    REQUIRE(planeSegmentator.segmentate(inputPointCloud, outputPlanes, *context));
+
+    elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "Context first frame with warm up elapsed mcs: " << elapsedMcs << std::endl;
+    REQUIRE(outputPlanes.size() == expectedPlanes.size());
+
+    for(std::size_t index = 0; index < expectedPlanes.size(); ++index)
+    {
+        REQUIRE(outputPlanes[index].regions == expectedPlanes[index].regions);
+    }
+
+    removeFolder(programCacheFolderPath);
+}
+
+TEST_CASE("Context calibration")
+{
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    REQUIRE(! context->setSplitterMaxCpuRegionArea(0));
+    REQUIRE(context->setSplitterMaxCpuRegionArea(128 * 128));
+    REQUIRE(context->getSplitterMaxCpuRegionArea() == 128 * 128);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    REQUIRE(context->calibrate());
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "Context calibration splitter max CPU region area: " << context->getSplitterMaxCpuRegionArea() <<
+                 " (elapsed mcs: " << elapsedMcs << ")" << std::endl;
+
+    std::string calibrationFolderPath = createTemporaryFolder();
+    std::string calibrationFilePath = calibrationFolderPath + "/calibration.txt";
+    REQUIRE(context->saveCalibration(calibrationFilePath));
+
+    std::unique_ptr<pcps::Context> loadedContext = pcps::Context::buildDefault();
+    REQUIRE(! loadedContext->loadCalibration(std::string(PCPS_TEST_DATA_FOLDER) + "/organizer/input.pcd"));
+    REQUIRE(loadedContext->loadCalibration(calibrationFilePath));
+    REQUIRE(loadedContext->getSplitterMaxCpuRegionArea() == context->getSplitterMaxCpuRegionArea());
+    removeFolder(calibrationFolderPath);
+}
+
+TEST_CASE("PlaneSegmentationPipeline")
+{
+    std::string testDataPath = std::string(PCPS_TEST_DATA_FOLDER) + "/organizer";
+    pcps::Cloud inputPointCloud = loadPointCloud(testDataPath + "/expected.pcd");
+    std::unique_ptr<pcps::Context> context = pcps::Context::buildDefault();
+    pcps::PlaneSegmentator planeSegmentator;
+    std::vector<pcps::Plane> expectedPlanes;
+    REQUIRE(planeSegmentator.segmentate(inputPointCloud, expectedPlanes, *context));
+
+    const int frames = 8;
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for(int frame = 0; frame < frames; ++frame)
+    {
+        std::vector<pcps::Plane> outputPlanes;
+        REQUIRE(planeSegmentator.segmentate(inputPointCloud, outputPlanes, *context));
+    }
+
+    auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+    auto elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+    std::cout << "PlaneSegmentationPipeline synchronous " << frames << " frames elapsed mcs: " << elapsedMcs <<
+                 std::endl;
+
+    {
+        pcps::PlaneSegmentationPipeline pipeline(planeSegmentator, *context);
+        REQUIRE(! pipeline.setQueueCapacity(0));
+        REQUIRE(pipeline.setQueueCapacity(2));
+
+        std::vector<std::future<pcps::PlaneSegmentationResult>> futures;
+        startTime = std::chrono::high_resolution_clock::now();
+
+        for(int frame = 0; frame < frames; ++frame)
+        {
+            futures.push_back(pipeline.submit(inputPointCloud));
+        }
+
+        int maxQueueDepth = 0;
+
+        for(auto stage : { pcps::PlaneSegmentationPipeline::Stage::ORGANIZATION,
+                           pcps::PlaneSegmentationPipeline::Stage::NORMAL_EXTRACTION,
+                           pcps::PlaneSegmentationPipeline::Stage::NORMAL_SPLIT,
+                           pcps::PlaneSegmentationPipeline::Stage::NORMAL_MERGE })
+        {
+            maxQueueDepth = std::max(maxQueueDepth, pipeline.getQueueDepth(stage));
+        }
+
+        REQUIRE(maxQueueDepth <= pipeline.getQueueCapacity());
+
+        for(int frame = 0; frame < frames; ++frame)
+        {
+            pcps::PlaneSegmentationResult result = futures[std::size_t(frame)].get();
+            REQUIRE(result.success);
+            REQUIRE(! result.dropped);
+            REQUIRE(result.frameIndex == std::uint64_t(frame));
+            REQUIRE(result.planes.size() == expectedPlanes.size());
+
+            for(std::size_t index = 0; index < expectedPlanes.size(); ++index)
+            {
+                REQUIRE(result.planes[index].regions == expectedPlanes[index].regions);
+            }
+        }
+
+        elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+        elapsedMcs = std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count();
+        std::cout << "PlaneSegmentationPipeline " << frames << " frames elapsed mcs: " << elapsedMcs <<
+                     ", last latency mcs: " << pipeline.getLastLatencyMcs() << std::endl;
+        REQUIRE(pipeline.getDroppedFrames() == 0);
+    }
+
+    // Dropped frames are reported as such, and the rest are segmented as usual:
+
+    for(auto backpressure : { pcps::PlaneSegmentationPipeline::Backpressure::DROP_OLDEST,
+                              pcps::PlaneSegmentationPipeline::Backpressure::DROP_NEWEST })
+    {
+        pcps::PlaneSegmentationPipeline pipeline(planeSegmentator, *context);
+        REQUIRE(pipeline.setQueueCapacity(1));
+        REQUIRE(pipeline.setBackpressure(backpressure));
+
+        std::mutex resultsMutex;
+        std::vector<pcps::PlaneSegmentationResult> results;
+
+        for(int frame = 0; frame < frames; ++frame)
+        {
+            pipeline.submit(inputPointCloud, [&resultsMutex, &results](pcps::PlaneSegmentationResult& result)
+            {
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                results.push_back(std::move(result));
+            });
+        }
+
+        pipeline.wait();
+        REQUIRE(results.size() == std::size_t(frames));
+
+        std::uint64_t droppedFrames = 0;
+
+        for(const pcps::PlaneSegmentationResult& result : results)
+        {
+            if(result.dropped)
+            {
+                REQUIRE(! result.success);
+                ++droppedFrames;
+            }
+            else
+            {
+                REQUIRE(result.success);
+                REQUIRE(result.planes.size() == expectedPlanes.size());
+            }
+        }
+
+        REQUIRE(droppedFrames < std::uint64_t(frames));
+        REQUIRE(pipeline.getDroppedFrames() == droppedFrames);
+
+        const char* backpressureName = backpressure == pcps::PlaneSegmentationPipeline::Backpressure::DROP_OLDEST ?
+                    "drop oldest" : "drop newest";
+        std::cout << "PlaneSegmentationPipeline " << backpressureName << " dropped frames: " << droppedFrames <<
+                     std::endl;
+    }
+}
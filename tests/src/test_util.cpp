@@ -6,9 +6,16 @@
 
 #include "test_util.h"
 
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
 #include <pcl/io/pcd_io.h>
 #include "catch.hpp"
 #include "pcps_pcl.h"
+#include "pcps_plane.h"
 #include "pcps_epsilon.h"
 #include "pcps_normal_region.h"
 
@@ -217,3 +224,80 @@ bool areSimilarClouds(const pcps::Cloud& a, const pcps::Cloud& b, int maxDiffere
 
     return differentPoints <= maxDifferentPoints;
 }
+
+std::string createTemporaryFolder()
+{
+    const char* temporaryFolderPath = std::getenv("TMPDIR");
+    std::string folderPathTemplate = std::string(temporaryFolderPath ? temporaryFolderPath : "/tmp") +
+            "/pcps_test_XXXXXX";
+    std::vector<char> folderPath(folderPathTemplate.begin(), folderPathTemplate.end());
+    folderPath.push_back(0);
+    REQUIRE(mkdtemp(folderPath.data()));
+    return std::string(folderPath.data());
+}
+
+void removeFolder(const std::string& folderPath)
+{
+    DIR* folder = opendir(folderPath.c_str());
+    REQUIRE(folder);
+
+    while(dirent* entry = readdir(folder))
+    {
+        std::string fileName = entry->d_name;
+
+        if(fileName != "." && fileName != "..")
+        {
+            REQUIRE(std::remove((folderPath + '/' + fileName).c_str()) == 0);
+        }
+    }
+
+    closedir(folder);
+    REQUIRE(rmdir(folderPath.c_str()) == 0);
+}
+
+float getPlanesMeanAngle(const std::vector<pcps::Plane>& planes)
+{
+    double angleSum = 0;
+    double areaSum = 0;
+
+    for(const pcps::Plane& plane : planes)
+    {
+        double meanX = 0;
+        double meanY = 0;
+        double meanZ = 0;
+
+        for(const pcps::NormalRegion& normalRegion : plane.regions)
+        {
+            double area = double(normalRegion.width) * normalRegion.height;
+            meanX += normalRegion.normal.x * area;
+            meanY += normalRegion.normal.y * area;
+            meanZ += normalRegion.normal.z * area;
+        }
+
+        double meanLength = std::sqrt((meanX * meanX) + (meanY * meanY) + (meanZ * meanZ));
+
+        if(meanLength < pcps::epsilon)
+        {
+            continue;
+        }
+
+        for(const pcps::NormalRegion& normalRegion : plane.regions)
+        {
+            const pcps::Point& normal = normalRegion.normal;
+            double normalLength = std::sqrt((normal.x * normal.x) + (normal.y * normal.y) + (normal.z * normal.z));
+
+            if(normalLength < pcps::epsilon)
+            {
+                continue;
+            }
+
+            double area = double(normalRegion.width) * normalRegion.height;
+            double cosine = ((normal.x * meanX) + (normal.y * meanY) + (normal.z * meanZ)) /
+                    (normalLength * meanLength);
+            angleSum += std::acos(std::max(-1.0, std::min(cosine, 1.0))) * area;
+            areaSum += area;
+        }
+    }
+
+    return areaSum > 0 ? float(angleSum / areaSum) : 0;
+}